@@ -0,0 +1,133 @@
+
+#include "async-client.h"
+#include "bytes.h"
+#include "exception.h"
+#include "message.h"
+#include "question.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace dns;
+
+static const size_t max_in_flight = 8192;
+
+AsyncClient::AsyncClient(Upstream upstream) :
+    m_random(std::random_device()())
+{
+    m_sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (m_sockfd == -1) {
+        throw dns::Exception("Could not open a new socket: ", strerror(errno));
+    }
+    int flags = fcntl(m_sockfd, F_GETFL, 0);
+    if (flags == -1 || fcntl(m_sockfd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        close(m_sockfd);
+        throw dns::Exception("Could not make socket non-blocking: ", strerror(errno));
+    }
+    // Connecting the socket means the kernel will drop datagrams from anyone but the upstream.
+    if (connect(m_sockfd, upstream.sockaddr(), upstream.sockaddr_length()) != 0) {
+        close(m_sockfd);
+        throw dns::Exception("Could not connect to upstream: ", strerror(errno));
+    }
+}
+
+AsyncClient::~AsyncClient()
+{
+    close(m_sockfd);
+}
+
+bool AsyncClient::send(const Question& q, bool rd, uint16_t& tag)
+{
+    if (m_in_flight.size() >= max_in_flight) {
+        return false;
+    }
+    uint16_t id;
+    do {
+        id = uint16_t(m_random());
+    } while (m_in_flight.find(id) != m_in_flight.end());
+
+    char buffer[512];
+    Message query = Message::beginQuery(q);
+    query.setID(id).setRD(rd);
+    const char *end = query.encode(buffer, buffer + sizeof buffer);
+    if (end == nullptr) {
+        return false;
+    }
+    int sent = ::send(m_sockfd, buffer, (end - buffer), 0);
+    if (sent != (end - buffer)) {
+        return false;
+    }
+    InFlight& f = m_in_flight[id];
+    f.question.assign(static_cast<const char *>(buffer) + 12, end);
+    f.sent = m_by_sent.emplace_hint(m_by_sent.end(), clock::now(), id);
+    tag = id;
+    return true;
+}
+
+bool AsyncClient::receive(Reply& reply)
+{
+    while (true) {
+        int nbytes = recv(m_sockfd, m_buffer, sizeof m_buffer, 0);
+        if (nbytes < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return false;
+            }
+            // e.g. ECONNREFUSED from an ICMP port-unreachable; the query
+            // it refers to will be cleaned up by expire().
+            continue;
+        }
+        uint16_t id;
+        uint16_t fields;
+        const char *end = m_buffer + nbytes;
+        const char *src = get16bits(m_buffer, end, id);
+        src = get16bits(src, end, fields);
+        if (src == nullptr || (fields & 0x8000) == 0) {
+            continue;  // too short to be a DNS message, or not a response
+        }
+        auto it = m_in_flight.find(id);
+        if (it == m_in_flight.end()) {
+            continue;  // a late reply to a query we've already given up on
+        }
+        const std::string& question = it->second.question;
+        if ((end - m_buffer) < 12 + question.size() || memcmp(m_buffer + 12, question.data(), question.size()) != 0) {
+            continue;  // the reply is not about what we asked
+        }
+        reply.tag = id;
+        reply.rtt = clock::now() - it->second.sent->first;
+        reply.packet = m_buffer;
+        reply.end = end;
+        forget(it);
+        return true;
+    }
+}
+
+std::vector<uint16_t> AsyncClient::expire(nonstd::milliseconds timeout)
+{
+    std::vector<uint16_t> result;
+    auto deadline = clock::now() - timeout;
+    while (!m_by_sent.empty() && m_by_sent.begin()->first <= deadline) {
+        uint16_t id = m_by_sent.begin()->second;
+        result.push_back(id);
+        forget(m_in_flight.find(id));
+    }
+    return result;
+}
+
+int AsyncClient::next_timeout_ms(nonstd::milliseconds timeout) const
+{
+    if (m_by_sent.empty()) {
+        return -1;
+    }
+    auto oldest = m_by_sent.begin()->first;
+    auto remaining = std::chrono::duration_cast<nonstd::milliseconds>(oldest + timeout - clock::now());
+    return (remaining.count() < 0) ? 0 : int(remaining.count()) + 1;
+}
+
+void AsyncClient::forget(std::map<uint16_t, InFlight>::iterator it)
+{
+    m_by_sent.erase(it->second.sent);
+    m_in_flight.erase(it);
+}
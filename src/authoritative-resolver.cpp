@@ -1,170 +1,1148 @@
 
 #include "authoritative-resolver.h"
+#include "bytes.h"
+#include "casefold.h"
 #include "exception.h"
 #include "message.h"
 #include "nonstd.h"
 #include "question.h"
+#include "response.h"
+#include "response-writer.h"
 #include "rr.h"
 #include "rrtype.h"
+#include "zone-writer.h"
 
+#include <algorithm>
 #include <assert.h>
+#include <atomic>
+#include <condition_variable>
+#include <ctype.h>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 using namespace dns;
 
-AuthoritativeResolver::AuthoritativeResolver(const std::string& filename)
+AuthoritativeResolver::AuthoritativeResolver(const std::string& filename, const ResolverOptions& options)
 {
     std::ifstream file(filename.data());
     if (!file) {
         throw dns::Exception("Could not open file: ", filename);
     }
 
+    if (options.compact_storage) {
+        m_compact.reset(new CompactZone);
+    }
     std::string line;
     while (!file.eof()) {
         std::getline(file, line);
         if (line.empty()) continue;
+        if (line.compare(0, 9, "$GENERATE") == 0) {
+            if (m_compact != nullptr) {
+                throw dns::Exception("$GENERATE is not supported with compact storage");
+            }
+            add_generated_range(GeneratedRange(line.data(), line.data() + line.size()));
+            continue;
+        }
         RR rr;
         const char *end = line.data() + line.size();
         const char *p = rr.decode_repr(line.data(), end);
         if (p != end) {
             throw dns::Exception("Zonefile RR contained trailing characters");
         }
-        add_rr(std::move(rr));
+        if (m_compact != nullptr) {
+            m_compact->add(rr);
+            continue;
+        }
+        if (options.intern_names) {
+            Name name = rr.name();
+            name.intern();
+            rr.set_name(name);
+        }
+        uint32_t address;
+        if (options.reverse_index && rr.rrtype() == RRType::PTR && ReverseIndex::parse_name(rr.name(), address)) {
+            m_reverse_index.add(address, std::move(rr));
+        } else {
+            add_rr(std::move(rr));
+        }
+    }
+    if (m_compact != nullptr) {
+        m_compact->finish();
+        return;
+    }
+    index_reverse_records();
+    precompute_zones(options.negative_templates);
+    resolve_additional();
+    resolve_cname_targets();
+    if (options.name_filters) {
+        build_name_filters();
+    }
+    if (options.exact_index) {
+        build_exact_index();
     }
 }
 
-void AuthoritativeResolver::print_records() const
+AuthoritativeResolver::DumpCounts AuthoritativeResolver::dump_records(int fd, int threads) const
 {
-    struct Visitor {
-        static void visit(const DomainTreeNode& node) {
-            SymbolTable syms;  // empty, will not be used
-            for (auto&& rr : node.m_rr_list) {
-                std::cout << rr.repr(syms) << std::endl;
+    if (m_compact != nullptr) {
+        ZoneWriter out(ZoneWriter::to_fd(fd));
+        m_compact->for_each([&](const Name& owner, RRType rrtype, RRClass rrclass, uint32_t ttl,
+                                const char *rdata, size_t rdlength) {
+            out.write(owner, rrtype, rrclass, ttl, rdata, rdlength);
+        });
+        out.flush();
+        DumpCounts counts;
+        counts.records = out.records();
+        counts.generated = out.directives();
+        return counts;
+    }
+
+    // Lay the tree out in preorder, visiting the children in the same
+    // order as Label::operator<, so that each subtree is a stretch of it.
+    struct Child {
+        const char *key;
+        size_t n;
+        const DomainTreeNode *node;
+    };
+    std::vector<const DomainTreeNode *> nodes;
+    std::vector<Child> stack;
+    stack.push_back(Child{"", 0, &m_root});
+    while (!stack.empty()) {
+        const DomainTreeNode *node = stack.back().node;
+        stack.pop_back();
+        nodes.push_back(node);
+        size_t first = stack.size();
+        node->m_children.for_each([&](const char *key, size_t n, const DomainTreeNode& child) {
+            stack.push_back(Child{key, n, &child});
+        });
+        std::sort(stack.begin() + first, stack.end(), [](const Child& a, const Child& b) {
+            int cmp = compare_ignoring_case(a.key, b.key, std::min(a.n, b.n));
+            return (cmp != 0) ? (cmp > 0) : (a.n > b.n);  // reversed, since the stack pops the last first
+        });
+    }
+
+    // Cut the dump into stretches of about the same number of records,
+    // several for each thread so that no thread is left with the bulk:
+    // each is the nodes [first_node, last_node) of the preorder, then the
+    // records [first_reverse, last_reverse) of the reverse index.
+    struct DumpRange {
+        size_t first_node = 0;
+        size_t last_node = 0;
+        size_t first_reverse = 0;
+        size_t last_reverse = 0;
+    };
+    size_t total = m_reverse_index.size();
+    for (const DomainTreeNode *node : nodes) {
+        total += node->m_rr_list.size() + node->m_generated.size();
+    }
+    size_t per_range = (threads <= 1) ? total : total / (4 * size_t(threads)) + 1;
+    std::vector<DumpRange> ranges(1);
+    size_t weight = 0;
+    auto cut = [&]() {
+        if (weight >= per_range) {
+            DumpRange next;
+            next.first_node = next.last_node = ranges.back().last_node;
+            next.first_reverse = next.last_reverse = ranges.back().last_reverse;
+            ranges.push_back(next);
+            weight = 0;
+        }
+    };
+    for (const DomainTreeNode *node : nodes) {
+        ranges.back().last_node += 1;
+        weight += node->m_rr_list.size() + node->m_generated.size();
+        cut();
+    }
+    for (size_t i = 0; i < m_reverse_index.size(); ++i) {
+        ranges.back().last_reverse += 1;
+        weight += 1;
+        cut();
+    }
+
+    auto dump_range = [&](const DumpRange& range, ZoneWriter& out) {
+        for (size_t i = range.first_node; i < range.last_node; ++i) {
+            for (auto&& rr : nodes[i]->m_rr_list) {
+                out.write(rr);
             }
-            for (auto&& kv : node.m_children) {
-                visit(kv.second);
+            for (const GeneratedRange *generated : nodes[i]->m_generated) {
+                out.write_line(generated->repr());
             }
         }
+        // The owner names are rebuilt once for each address.
+        Name owner;
+        bool have_owner = false;
+        uint32_t owner_address = 0;
+        m_reverse_index.for_each(range.first_reverse, range.last_reverse, [&](uint32_t address, RRClass rrclass,
+                                                                               uint32_t ttl, const char *rdata,
+                                                                               size_t rdlength) {
+            if (!have_owner || address != owner_address) {
+                owner = ReverseIndex::make_name(address);
+                owner_address = address;
+                have_owner = true;
+            }
+            out.write(owner, RRType::PTR, rrclass, ttl, rdata, rdlength);
+        });
     };
-    Visitor v;
-    v.visit(m_root);
+
+    ZoneWriter::Sink to_fd = ZoneWriter::to_fd(fd);
+    if (threads <= 1) {
+        ZoneWriter out(to_fd);
+        for (auto&& range : ranges) {
+            dump_range(range, out);
+        }
+        out.flush();
+        DumpCounts counts;
+        counts.records = out.records();
+        counts.generated = out.directives();
+        return counts;
+    }
+
+    // The workers take the stretches in order, each formatting its own
+    // into memory; this thread writes them out in order as they finish.
+    struct Chunk {
+        std::string text;
+        DumpCounts counts;
+        bool done = false;
+    };
+    std::vector<Chunk> chunks(ranges.size());
+    std::atomic<size_t> next_range(0);
+    std::mutex mutex;
+    std::condition_variable finished;
+    auto work = [&]() {
+        for (size_t i; (i = next_range++) < ranges.size(); ) {
+            std::string text;
+            ZoneWriter out([&](const char *data, size_t n) { text.append(data, n); });
+            dump_range(ranges[i], out);
+            out.flush();
+            std::lock_guard<std::mutex> lock(mutex);
+            chunks[i].text.swap(text);
+            chunks[i].counts.records = out.records();
+            chunks[i].counts.generated = out.directives();
+            chunks[i].done = true;
+            finished.notify_all();
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back(work);
+    }
+    DumpCounts counts;
+    try {
+        for (auto&& chunk : chunks) {
+            std::string text;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                finished.wait(lock, [&]() { return chunk.done; });
+                text.swap(chunk.text);
+            }
+            to_fd(text.data(), text.size());
+            counts.records += chunk.counts.records;
+            counts.generated += chunk.counts.generated;
+        }
+    } catch (...) {
+        next_range = ranges.size();
+        for (auto&& worker : workers) worker.join();
+        throw;
+    }
+    for (auto&& worker : workers) {
+        worker.join();
+    }
+    return counts;
 }
 
-void AuthoritativeResolver::add_SOA_to_authority_section(const DomainTreeNode *node, Message& response) const
+void AuthoritativeResolver::print_name_filters() const
 {
-    assert(node->is_top_of_zone());
-    for (auto&& rr : node->m_rr_list) {
-        if (rr.is_SOA_record()) {
-            response.add_authority(rr);
-            break;
+    for (auto&& apex : m_apexes) {
+        const DomainTreeNode& node = *apex.node;
+        std::cout << ";; " << node.m_soa->front().name().repr() << " ";
+        if (node.m_name_filter == nullptr) {
+            std::cout << "has wildcards or generated ranges, no name filter" << std::endl;
+            continue;
         }
+        char line[100];
+        snprintf(line, sizeof line, "name filter: %zu names, %zu bytes, %.2f%% false positives",
+                 node.m_name_filter->size(), node.m_name_filter->memory_bytes(), 100 * node.m_false_positive_rate);
+        std::cout << line << std::endl;
     }
 }
 
-void AuthoritativeResolver::populate_with_referral(const DomainTreeNode *zone_cut_node, Message& response) const
+template<class Sink>
+void AuthoritativeResolver::populate_with_referral(const DomainTreeNode *node, Sink& response) const
 {
-    for (auto&& rr : zone_cut_node->m_rr_list) {
-        if (rr.is_NS_record()) {
-            response.add_authority(rr);
-            // TODO: add A and AAAA "glue" to the "additional" section
+    assert(node->m_referral != nullptr);
+    response.add_authority(*node->m_referral);
+    add_additional_section(&node->m_referral, 1, response);
+}
+
+template<class Sink>
+void AuthoritativeResolver::add_additional_section(const RRset *const *rrsets, int n, Sink& response)
+{
+    // RFC 1034, section 4.3.2, step 6. The additional section is written
+    // last, so it is the first thing to be dropped if space runs out.
+    // An address RRset wanted by several of the records goes in once.
+    // More than fit in the table wouldn't fit in the packet either, so
+    // past that we stop rather than risk adding one twice.
+    static const int max_added = 32;
+    const RRset *added[max_added];
+    int num_added = 0;
+    for (int i = 0; i < n; ++i) {
+        for (const RRset *extra : rrsets[i]->additional()) {
+            if (std::find(added, added + num_added, extra) != added + num_added) continue;
+            if (num_added == max_added) return;
+            added[num_added++] = extra;
+            response.add_additional(*extra);
         }
     }
 }
 
-void AuthoritativeResolver::populate_response(const Question& question, Message& response) const
+void AuthoritativeResolver::populate_response(const Question& question, Response& response) const
 {
-    response.add_question(Question(
-        question.qname(),
-        question.qtype(),
-        question.qclass()
-    ));
+    if (m_compact != nullptr) {
+        m_compact->populate_response(question, response);
+        return;
+    }
+    populate(question, response);
+}
 
-    const Name& name = question.qname();
+void AuthoritativeResolver::populate_response(const QueryView& query, ResponseWriter& response) const
+{
+    assert(query.has_question());
+    if (m_compact != nullptr) {
+        m_compact->populate_response(query, response);
+        return;
+    }
+    populate(query, response);
+}
+
+// populate() works on either an owned Question or a QueryView into the
+// query packet, and lookup() on either a Name or a QueryView; these
+// overloads paper over the differences.
+
+static const Name& qname(const Question& question)
+{
+    return question.qname();
+}
+
+static const QueryView& qname(const QueryView& query)
+{
+    return query;
+}
+
+static int label_count(const Name& name)
+{
     assert(name.labels().back().empty());
+    return name.labels().size() - 1;
+}
+
+static int label_count(const QueryView& query)
+{
+    return query.label_count();
+}
+
+static const DomainTreeNode *find_child(const DomainTreeNode *node, const Name& name, int i)
+{
+    LabelView label = name.labels()[i];
+    char folded[63];
+    uint32_t hash = fold_label(label.data(), label.size(), folded);
+    return node->find_child(folded, label.size(), hash);
+}
+
+static const DomainTreeNode *find_child(const DomainTreeNode *node, const QueryView& query, int i)
+{
+    // The view has already folded and hashed every label of the qname.
+    return node->find_child(query.folded_label_data(i), query.label_size(i), query.label_hash(i));
+}
+
+static void set_question(Response& response, const Question& question)
+{
+    response.set_question(question);
+}
+
+static void set_question(ResponseWriter& response, const QueryView& query)
+{
+    response.copy_question(query.question_begin(), query.question_end());
+}
+
+// Add an answer RRset. One found through a wildcard takes the name being
+// looked up as its owner: the qname, or else the `owner` a CNAME led to.
+static void add_answer(Response& response, const Question& question, const RRset& rrset,
+                       bool found_wildcard, const Name *owner)
+{
+    if (found_wildcard) {
+        response.add_answer(rrset, (owner != nullptr) ? owner : &question.qname());
+    } else {
+        response.add_answer(rrset);
+    }
+}
+
+static void add_answer(ResponseWriter& response, const QueryView&, const RRset& rrset,
+                       bool found_wildcard, const Name *owner)
+{
+    if (!found_wildcard) {
+        response.add_answer(rrset);
+    } else if (owner == nullptr) {
+        response.add_answer_owned_by_qname(rrset);
+    } else {
+        response.add_answer(rrset, owner);
+    }
+}
+
+// The authority section of a negative answer (NXDOMAIN or NODATA) for the
+// name `node` was looked up for: the qname, or else the `owner` a CNAME
+// led to. For the qname, the writer copies the zone's pre-encoded SOA,
+// pointing its owner at the apex's labels at the end of the qname.
+
+static void add_negative_authority(Response& response, const Question&, const DomainTreeNode *node, const Name *)
+{
+    response.add_authority(*node->soa());
+}
+
+static void add_negative_authority(ResponseWriter& response, const QueryView& query, const DomainTreeNode *node,
+                                   const Name *owner)
+{
+    const DomainTreeNode *apex = node->top_of_zone();
+    if (owner != nullptr || apex->negative_template().empty()) {
+        response.add_authority(*node->soa());
+        return;
+    }
+    int i = query.label_count() - apex->depth();  // the apex's first label in the qname
+    response.add_authority_preencoded(apex->negative_template(), 12 + query.label_offset(i));
+}
+
+const DomainTreeNode *AuthoritativeResolver::find_apex(const QueryView& query, int i) const noexcept
+{
+    uint32_t hash = query.suffix_hash(i);
+    auto it = std::lower_bound(m_apexes.begin(), m_apexes.end(), hash, [](const Apex& a, uint32_t h) {
+        return a.hash < h;
+    });
+    for (; it != m_apexes.end() && it->hash == hash; ++it) {
+        if (it->folded_name.size() == query.folded_suffix_size(i) &&
+            memcmp(it->folded_name.data(), query.folded_suffix_data(i), it->folded_name.size()) == 0) {
+            return it->node;
+        }
+    }
+    return nullptr;
+}
+
+const DomainTreeNode *AuthoritativeResolver::filtered_nxdomain(const Question&) const noexcept
+{
+    // Only the server's path has the qname's suffix hashes at hand.
+    return nullptr;
+}
+
+// If the name filters prove the qname doesn't exist, return the apex of
+// the zone to answer NXDOMAIN from; otherwise nullptr, and the tree must
+// decide. Going from the root outward, each suffix of the qname is either
+// an apex we serve (whose zone the rest of the qname is in, so far), or
+// must be in the current zone's filter: a name that's not has no
+// descendants either. A suffix at a zone cut leaves it to the tree.
+const DomainTreeNode *AuthoritativeResolver::filtered_nxdomain(const QueryView& query) const noexcept
+{
+    const DomainTreeNode *apex = nullptr;
+    for (int i = query.label_count(); i >= 0; --i) {
+        if (const DomainTreeNode *node = find_apex(query, i)) {
+            apex = node;
+            continue;
+        }
+        if (apex == nullptr || apex->m_name_filter == nullptr) continue;
+        uint32_t hash = query.suffix_hash(i);
+        if (!apex->m_name_filter->may_contain(hash)) {
+            return apex;
+        }
+        if (std::binary_search(apex->m_cut_hashes.begin(), apex->m_cut_hashes.end(), hash)) {
+            return nullptr;
+        }
+    }
+    return nullptr;
+}
+
+// The perfect hash's key for a name: its hash (as by hash_name_step()),
+// with its length and label count thrown in to separate names whose
+// 32-bit hashes collide.
+static uint64_t exact_key(uint32_t hash, size_t size, int labels)
+{
+    return (uint64_t(hash) << 32) | (uint64_t(size) << 8) | uint64_t(labels);
+}
+
+const DomainTreeNode *AuthoritativeResolver::find_exact(const Name&) const noexcept
+{
+    // Only the server's path has the qname's hash at hand.
+    return nullptr;
+}
+
+const DomainTreeNode *AuthoritativeResolver::find_exact(const QueryView& query) const noexcept
+{
+    size_t size = query.folded_suffix_size(0);
+    size_t i = m_exact_hash.lookup(exact_key(query.qname_hash(), size, query.label_count()));
+    if (i >= m_exact_nodes.size()) {
+        return nullptr;
+    }
+    // Any name maps to some index; make sure it's the right one.
+    const char *name = m_exact_names.data() + m_exact_name_offsets[i];
+    if (uint8_t(name[0]) != size || memcmp(name + 1, query.folded_suffix_data(0), size) != 0) {
+        return nullptr;
+    }
+    return m_exact_nodes[i];
+}
+
+static bool parse_octet(const Name& name, int i, uint8_t& octet)
+{
+    LabelView label = name.labels()[i];
+    return ReverseIndex::parse_octet(label.data(), label.size(), octet);
+}
+
+static bool parse_octet(const QueryView& query, int i, uint8_t& octet)
+{
+    return ReverseIndex::parse_octet(query.label_data(i), query.label_size(i), octet);
+}
+
+// The tree walk for `qname` has come to a stop at `node`, in the
+// in-addr.arpa. tree, with labels i and to its left still to go. If the
+// qname, or a name between it and `node`, is in the reverse index, say
+// where the lookup ends up, and return true; otherwise return false, and
+// it is up to `node` (and its wildcard, if any), as usual.
+static const RRsetIndex no_rrsets;
+
+template<class QName>
+static bool find_reverse(const DomainTreeNode *node, const QName& qname, int i, DomainTreeLookup& result)
+{
+    const ReverseIndex& index = *node->reverse_index();
+    int octets = node->depth() - 2;  // below in-addr.arpa.
+    if (octets >= 4) return false;
+    uint32_t prefix = 0;
+    int n = label_count(qname);
+    for (int j = n - 3; j > i; --j) {
+        uint8_t octet;
+        if (!parse_octet(qname, j, octet)) return false;
+        prefix = (prefix << 8) | octet;
+    }
+    // Follow the qname down through the names that exist implicitly.
+    int matched = octets;
+    for (int j = i; j >= 0 && matched < 4; --j) {
+        uint8_t octet;
+        if (!parse_octet(qname, j, octet) || !index.has_prefix((prefix << 8) | octet, matched + 1)) break;
+        prefix = (prefix << 8) | octet;
+        matched += 1;
+    }
+    if (matched == octets) {
+        return false;
+    }
+    // The closest encloser is below `node`, so `node`'s wildcard (if any)
+    // can't match (RFC 4592, section 3.3.1).
+    result.node = node;
+    result.rrsets = &no_rrsets;
+    if (matched == n - 2) {
+        result.found_reverse = (matched == 4 && index.find(prefix, result.reverse_first, result.reverse_last));
+    } else {
+        result.found_nothing = true;
+    }
+    return true;
+}
+
+static const char *label_data(const Name& name, int i)
+{
+    return name.labels()[i].data();
+}
+
+static const char *label_data(const QueryView& query, int i)
+{
+    return query.label_data(i);
+}
+
+static size_t label_size(const Name& name, int i)
+{
+    return name.labels()[i].size();
+}
+
+static size_t label_size(const QueryView& query, int i)
+{
+    return query.label_size(i);
+}
+
+// The tree walk for `qname` has come to a stop, with labels i and to its
+// left below `node`, an origin of generated ranges. If the qname is a
+// generated name, or lies between one and `node`, or below one, say
+// where the lookup ends up and return true; otherwise return false, and
+// it is up to the tree as usual. (A name in the tree itself never gets
+// here: the tree's records take precedence over generated ones.)
+template<class QName>
+static bool find_generated(const DomainTreeNode *node, const QName& qname, int i, DomainTreeLookup& result)
+{
+    const char *labels[128];
+    uint8_t sizes[128];
+    for (int j = 0; j <= i; ++j) {
+        labels[j] = label_data(qname, j);
+        sizes[j] = label_size(qname, j);
+    }
+    bool exists = false;
+    bool below = false;
+    for (const GeneratedRange *range : node->generated_ranges()) {
+        uint32_t value;
+        switch (range->match(labels, sizes, i + 1, value)) {
+            case GeneratedRange::NAME: result.found_generated = true; exists = true; break;
+            case GeneratedRange::ANCESTOR: exists = true; break;
+            case GeneratedRange::DESCENDANT: below = true; break;
+            case GeneratedRange::NO_MATCH: break;
+        }
+    }
+    if (!exists && !below) {
+        return false;
+    }
+    // As with the reverse index, the closest encloser is below `node`,
+    // so `node`'s wildcard (if any) can't match.
+    result.node = node;
+    result.rrsets = &no_rrsets;
+    result.found_nothing = !exists;
+    return true;
+}
 
+template<class QName>
+DomainTreeLookup AuthoritativeResolver::lookup(const QName& qname) const
+{
+    // Where the zones start and stop has been worked out for every node
+    // already, so all that's left is the descent. A name that owns
+    // records may not need even that.
+    DomainTreeLookup result;
+    if (const DomainTreeNode *node = find_exact(qname)) {
+        result.node = node;
+        result.rrsets = &node->m_rrsets;
+        return result;
+    }
     const DomainTreeNode *node = &m_root;
-    const DomainTreeNode *last_zone_cut_node = nullptr;
-    const DomainTreeNode *last_top_of_zone_node = nullptr;
-    bool in_authoritative_zone = false;
-    bool found_nothing_in_tree = false;
-    bool found_wildcard = false;
-    for (auto&& label : nonstd::drop(1, nonstd::reversed(name.labels()))) {
-        if (node->is_top_of_zone()) {
-            in_authoritative_zone = true;
-            last_top_of_zone_node = node;
-        } else if (node->is_zone_cut()) {
-            // RC 1034, section 4.2.1: the zone cut's NS records themselves are not authoritative
-            in_authoritative_zone = false;
-            last_zone_cut_node = node;
+    const DomainTreeNode *ranges = nullptr;  // the nearest origin of generated ranges in this zone
+    int ranges_i = 0;
+    for (int i = label_count(qname) - 1; i >= 0; --i) {
+        if (!node->m_generated.empty()) {
+            ranges = node;
+            ranges_i = i;
         }
         // RFC 1034, section 4.3.2, step 3
-        auto it = node->m_children.find(label);
-        if (it != node->m_children.end()) {
-            node = &it->second;
+        const DomainTreeNode *child = find_child(node, qname, i);
+        if (child != nullptr) {
+            if (child->is_top_of_zone() || child->is_zone_cut()) {
+                ranges = nullptr;
+            }
+            node = child;
             continue;
         }
+        // Records in the reverse index take precedence over generated
+        // ones, but a generated name can still be below a name the index
+        // says doesn't exist.
+        DomainTreeLookup reverse;
+        bool in_reverse = (node->reverse_index() != nullptr && find_reverse(node, qname, i, reverse));
+        if (in_reverse && !reverse.found_nothing) {
+            return reverse;
+        }
+        if (ranges != nullptr && find_generated(ranges, qname, ranges_i, result)) {
+            return result;
+        }
+        if (in_reverse) {
+            return reverse;
+        }
         // A match is impossible. Step 3c.
-        auto star = node->m_children.find(Label::asterisk());
-        if (star != node->m_children.end()) {
-            node = &star->second;
-            found_wildcard = true;
+        if (node->m_wildcard != nullptr) {
+            node = node->m_wildcard;
+            result.found_wildcard = true;
         } else {
-            found_nothing_in_tree = true;
+            result.found_nothing = true;
         }
         break;
     }
-    assert(node != nullptr);
-    if (node->is_top_of_zone()) {
-        in_authoritative_zone = true;
-        last_top_of_zone_node = node;
-    } else if (node->is_zone_cut()) {
-        // RC 1034, section 4.2.1: the zone cut's NS records themselves are not authoritative
-        in_authoritative_zone = false;
-        last_zone_cut_node = node;
+    result.node = node;
+    result.rrsets = &node->m_rrsets;
+    return result;
+}
+
+// Add the answers generated for the name being looked up (the qname, or
+// else the `owner` a CNAME led to) from the ranges at `node`. A generated
+// CNAME isn't followed: the client must take it from there.
+
+static void add_generated_answer(Response& response, const Question& question, const Name *owner,
+                                 const GeneratedRange& range, uint32_t value)
+{
+    response.add_synthesized_answer(range.make_rr((owner != nullptr) ? *owner : question.qname(), value));
+}
+
+static void add_generated_answer(ResponseWriter& response, const QueryView&, const Name *owner,
+                                 const GeneratedRange& range, uint32_t value)
+{
+    char rdata[255];
+    size_t n = range.write_rdata(value, rdata, sizeof rdata);
+    response.add_answer(owner, range.rrtype(), range.rrclass(), range.ttl(), rdata, n);
+}
+
+template<class Query, class Sink>
+static void add_generated_answers(Sink& response, const Query& question, const DomainTreeNode *node,
+                                  const Name *owner)
+{
+    const char *labels[128];
+    uint8_t sizes[128];
+    int n = (owner != nullptr) ? label_count(*owner) : label_count(qname(question));
+    n -= node->depth();
+    for (int j = 0; j < n; ++j) {
+        labels[j] = (owner != nullptr) ? label_data(*owner, j) : label_data(qname(question), j);
+        sizes[j] = (owner != nullptr) ? label_size(*owner, j) : label_size(qname(question), j);
+    }
+    // Any number of ranges may match, so rather than collect them we go
+    // over the ranges twice: once for a CNAME, then for the qtype.
+    RRType qtype = question.qtype();
+    uint32_t value;
+    if (qtype != RRType::CNAME && qtype != RRType::ANY) {
+        for (const GeneratedRange *range : node->generated_ranges()) {
+            if (range->rrtype() == RRType::CNAME && range->match(labels, sizes, n, value) == GeneratedRange::NAME) {
+                add_generated_answer(response, question, owner, *range, value);
+                return;
+            }
+        }
+    }
+    bool answered = false;
+    for (const GeneratedRange *range : node->generated_ranges()) {
+        if ((qtype == RRType::ANY || range->rrtype() == qtype) &&
+            range->match(labels, sizes, n, value) == GeneratedRange::NAME) {
+            add_generated_answer(response, question, owner, *range, value);
+            answered = true;
+        }
+    }
+    if (!answered) {
+        add_negative_authority(response, question, node, owner);
     }
+}
 
-    response.setAA(in_authoritative_zone);
-    if (in_authoritative_zone) {
-        if (found_nothing_in_tree) {
-            response.setRCode(RCode::NXDOMAIN);
-            add_SOA_to_authority_section(last_top_of_zone_node, response);
-        } else {
-            // We found either the qname, or a wildcard matching the qname.
+// Add the answers from the reverse index for the name being looked up
+// (the qname, or else the `owner` a CNAME led to), whose records are
+// [first, last) of `node`'s index; they are all PTR records.
+
+static void add_reverse_answer(Response& response, const Question&, const Name *owner,
+                               const ReverseIndex& index, size_t i)
+{
+    Name name = (owner != nullptr) ? *owner : ReverseIndex::make_name(index.address(i));
+    response.add_synthesized_answer(RR(std::move(name), RRType::PTR, index.rrclass(i), index.ttl(i),
+                                       std::string(index.rdata(i), index.rdlength(i))));
+}
+
+static void add_reverse_answer(ResponseWriter& response, const QueryView&, const Name *owner,
+                               const ReverseIndex& index, size_t i)
+{
+    response.add_answer(owner, RRType::PTR, index.rrclass(i), index.ttl(i), index.rdata(i), index.rdlength(i));
+}
+
+template<class Query, class Sink>
+static void add_reverse_answers(Sink& response, const Query& question, const DomainTreeNode *node,
+                                const Name *owner, size_t first, size_t last)
+{
+    RRType qtype = question.qtype();
+    if (qtype != RRType::PTR && qtype != RRType::ANY) {
+        add_negative_authority(response, question, node, owner);
+        return;
+    }
+    const ReverseIndex& index = *node->reverse_index();
+    for (size_t i = first; i < last; ++i) {
+        add_reverse_answer(response, question, owner, index, i);
+    }
+}
+
+// The longest CNAME chain we follow within one response.
+static const int max_cname_chain = 8;
+
+template<class Query, class Sink>
+void AuthoritativeResolver::populate(const Query& question, Sink& response) const
+{
+    set_question(response, question);
+
+    if (const DomainTreeNode *apex = filtered_nxdomain(question)) {
+        response.setAA(true);
+        response.setRCode(RCode::NXDOMAIN);
+        add_negative_authority(response, question, apex, nullptr);
+        return;
+    }
+
+    DomainTreeLookup found = lookup(qname(question));
+    response.setAA(found.node->m_authoritative);
+    if (!found.node->m_authoritative) {
+        if (found.node->m_referral != nullptr) {
+            // RFC 1034, section 4.3.2, step 3b: respond with a referral
+            // RFC 4592, section 4.2: it does not matter if the zone name in question is a wildcard
             response.setRCode(RCode::NOERROR);
-            for (auto&& rr : node->m_rr_list) {
-                if (question.qtype() == rr.rrtype() || question.qtype() == RRType::ANY) {
-                    // This RR is relevant!
-                    RR modified_rr = rr;
-                    if (found_wildcard) {
-                        modified_rr.set_name(question.qname());
-                    }
-                    response.add_answer(std::move(modified_rr));
-                }
-            }
+            populate_with_referral(found.node, response);
+        } else {
+            // If we have no relevant authority at all, we should just refuse to answer.
+            response.setRCode(RCode::REFUSED);
+        }
+        return;
+    }
+
+    // RFC 1034, section 4.3.2, step 3a: if the name is an alias, answer
+    // with its CNAME and carry on with the canonical name. The targets were
+    // looked up when the zone was loaded; we follow them as long as they
+    // stay within our authoritative data, don't loop, and aren't too many.
+    const DomainTreeNode *chain[max_cname_chain];
+    const Name *owner = nullptr;  // the name being looked up, if not the qname
+    for (int links = 0; ; ++links) {
+        if (found.found_nothing) {
+            // RFC 6604: the RCODE is that of the last name in the chain.
+            response.setRCode(RCode::NXDOMAIN);
+            add_negative_authority(response, question, found.node, owner);
+            return;
         }
-    } else if (last_zone_cut_node != nullptr) {
-        // RFC 1034, section 4.3.2, step 3b: respond with a referral
-        // RFC 4592, section 4.2: it does not matter if the zone name in question is a wildcard
+        // We found either the name, or a wildcard matching the name.
+        const DomainTreeNode *node = found.node;
         response.setRCode(RCode::NOERROR);
-        populate_with_referral(last_zone_cut_node, response);
-    } else {
-        // If we have no relevant authority at all, we should just refuse to answer.
-        response.setRCode(RCode::REFUSED);
+        if (found.found_generated) {
+            add_generated_answers(response, question, node, owner);
+            return;
+        }
+        if (found.found_reverse) {
+            add_reverse_answers(response, question, node, owner, found.reverse_first, found.reverse_last);
+            return;
+        }
+        const RRset *cname = found.rrsets->find(RRType::CNAME);
+        if (cname != nullptr && question.qtype() != RRType::CNAME && question.qtype() != RRType::ANY) {
+            add_answer(response, question, *cname, found.found_wildcard, owner);
+            chain[links] = node;
+            const DomainTreeNode::CNAMETarget *target = node->m_cname_target.get();
+            if (target == nullptr || !target->lookup.node->m_authoritative || links + 1 == max_cname_chain ||
+                std::find(chain, chain + links + 1, target->lookup.node) != chain + links + 1) {
+                // The client must take it from here.
+                return;
+            }
+            owner = &target->name;
+            found = target->lookup;
+            continue;
+        }
+        if (question.qtype() == RRType::ANY && !found.rrsets->empty()) {
+            const RRset *answers[32];
+            int n = 0;
+            for (auto&& rrset : found.rrsets->rrsets()) {
+                add_answer(response, question, rrset, found.found_wildcard, owner);
+                if (!rrset.additional().empty() && n < 32) answers[n++] = &rrset;
+            }
+            add_additional_section(answers, n, response);
+        } else if (const RRset *rrset = found.rrsets->find(question.qtype())) {
+            add_answer(response, question, *rrset, found.found_wildcard, owner);
+            add_additional_section(&rrset, 1, response);
+        } else {
+            // NODATA: the name exists, but has no records of this type.
+            // RFC 2308, section 2.2: the authority section holds the SOA.
+            add_negative_authority(response, question, node, owner);
+        }
+        return;
     }
 }
 
 void AuthoritativeResolver::add_rr(RR rr)
 {
-    bool is_SOA = rr.is_SOA_record();
-    bool is_NS = rr.is_NS_record();
     DomainTreeNode *node = &m_root;
     const Name& name = rr.name();
     for (auto&& label : nonstd::drop(1, nonstd::reversed(name.labels()))) {
-        node = &node->m_children[label];
+        char folded[63];
+        uint32_t hash = fold_label(label.data(), label.size(), folded);
+        node = &node->m_children.find_or_insert(folded, label.size(), hash);
     }
     node->m_rr_list.emplace_back(std::move(rr));
-    if (is_SOA) node->m_has_SOA_record = true;
-    if (is_NS) node->m_has_NS_record = true;
+    node->m_rrsets.add(node->m_rr_list.back());
+}
+
+void AuthoritativeResolver::add_generated_range(GeneratedRange range)
+{
+    DomainTreeNode *node = &m_root;
+    for (auto&& label : nonstd::drop(1, nonstd::reversed(range.origin().labels()))) {
+        char folded[63];
+        uint32_t hash = fold_label(label.data(), label.size(), folded);
+        node = &node->m_children.find_or_insert(folded, label.size(), hash);
+    }
+    m_generated_ranges.push_back(std::move(range));
+    node->m_generated.push_back(&m_generated_ranges.back());
+}
+
+void AuthoritativeResolver::index_reverse_records()
+{
+    if (m_reverse_index.empty()) {
+        return;
+    }
+    // An address whose name is also in the tree (because it owns other
+    // records, or has names below it) keeps its PTR records there too.
+    std::vector<RR> in_tree = m_reverse_index.finish([&](uint32_t address) {
+        return find_node(ReverseIndex::make_name(address)) != nullptr;
+    });
+    for (auto&& rr : in_tree) {
+        add_rr(std::move(rr));
+    }
+    // Make sure the tree reaches in-addr.arpa., where the index hangs.
+    DomainTreeNode *node = &m_root;
+    for (const char *label : {"arpa", "in-addr"}) {
+        char folded[8];
+        size_t n = strlen(label);
+        uint32_t hash = fold_label(label, n, folded);
+        node = &node->m_children.find_or_insert(folded, n, hash);
+    }
+    m_reverse_root = node;
+}
+
+const DomainTreeNode *AuthoritativeResolver::find_node(const Name& name) const
+{
+    const DomainTreeNode *node = &m_root;
+    for (auto&& label : nonstd::drop(1, nonstd::reversed(name.labels()))) {
+        char folded[63];
+        uint32_t hash = fold_label(label.data(), label.size(), folded);
+        node = node->find_child(folded, label.size(), hash);
+        if (node == nullptr) break;
+    }
+    return node;
+}
+
+void AuthoritativeResolver::precompute_zones(bool negative_templates)
+{
+    struct Visitor {
+        const AuthoritativeResolver *self;
+        uint32_t star_hash;
+        bool negative_templates;
+        void visit(DomainTreeNode& node, const DomainTreeNode& parent) {
+            node.m_depth = (&node == &self->m_root) ? 0 : parent.m_depth + 1;
+            node.m_authoritative = parent.m_authoritative;
+            node.m_top_of_zone = parent.m_top_of_zone;
+            node.m_zone_cut = parent.m_zone_cut;
+            if (node.is_top_of_zone()) {
+                node.m_authoritative = true;
+                node.m_top_of_zone = &node;
+            } else if (node.is_zone_cut()) {
+                // RC 1034, section 4.2.1: the zone cut's NS records themselves are not authoritative
+                node.m_authoritative = false;
+                node.m_zone_cut = &node;
+            }
+            if (node.m_top_of_zone != nullptr) {
+                node.m_soa = node.m_top_of_zone->m_rrsets.find(RRType::SOA);
+            }
+            if (node.is_top_of_zone() && negative_templates) {
+                // RFC 1035, section 5.2: a zone has exactly one SOA record.
+                const RR& soa = node.m_soa->front();
+                std::string& wire = node.m_negative_template;
+                wire.resize(2 + 10 + soa.rdata().size());
+                char *end = &wire[0] + wire.size();
+                char *p = put16bits(&wire[0], end, 0);  // the owner name, filled in per response
+                p = put16bits(p, end, int(soa.rrtype()));
+                p = put16bits(p, end, int(soa.rrclass()));
+                p = put32bits(p, end, soa.ttl());
+                p = put_uint16_sized_string(p, end, soa.rdata());
+                assert(p == end);
+            }
+            if (node.m_zone_cut != nullptr) {
+                node.m_referral = node.m_zone_cut->m_rrsets.find(RRType::NS);
+            }
+            node.m_reverse = (&node == self->m_reverse_root) ? &self->m_reverse_index : parent.m_reverse;
+            node.m_wildcard = node.m_children.find("*", 1, star_hash);
+            node.m_children.for_each([&](const char *, size_t, DomainTreeNode& child) { visit(child, node); });
+        }
+    };
+    char folded[1];
+    Visitor v{this, fold_label("*", 1, folded), negative_templates};
+    v.visit(m_root, DomainTreeNode());
+}
+
+void AuthoritativeResolver::resolve_additional()
+{
+    // Resolve, once and for all, the names in NS and MX records to
+    // the A and AAAA RRsets (if we have any) that go with them.
+    struct Visitor {
+        const AuthoritativeResolver *self;
+        void visit(DomainTreeNode& node) {
+            SymbolTable syms;  // empty, will not be used
+            for (auto&& rrset : node.m_rrsets.rrsets()) {
+                if (rrset.rrtype() != RRType::NS && rrset.rrtype() != RRType::MX) continue;
+                for (const RR *rr : rrset.records()) {
+                    auto name = rr->additional_name(syms);
+                    if (!name) continue;
+                    const DomainTreeNode *target = self->find_node(*name);
+                    if (target == nullptr) continue;
+                    for (RRType type : {RRType(RRType::A), RRType(RRType::AAAA)}) {
+                        if (const RRset *address = target->m_rrsets.find(type)) {
+                            rrset.add_additional(address);
+                        }
+                    }
+                }
+            }
+            node.m_children.for_each([&](const char *, size_t, DomainTreeNode& child) { visit(child); });
+        }
+    };
+    Visitor v{this};
+    v.visit(m_root);
+}
+
+void AuthoritativeResolver::resolve_cname_targets()
+{
+    struct Visitor {
+        const AuthoritativeResolver *self;
+        void visit(DomainTreeNode& node) {
+            SymbolTable syms;  // empty, will not be used
+            if (const RRset *cname = node.m_rrsets.find(RRType::CNAME)) {
+                // RFC 2181, section 10.1: a name has at most one CNAME.
+                auto target = cname->front().rhs_name(syms);
+                if (!target) {
+                    throw dns::Exception("Zonefile CNAME record has malformed RDATA: ",
+                                         cname->front().name().repr());
+                }
+                node.m_cname_target.reset(new DomainTreeNode::CNAMETarget);
+                node.m_cname_target->name = *target;
+                node.m_cname_target->lookup = self->lookup(node.m_cname_target->name);
+            }
+            node.m_children.for_each([&](const char *, size_t, DomainTreeNode& child) { visit(child); });
+        }
+    };
+    Visitor v{this};
+    v.visit(m_root);
+}
+
+void AuthoritativeResolver::build_name_filters()
+{
+    // The names in one zone: everything under its apex, down to the zone
+    // cuts and short of any other zone's apex. Empty non-terminals count,
+    // since a query for one must get NODATA rather than NXDOMAIN, and so
+    // do the names in the reverse index that belong to the zone.
+    struct Zone {
+        const AuthoritativeResolver *self;
+        std::vector<uint32_t> hashes;
+        std::vector<uint32_t> cut_hashes;
+        bool has_synthesis = false;
+
+        // `octets` is how many labels below in-addr.arpa. the node is, and
+        // `prefix` the address they spell, or -1 if it's not under there.
+        void visit(const DomainTreeNode& node, uint32_t hash, bool is_apex, int octets, uint32_t prefix) {
+            if (node.is_top_of_zone() && !is_apex) return;
+            hashes.push_back(hash);
+            if (node.is_zone_cut()) {
+                cut_hashes.push_back(hash);
+                return;
+            }
+            if (node.m_wildcard != nullptr || !node.m_generated.empty()) {
+                has_synthesis = true;
+            }
+            if (&node == self->m_reverse_root) {
+                octets = 0;
+            }
+            if (node.m_reverse != nullptr && octets >= 0 && octets < 4) {
+                add_reverse_names(node, hash, octets, prefix);
+            }
+            node.m_children.for_each([&](const char *key, size_t n, const DomainTreeNode& child) {
+                uint8_t octet;
+                bool numeric = (octets >= 0 && ReverseIndex::parse_octet(key, n, octet));
+                visit(child, hash_name_step(hash, hash_folded(key, n)), false,
+                      numeric ? (octets + 1) : -1, numeric ? ((prefix << 8) | octet) : 0);
+            });
+        }
+
+        // The names below `node` that exist only in the reverse index.
+        void add_reverse_names(const DomainTreeNode& node, uint32_t hash, int octets, uint32_t prefix) {
+            node.m_reverse->for_each_address(prefix, octets, [&](uint32_t address) {
+                uint32_t h = hash;
+                for (int i = octets; i < 4; ++i) {
+                    char label[4];
+                    size_t n = snprintf(label, sizeof label, "%u", (address >> (24 - 8 * i)) & 0xFF);
+                    uint32_t label_hash = hash_folded(label, n);
+                    if (i == octets && node.find_child(label, n, label_hash) != nullptr) {
+                        return;  // the tree has the rest
+                    }
+                    h = hash_name_step(h, label_hash);
+                    hashes.push_back(h);
+                }
+            });
+        }
+    };
+    struct Visitor {
+        AuthoritativeResolver *self;
+        std::string folded_name;
+        void visit(DomainTreeNode& node, uint32_t hash, int octets, uint32_t prefix) {
+            if (&node == self->m_reverse_root) {
+                octets = 0;
+            }
+            if (node.is_top_of_zone()) {
+                self->m_apexes.push_back(Apex{hash, &node, folded_name});
+                Zone zone;
+                zone.self = self;
+                zone.visit(node, hash, true, octets, prefix);
+                // A wildcard or a generated range matches names that
+                // aren't in the tree, so a filter over the tree would be
+                // no use.
+                if (!zone.has_synthesis) {
+                    std::sort(zone.hashes.begin(), zone.hashes.end());
+                    zone.hashes.erase(std::unique(zone.hashes.begin(), zone.hashes.end()), zone.hashes.end());
+                    node.m_name_filter.reset(new NameFilter(zone.hashes));
+                    node.m_false_positive_rate = node.m_name_filter->measure_false_positive_rate(zone.hashes, 10000);
+                    std::sort(zone.cut_hashes.begin(), zone.cut_hashes.end());
+                    node.m_cut_hashes = std::move(zone.cut_hashes);
+                }
+            }
+            node.m_children.for_each([&](const char *key, size_t n, DomainTreeNode& child) {
+                std::string parent = folded_name;
+                folded_name.insert(0, key, n);
+                folded_name.insert(0, 1, char(n));
+                uint8_t octet;
+                bool numeric = (octets >= 0 && ReverseIndex::parse_octet(key, n, octet));
+                visit(child, hash_name_step(hash, hash_folded(key, n)),
+                      numeric ? (octets + 1) : -1, numeric ? ((prefix << 8) | octet) : 0);
+                folded_name = std::move(parent);
+            });
+        }
+    };
+    Visitor v{this, std::string()};
+    v.visit(m_root, 0, -1, 0);
+    std::sort(m_apexes.begin(), m_apexes.end(), [](const Apex& a, const Apex& b) { return a.hash < b.hash; });
+}
+
+void AuthoritativeResolver::build_exact_index()
+{
+    // Names whose keys collide (which takes a 32-bit hash collision
+    // between names of the same length) are left out, and found by
+    // walking the tree.
+    struct Owner {
+        uint64_t key;
+        const DomainTreeNode *node;
+        uint32_t name_offset;
+    };
+    struct Visitor {
+        std::vector<Owner> owners;
+        std::string names;
+        std::string folded_name;
+        void visit(const DomainTreeNode& node, uint32_t hash, int labels) {
+            if (!node.m_rrsets.empty()) {
+                owners.push_back(Owner{exact_key(hash, folded_name.size(), labels), &node, uint32_t(names.size())});
+                names.push_back(char(folded_name.size()));
+                names += folded_name;
+            }
+            node.m_children.for_each([&](const char *key, size_t n, const DomainTreeNode& child) {
+                std::string parent = folded_name;
+                folded_name.insert(0, key, n);
+                folded_name.insert(0, 1, char(n));
+                visit(child, hash_name_step(hash, hash_folded(key, n)), labels + 1);
+                folded_name = std::move(parent);
+            });
+        }
+    };
+    Visitor v;
+    v.visit(m_root, 0, 0);
+    std::sort(v.owners.begin(), v.owners.end(), [](const Owner& a, const Owner& b) { return a.key < b.key; });
+
+    std::vector<Owner> unique;
+    for (size_t i = 0; i < v.owners.size(); ) {
+        size_t j = i + 1;
+        while (j < v.owners.size() && v.owners[j].key == v.owners[i].key) ++j;
+        if (j == i + 1) unique.push_back(v.owners[i]);
+        i = j;
+    }
+    std::vector<uint64_t> keys;
+    for (auto&& owner : unique) {
+        keys.push_back(owner.key);
+    }
+    m_exact_hash = PerfectHash(keys);
+    m_exact_nodes.assign(unique.size(), nullptr);
+    m_exact_name_offsets.assign(unique.size(), 0);
+    for (auto&& owner : unique) {
+        size_t i = m_exact_hash.lookup(owner.key);
+        m_exact_nodes[i] = owner.node;
+        m_exact_name_offsets[i] = owner.name_offset;
+    }
+    m_exact_names = std::move(v.names);
 }
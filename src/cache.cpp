@@ -0,0 +1,248 @@
+
+#include "bytes.h"
+#include "cache.h"
+#include "casefold.h"
+#include "exception.h"
+#include "message.h"
+#include "question.h"
+#include "rr.h"
+#include "rrtype.h"
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+
+using namespace dns;
+
+// RFC 2308, section 5: negative answers should not be cached for more than
+// a few hours. Positive answers are capped at a week, as BIND does.
+static const uint32_t max_negative_ttl = 3 * 3600;
+static const uint32_t max_positive_ttl = 7 * 86400;
+
+double Cache::Stats::hit_ratio() const noexcept
+{
+    uint64_t lookups = hits + misses;
+    return (lookups == 0) ? 0.0 : double(hits) / double(lookups);
+}
+
+std::string Cache::Stats::repr() const
+{
+    std::string result;
+    result += ";; CACHE: hits " + std::to_string(hits);
+    result += ", misses " + std::to_string(misses);
+    result += ", hit ratio " + std::to_string(int(hit_ratio() * 100 + 0.5)) + "%";
+    result += ", entries " + std::to_string(entries);
+    result += ", memory " + std::to_string(bytes) + " bytes";
+    result += ", evictions " + std::to_string(evictions);
+    return result;
+}
+
+Cache::Cache(size_t max_bytes, int shards)
+{
+    if (shards < 1) {
+        throw dns::Exception("Cache must have at least one shard");
+    }
+    m_max_bytes_per_shard = max_bytes / shards;
+    for (int i = 0; i < shards; ++i) {
+        m_shards.emplace_back(new Shard);
+    }
+}
+
+std::string Cache::key_for(const Question& q)
+{
+    // Names compare case-insensitively, so fold the qname before using it as a key.
+    std::string key;
+    for (auto&& label : q.qname().labels()) {
+        key += char(label.size());
+        size_t offset = key.size();
+        key.resize(offset + label.size());
+        fold_label(label.data(), label.size(), &key[offset]);
+    }
+    key += char(int(q.qtype()) >> 8);
+    key += char(int(q.qtype()));
+    key += char(int(q.qclass()) >> 8);
+    key += char(int(q.qclass()));
+    return key;
+}
+
+uint32_t Cache::cacheable_ttl(const Message& response)
+{
+    if (!response.is_response() || response.is_truncated()) {
+        return 0;
+    }
+    if (response.rcode() == RCode::NOERROR && !response.answers().empty()) {
+        uint32_t ttl = max_positive_ttl;
+        for (auto&& rr : response.answers()) {
+            ttl = std::min(ttl, rr.ttl());
+        }
+        return ttl;
+    }
+    if (response.rcode() == RCode::NXDOMAIN || response.rcode() == RCode::NOERROR) {
+        // RFC 2308, section 5: a negative answer is cached for the lesser of
+        // the SOA's own TTL and its MINIMUM field. Without an SOA (e.g. in a
+        // referral) there is nothing to go on, so don't cache it at all.
+        for (auto&& rr : response.authority()) {
+            if (rr.is_SOA_record()) {
+                auto minimum = rr.soa_minimum(response.symbol_table());
+                if (!minimum) return 0;
+                uint32_t ttl = std::min(rr.ttl(), *minimum);
+                return std::min(ttl, max_negative_ttl);
+            }
+        }
+    }
+    return 0;
+}
+
+size_t Cache::footprint(const Entry& e) noexcept
+{
+    // Count the strings' contents plus a rough estimate of the list node,
+    // the hash node, and the duplicate of the key held by the index.
+    return sizeof(Entry) + 2 * e.key.size() + e.wire.size() + 64;
+}
+
+Cache::Shard& Cache::shard_for(const std::string& key)
+{
+    size_t h = hash_folded(key.data(), key.size());
+    return *m_shards[h % m_shards.size()];
+}
+
+void Cache::erase(Shard& shard, std::list<Entry>::iterator it)
+{
+    shard.bytes -= footprint(*it);
+    shard.index.erase(it->key);
+    shard.lru.erase(it);
+}
+
+bool Cache::lookup(const Question& q, std::string& wire)
+{
+    std::string key = key_for(q);
+    Shard& shard = shard_for(key);
+    std::lock_guard<std::mutex> lk(shard.mtx);
+    auto found = shard.index.find(key);
+    if (found == shard.index.end()) {
+        shard.misses += 1;
+        return false;
+    }
+    auto it = found->second;
+    if (it->expires <= clock::now()) {
+        erase(shard, it);
+        shard.misses += 1;
+        return false;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, it);
+    wire = it->wire;
+    shard.hits += 1;
+    auto age = std::chrono::duration_cast<std::chrono::seconds>(clock::now() - it->stored);
+    age_ttls(wire, uint32_t(age.count()));
+    return true;
+}
+
+void Cache::evict(const Question& q)
+{
+    std::string key = key_for(q);
+    Shard& shard = shard_for(key);
+    std::lock_guard<std::mutex> lk(shard.mtx);
+    auto found = shard.index.find(key);
+    if (found != shard.index.end()) {
+        erase(shard, found->second);
+    }
+}
+
+// Skip a possibly compressed name in wire format.
+static const char *skip_name(const char *src, const char *end) noexcept
+{
+    while (src != nullptr && src < end) {
+        uint8_t length = *src;
+        if ((length & 0xC0) == 0xC0) {
+            return (end - src >= 2) ? src + 2 : nullptr;
+        }
+        if (length == 0) {
+            return src + 1;
+        }
+        src += 1 + length;
+    }
+    return nullptr;
+}
+
+void Cache::age_ttls(std::string& wire, uint32_t age) noexcept
+{
+    // The response decoded when it was inserted, but stop at anything odd
+    // rather than trust that.
+    char *packet = &wire[0];
+    const char *end = packet + wire.size();
+    uint16_t counts[4] = {};
+    const char *src = packet + 4;
+    for (auto& count : counts) {
+        src = get16bits(src, end, count);
+    }
+    for (int i = 0; i < counts[0]; ++i) {
+        src = skip_name(src, end);
+        if (src == nullptr || end - src < 4) return;
+        src += 4;
+    }
+    int records = counts[1] + counts[2] + counts[3];
+    for (int i = 0; i < records; ++i) {
+        uint16_t rrtype = 0;
+        uint16_t rrclass = 0;
+        uint32_t ttl = 0;
+        uint16_t rdlength = 0;
+        src = skip_name(src, end);
+        src = get16bits(src, end, rrtype);
+        src = get16bits(src, end, rrclass);
+        const char *ttl_at = src;
+        src = get32bits(src, end, ttl);
+        src = get16bits(src, end, rdlength);
+        if (src == nullptr || end - src < rdlength) return;
+        if (rrtype != int(RRType::OPT)) {  // whose TTL field holds EDNS flags instead
+            put32bits(packet + (ttl_at - packet), end, (ttl > age) ? ttl - age : 0);
+        }
+        src += rdlength;
+    }
+}
+
+void Cache::insert(const Question& q, const Message& response, const char *packet, const char *end)
+{
+    uint32_t ttl = cacheable_ttl(response);
+    if (ttl == 0) {
+        return;
+    }
+    Entry entry;
+    entry.key = key_for(q);
+    entry.wire.assign(packet, end);
+    entry.stored = clock::now();
+    entry.expires = entry.stored + std::chrono::seconds(ttl);
+    size_t size = footprint(entry);
+    if (size > m_max_bytes_per_shard) {
+        return;
+    }
+
+    Shard& shard = shard_for(entry.key);
+    std::lock_guard<std::mutex> lk(shard.mtx);
+    auto found = shard.index.find(entry.key);
+    if (found != shard.index.end()) {
+        erase(shard, found->second);
+    }
+    while (shard.bytes + size > m_max_bytes_per_shard) {
+        erase(shard, std::prev(shard.lru.end()));
+        shard.evictions += 1;
+    }
+    shard.lru.push_front(std::move(entry));
+    shard.index.emplace(shard.lru.front().key, shard.lru.begin());
+    shard.bytes += size;
+    shard.insertions += 1;
+}
+
+Cache::Stats Cache::stats() const
+{
+    Stats result;
+    for (auto&& shard : m_shards) {
+        std::lock_guard<std::mutex> lk(shard->mtx);
+        result.hits += shard->hits;
+        result.misses += shard->misses;
+        result.insertions += shard->insertions;
+        result.evictions += shard->evictions;
+        result.entries += shard->lru.size();
+        result.bytes += shard->bytes;
+    }
+    return result;
+}
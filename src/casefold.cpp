@@ -0,0 +1,284 @@
+
+#include "casefold.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DNS_CASEFOLD_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace dns;
+
+uint32_t dns::hash_folded(const char *folded, size_t n) noexcept
+{
+    // Multiply-xorshift over 64-bit words; the tail is zero-padded, and
+    // mixing in the length keeps "a\0" distinct from "a".
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ n;
+    for (; n >= 8; folded += 8, n -= 8) {
+        uint64_t word;
+        memcpy(&word, folded, 8);
+        h = (h ^ word) * 0xFF51AFD7ED558CCDull;
+        h ^= (h >> 32);
+    }
+    if (n != 0) {
+        uint64_t word = 0;
+        memcpy(&word, folded, n);
+        h = (h ^ word) * 0xFF51AFD7ED558CCDull;
+        h ^= (h >> 32);
+    }
+    h *= 0xC4CEB9FE1A85EC53ull;
+    return uint32_t(h ^ (h >> 29));
+}
+
+static uint32_t scalar_fold_label(const char *src, size_t n, char *dst)
+{
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = ascii_tolower(src[i]);
+    }
+    return hash_folded(dst, n);
+}
+
+static bool scalar_equal(const char *a, const char *b, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        if (ascii_tolower(a[i]) != ascii_tolower(b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int scalar_compare(const char *a, const char *b, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        int ua = ascii_toupper(a[i]);
+        int ub = ascii_toupper(b[i]);
+        if (ua != ub) {
+            return ua - ub;
+        }
+    }
+    return 0;
+}
+
+static const CaseFoldKernel scalar_kernel = {
+    "scalar", scalar_fold_label, scalar_equal, scalar_compare,
+};
+
+#if DNS_CASEFOLD_X86
+
+// The vector kernels work a register at a time. A label that doesn't fill
+// its last register is finished with one more load that overlaps the
+// previous one; a label shorter than a register is loaded whole if that
+// can't cross into the next (possibly unmapped) page, and through a
+// buffer otherwise. Either way, the lanes past the label are ignored.
+//
+// To find the letters, shift 'A'..'Z' (or 'a'..'z') down to the 26 most
+// negative signed bytes, so that a single signed compare picks them out.
+
+static inline bool load_stays_in_page(const char *p, size_t width)
+{
+    return (reinterpret_cast<uintptr_t>(p) & 4095) <= 4096 - width;
+}
+
+// Copy n < 32 bytes without a call to memcpy().
+static inline void copy_short(char *dst, const char *src, size_t n)
+{
+    size_t i = 0;
+    if (n & 16) { memcpy(dst + i, src + i, 16); i += 16; }
+    if (n & 8) { memcpy(dst + i, src + i, 8); i += 8; }
+    if (n & 4) { memcpy(dst + i, src + i, 4); i += 4; }
+    if (n & 2) { memcpy(dst + i, src + i, 2); i += 2; }
+    if (n & 1) { dst[i] = src[i]; }
+}
+
+__attribute__((target("sse2")))
+static inline __m128i sse2_load_short(const char *p, size_t n)
+{
+    if (n != 0 && load_stays_in_page(p, 16)) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    }
+    char buf[16] = {};
+    copy_short(buf, p, n);
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i sse2_to_lower(__m128i v)
+{
+    __m128i upper = _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8(char(0x80 - 'A'))), _mm_set1_epi8(char(0x80 + 26)));
+    return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i sse2_to_upper(__m128i v)
+{
+    __m128i lower = _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8(char(0x80 - 'a'))), _mm_set1_epi8(char(0x80 + 26)));
+    return _mm_xor_si128(v, _mm_and_si128(lower, _mm_set1_epi8(0x20)));
+}
+
+// A bit for each of the 16 lanes in which the folded bytes differ.
+__attribute__((target("sse2")))
+static inline unsigned sse2_differences(__m128i a, __m128i b, bool upper)
+{
+    a = upper ? sse2_to_upper(a) : sse2_to_lower(a);
+    b = upper ? sse2_to_upper(b) : sse2_to_lower(b);
+    return ~unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(a, b))) & 0xFFFF;
+}
+
+// The index of the first byte at which the folded labels differ, or n.
+__attribute__((target("sse2")))
+static inline size_t sse2_find_difference(const char *a, const char *b, size_t n, bool upper)
+{
+    if (n < 16) {
+        unsigned m = sse2_differences(sse2_load_short(a, n), sse2_load_short(b, n), upper) & ((1u << n) - 1);
+        return (m != 0) ? __builtin_ctz(m) : n;
+    }
+    for (size_t i = 0; ; i += 16) {
+        if (i + 16 > n) i = n - 16;
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        unsigned m = sse2_differences(va, vb, upper);
+        if (m != 0) return i + __builtin_ctz(m);
+        if (i + 16 == n) return n;
+    }
+}
+
+__attribute__((target("sse2")))
+static uint32_t sse2_fold_label(const char *src, size_t n, char *dst)
+{
+    if (n < 16) {
+        char buf[16];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(buf), sse2_to_lower(sse2_load_short(src, n)));
+        copy_short(dst, buf, n);
+        return hash_folded(dst, n);
+    }
+    // Folding is idempotent, so an overlapping last register is harmless
+    // even when folding in place.
+    for (size_t i = 0; ; i += 16) {
+        if (i + 16 > n) i = n - 16;
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), sse2_to_lower(v));
+        if (i + 16 == n) break;
+    }
+    return hash_folded(dst, n);
+}
+
+__attribute__((target("sse2")))
+static bool sse2_equal(const char *a, const char *b, size_t n)
+{
+    return sse2_find_difference(a, b, n, false) == n;
+}
+
+__attribute__((target("sse2")))
+static int sse2_compare(const char *a, const char *b, size_t n)
+{
+    size_t i = sse2_find_difference(a, b, n, true);
+    return (i == n) ? 0 : (int(ascii_toupper(a[i])) - int(ascii_toupper(b[i])));
+}
+
+static const CaseFoldKernel sse2_kernel = {
+    "sse2", sse2_fold_label, sse2_equal, sse2_compare,
+};
+
+// AVX2 only pays off for labels that fill a 32-byte register; shorter
+// ones take the SSE2 path.
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_to_lower(__m256i v)
+{
+    // AVX2 has no signed less-than for bytes, only greater-than.
+    __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(char(0x80 + 26)), _mm256_add_epi8(v, _mm256_set1_epi8(char(0x80 - 'A'))));
+    return _mm256_or_si256(v, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_to_upper(__m256i v)
+{
+    __m256i lower = _mm256_cmpgt_epi8(_mm256_set1_epi8(char(0x80 + 26)), _mm256_add_epi8(v, _mm256_set1_epi8(char(0x80 - 'a'))));
+    return _mm256_xor_si256(v, _mm256_and_si256(lower, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2")))
+static inline size_t avx2_find_difference(const char *a, const char *b, size_t n, bool upper)
+{
+    if (n < 32) {
+        return sse2_find_difference(a, b, n, upper);
+    }
+    for (size_t i = 0; ; i += 32) {
+        if (i + 32 > n) i = n - 32;
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+        va = upper ? avx2_to_upper(va) : avx2_to_lower(va);
+        vb = upper ? avx2_to_upper(vb) : avx2_to_lower(vb);
+        unsigned m = ~unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)));
+        if (m != 0) return i + __builtin_ctz(m);
+        if (i + 32 == n) return n;
+    }
+}
+
+__attribute__((target("avx2")))
+static uint32_t avx2_fold_label(const char *src, size_t n, char *dst)
+{
+    if (n < 32) {
+        return sse2_fold_label(src, n, dst);
+    }
+    for (size_t i = 0; ; i += 32) {
+        if (i + 32 > n) i = n - 32;
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), avx2_to_lower(v));
+        if (i + 32 == n) break;
+    }
+    return hash_folded(dst, n);
+}
+
+__attribute__((target("avx2")))
+static bool avx2_equal(const char *a, const char *b, size_t n)
+{
+    return avx2_find_difference(a, b, n, false) == n;
+}
+
+__attribute__((target("avx2")))
+static int avx2_compare(const char *a, const char *b, size_t n)
+{
+    size_t i = avx2_find_difference(a, b, n, true);
+    return (i == n) ? 0 : (int(ascii_toupper(a[i])) - int(ascii_toupper(b[i])));
+}
+
+static const CaseFoldKernel avx2_kernel = {
+    "avx2", avx2_fold_label, avx2_equal, avx2_compare,
+};
+
+#endif // DNS_CASEFOLD_X86
+
+std::vector<const CaseFoldKernel *> dns::supported_casefold_kernels()
+{
+    std::vector<const CaseFoldKernel *> result;
+    result.push_back(&scalar_kernel);
+#if DNS_CASEFOLD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) result.push_back(&sse2_kernel);
+    if (__builtin_cpu_supports("avx2")) result.push_back(&avx2_kernel);
+#endif
+    return result;
+}
+
+// The same choice as the last of supported_casefold_kernels(), made
+// without building the vector, so that it can't throw.
+static const CaseFoldKernel *best_casefold_kernel() noexcept
+{
+#if DNS_CASEFOLD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return &avx2_kernel;
+    if (__builtin_cpu_supports("sse2")) return &sse2_kernel;
+#endif
+    return &scalar_kernel;
+}
+
+const CaseFoldKernel& dns::casefold_kernel() noexcept
+{
+    static const CaseFoldKernel *kernel = best_casefold_kernel();
+    return *kernel;
+}
@@ -0,0 +1,647 @@
+
+#include "casefold.h"
+#include "compact-zone.h"
+#include "name.h"
+#include "query-view.h"
+#include "question.h"
+#include "rcode.h"
+#include "response.h"
+#include "response-writer.h"
+#include "rr.h"
+#include "rrtype.h"
+#include "succinct-tree.h"
+#include "symboltable.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+using namespace dns;
+
+static const size_t not_found = size_t(-1);
+
+// The longest CNAME chain we follow within one response.
+static const int max_cname_chain = 8;
+
+/**
+ *  The labels of a name being looked up: as written, and folded to
+ *  lowercase. Label 0 is the leftmost, and the root's isn't counted.
+ */
+class CompactZone::Labels {
+public:
+    explicit Labels(const QueryView& query) noexcept : m_count(query.label_count()) {
+        for (int i = 0; i < m_count; ++i) {
+            m_data[i] = query.label_data(i);
+            m_folded[i] = query.folded_label_data(i);
+            m_sizes[i] = query.label_size(i);
+        }
+    }
+
+    explicit Labels() noexcept : m_count(0) {}
+    explicit Labels(const Name& name) noexcept { assign(name); }
+
+    void assign(const Name& name) noexcept {
+        LabelList labels = name.labels();
+        m_count = labels.size() - 1;
+        char *dst = m_buffer;
+        for (int i = 0; i < m_count; ++i) {
+            m_data[i] = labels[i].data();
+            m_sizes[i] = labels[i].size();
+            fold_label(m_data[i], m_sizes[i], dst);
+            m_folded[i] = dst;
+            dst += m_sizes[i];
+        }
+    }
+
+    int count() const noexcept { return m_count; }
+    const char *folded(int i) const noexcept { return m_folded[i]; }
+    size_t size(int i) const noexcept { return m_sizes[i]; }
+
+    /**
+     *  The name made of labels i through the last. Only referrals and
+     *  negative answers need one, to own the records they add.
+     */
+    Name suffix(int i) const {
+        char wire[255];
+        char *dst = wire;
+        for (int j = i; j < m_count; ++j) {
+            *dst++ = m_sizes[j];
+            memcpy(dst, m_data[j], m_sizes[j]);
+            dst += m_sizes[j];
+        }
+        *dst++ = 0;
+        SymbolTable syms;  // empty, will not be used
+        Name name;
+        name.decode(syms, wire, dst);
+        return name;
+    }
+
+private:
+    int m_count;
+    const char *m_data[128];
+    const char *m_folded[128];
+    uint8_t m_sizes[128];
+    char m_buffer[255];
+};
+
+// Each pending record: the length of its folded name, which is made of
+// labels from the root, each as (length, octets); then its name in wire
+// format (with its length first), type, class, TTL, RDATA length and RDATA.
+struct PendingRecord {
+    const char *key;
+    size_t key_size;
+    const char *wire;
+    size_t wire_size;
+    uint16_t rrtype;
+    uint16_t rrclass;
+    uint32_t ttl;
+    const char *rdata;
+    size_t rdlength;
+
+    explicit PendingRecord(const char *p) noexcept {
+        key_size = uint8_t(p[0]);
+        key = p + 1;
+        p = key + key_size;
+        wire_size = uint8_t(p[0]);
+        wire = p + 1;
+        p = wire + wire_size;
+        memcpy(&rrtype, p, 2);
+        memcpy(&rrclass, p + 2, 2);
+        memcpy(&ttl, p + 4, 4);
+        uint16_t n;
+        memcpy(&n, p + 8, 2);
+        rdlength = n;
+        rdata = p + 10;
+    }
+};
+
+void CompactZone::add(const RR& rr)
+{
+    m_pending_offsets.push_back(m_pending.size());
+    const Name& name = rr.name();
+    LabelList labels = name.labels();
+    char key[255];
+    size_t key_size = 0;
+    for (size_t i = labels.size() - 1; i-- > 0; ) {
+        LabelView label = labels[i];
+        key[key_size] = label.size();
+        fold_label(label.data(), label.size(), key + key_size + 1);
+        key_size += 1 + label.size();
+    }
+    m_pending += char(key_size);
+    m_pending.append(key, key_size);
+    m_pending += char(name.wire_size());
+    m_pending.append(name.wire_data(), name.wire_size());
+    uint16_t rrtype = int(rr.rrtype());
+    uint16_t rrclass = int(rr.rrclass());
+    uint32_t ttl = rr.ttl();
+    uint16_t rdlength = rr.rdata().size();
+    m_pending.append(reinterpret_cast<const char *>(&rrtype), 2);
+    m_pending.append(reinterpret_cast<const char *>(&rrclass), 2);
+    m_pending.append(reinterpret_cast<const char *>(&ttl), 4);
+    m_pending.append(reinterpret_cast<const char *>(&rdlength), 2);
+    m_pending += rr.rdata();
+}
+
+// Compare two folded names, labels from the root, in canonical order:
+// label by label as unsigned octets, a shorter label (or name) first.
+static int compare_keys(const char *a, size_t an, const char *b, size_t bn) noexcept
+{
+    size_t i = 0;
+    size_t j = 0;
+    while (i < an && j < bn) {
+        size_t la = uint8_t(a[i]);
+        size_t lb = uint8_t(b[j]);
+        int c = memcmp(a + i + 1, b + j + 1, std::min(la, lb));
+        if (c != 0) return c;
+        if (la != lb) return (la < lb) ? -1 : 1;
+        i += 1 + la;
+        j += 1 + lb;
+    }
+    return int(i < an) - int(j < bn);
+}
+
+void CompactZone::finish()
+{
+    const char *pending = m_pending.data();
+    std::stable_sort(m_pending_offsets.begin(), m_pending_offsets.end(), [&](size_t a, size_t b) {
+        PendingRecord ra(pending + a);
+        PendingRecord rb(pending + b);
+        return compare_keys(ra.key, ra.key_size, rb.key, rb.key_size) < 0;
+    });
+
+    // Each distinct RDATA, by its offset in m_rdata.
+    struct RdataHash {
+        const std::string *pool;
+        size_t operator()(uint32_t offset) const noexcept {
+            uint16_t n;
+            memcpy(&n, pool->data() + offset, 2);
+            return hash_folded(pool->data() + offset + 2, n);
+        }
+    };
+    struct RdataEqual {
+        const std::string *pool;
+        bool operator()(uint32_t a, uint32_t b) const noexcept {
+            uint16_t na, nb;
+            memcpy(&na, pool->data() + a, 2);
+            memcpy(&nb, pool->data() + b, 2);
+            return na == nb && memcmp(pool->data() + a + 2, pool->data() + b + 2, na) == 0;
+        }
+    };
+    std::unordered_set<uint32_t, RdataHash, RdataEqual> distinct(16, RdataHash{&m_rdata}, RdataEqual{&m_rdata});
+    auto intern_rdata = [&](const char *data, size_t n) -> uint32_t {
+        uint32_t offset = m_rdata.size();
+        uint16_t length = n;
+        m_rdata.append(reinterpret_cast<const char *>(&length), 2);
+        m_rdata.append(data, n);
+        auto inserted = distinct.insert(offset);
+        if (!inserted.second) {
+            m_rdata.resize(offset);
+            return *inserted.first;
+        }
+        m_rdata_count += 1;
+        return offset;
+    };
+
+    std::vector<uint32_t> degrees;
+    size_t path[128];  // the nodes from the root to the last owner name
+    auto add_node = [&](size_t depth, const char *label, size_t n) {
+        size_t node = degrees.size();
+        if (node % 8 == 0) m_name_samples.push_back(m_names.size());
+        if (node % 64 == 0) m_owner_bits.push_back(0);
+        degrees.push_back(0);
+        m_names += char((depth == 0) ? 0 : depth - 1);
+        m_names += char(n);
+        m_names.append(label, n);
+        if (depth != 0) {
+            degrees[path[depth - 1]] += 1;
+        }
+        path[depth] = node;
+    };
+    add_node(0, "", 0);
+
+    const char *previous_key = nullptr;
+    size_t previous_key_size = 0;
+    std::vector<size_t> group;
+    for (size_t i = 0; i < m_pending_offsets.size(); ) {
+        PendingRecord first(pending + m_pending_offsets[i]);
+        size_t j = i + 1;
+        while (j < m_pending_offsets.size()) {
+            PendingRecord next(pending + m_pending_offsets[j]);
+            if (compare_keys(first.key, first.key_size, next.key, next.key_size) != 0) break;
+            ++j;
+        }
+
+        // The labels this name shares with the last one are on the path
+        // already; the rest are new nodes, taking their case from its wire format.
+        size_t shared = 0;
+        size_t k = 0;
+        while (previous_key != nullptr && k < first.key_size && k < previous_key_size &&
+               first.key[k] == previous_key[k] &&
+               memcmp(first.key + k, previous_key + k, 1 + uint8_t(first.key[k])) == 0) {
+            k += 1 + uint8_t(first.key[k]);
+            shared += 1;
+        }
+        const char *labels[128];
+        size_t depth = 0;
+        for (const char *p = first.wire; *p != 0; p += 1 + uint8_t(*p)) {
+            labels[depth++] = p;
+        }
+        for (size_t d = shared + 1; d <= depth; ++d) {
+            const char *label = labels[depth - d];
+            add_node(d, label + 1, uint8_t(*label));
+        }
+        size_t owner = path[depth];
+        m_owner_bits[owner / 64] |= uint64_t(1) << (owner % 64);
+        m_owner_offsets.push_back(m_records.size());
+
+        // The owner's records, by type, and in file order within each type.
+        group.assign(m_pending_offsets.begin() + i, m_pending_offsets.begin() + j);
+        std::stable_sort(group.begin(), group.end(), [&](size_t a, size_t b) {
+            return PendingRecord(pending + a).rrtype < PendingRecord(pending + b).rrtype;
+        });
+        size_t header = m_records.size();
+        m_records.append(2, '\0');
+        uint8_t flags = 0;
+        uint8_t rrsets = 0;
+        for (size_t g = 0; g < group.size(); ) {
+            uint16_t rrtype = PendingRecord(pending + group[g]).rrtype;
+            size_t h = g;
+            while (h < group.size() && PendingRecord(pending + group[h]).rrtype == rrtype) ++h;
+            uint16_t count = h - g;
+            m_records.append(reinterpret_cast<const char *>(&rrtype), 2);
+            m_records.append(reinterpret_cast<const char *>(&count), 2);
+            for (; g < h; ++g) {
+                PendingRecord r(pending + group[g]);
+                uint32_t offset = intern_rdata(r.rdata, r.rdlength);
+                m_records.append(reinterpret_cast<const char *>(&r.rrclass), 2);
+                m_records.append(reinterpret_cast<const char *>(&r.ttl), 4);
+                m_records.append(reinterpret_cast<const char *>(&offset), 4);
+                m_record_count += 1;
+            }
+            rrsets += 1;
+            if (rrtype == RRType::SOA) flags |= HAS_SOA;
+            if (rrtype == RRType::NS) flags |= HAS_NS;
+            if (rrtype == RRType::CNAME) flags |= HAS_CNAME;
+        }
+        m_records[header] = flags;
+        m_records[header + 1] = rrsets;
+
+        previous_key = first.key;
+        previous_key_size = first.key_size;
+        i = j;
+    }
+
+    m_owner_ranks.assign(m_owner_bits.size(), 0);
+    for (size_t w = 1; w < m_owner_bits.size(); ++w) {
+        m_owner_ranks[w] = m_owner_ranks[w - 1] + __builtin_popcountll(m_owner_bits[w - 1]);
+    }
+    m_tree = SuccinctTree(degrees);
+
+    std::string().swap(m_pending);
+    std::vector<size_t>().swap(m_pending_offsets);
+    m_names.shrink_to_fit();
+    m_name_samples.shrink_to_fit();
+    m_owner_bits.shrink_to_fit();
+    m_owner_offsets.shrink_to_fit();
+    m_records.shrink_to_fit();
+    m_rdata.shrink_to_fit();
+}
+
+size_t CompactZone::memory_bytes() const noexcept
+{
+    return m_tree.memory_bytes() + m_names.capacity() + m_name_samples.capacity() * sizeof(uint32_t) +
+           m_owner_bits.capacity() * sizeof(uint64_t) + m_owner_ranks.capacity() * sizeof(uint32_t) +
+           m_owner_offsets.capacity() * sizeof(uint32_t) + m_records.capacity() + m_rdata.capacity();
+}
+
+const char *CompactZone::name_entry(size_t node) const noexcept
+{
+    const char *p = m_names.data() + m_name_samples[node / 8];
+    for (size_t i = node % 8; i != 0; --i) {
+        p += 2 + uint8_t(p[1]);
+    }
+    return p;
+}
+
+const char *CompactZone::owner_records(size_t node) const noexcept
+{
+    uint64_t word = m_owner_bits[node / 64];
+    uint64_t bit = uint64_t(1) << (node % 64);
+    if (!(word & bit)) {
+        return nullptr;
+    }
+    size_t rank = m_owner_ranks[node / 64] + __builtin_popcountll(word & (bit - 1));
+    return m_records.data() + m_owner_offsets[rank];
+}
+
+bool CompactZone::find_rrset(size_t node, RRType rrtype, RRsetRef& found) const noexcept
+{
+    bool result = false;
+    for_each_rrset(node, [&](const RRsetRef& rrset) {
+        if (rrset.rrtype == rrtype) {
+            found = rrset;
+            result = true;
+        }
+    });
+    return result;
+}
+
+const char *CompactZone::rdata(uint32_t offset, size_t& length) const noexcept
+{
+    length = load<uint16_t>(m_rdata.data() + offset);
+    return m_rdata.data() + offset + 2;
+}
+
+// Compare a stored label (as loaded) with a folded one, in canonical order.
+static int compare_label(const char *label, size_t n, const char *folded, size_t m) noexcept
+{
+    for (size_t i = 0; i < n && i < m; ++i) {
+        uint8_t a = ascii_tolower(label[i]);
+        uint8_t b = folded[i];
+        if (a != b) return (a < b) ? -1 : 1;
+    }
+    return int(n > m) - int(n < m);
+}
+
+size_t CompactZone::find_child(size_t node, const char *folded, size_t n) const noexcept
+{
+    SuccinctTree::Children children = m_tree.children(node);
+    size_t lo = 0;
+    size_t hi = children.count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        size_t child = m_tree.child(children, mid);
+        const char *entry = name_entry(child);
+        int c = compare_label(entry + 2, uint8_t(entry[1]), folded, n);
+        if (c == 0) return child;
+        if (c < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return not_found;
+}
+
+CompactZone::Lookup CompactZone::lookup(const Labels& labels) const noexcept
+{
+    // As the default layout works out for each node when the zone is
+    // loaded: a node with an SOA is the apex of a zone, and one with NS
+    // records but no SOA is a zone cut (RFC 1034, section 4.2.1).
+    Lookup result;
+    auto visit = [&](size_t node, int depth) {
+        const char *records = owner_records(node);
+        uint8_t flags = (records != nullptr) ? records[0] : 0;
+        if (flags & HAS_SOA) {
+            result.authoritative = true;
+            result.apex = node;
+            result.apex_depth = depth;
+        } else if (flags & HAS_NS) {
+            result.authoritative = false;
+            result.cut = node;
+            result.cut_depth = depth;
+        }
+    };
+    size_t node = 0;
+    int depth = 0;
+    visit(node, depth);
+    for (int i = labels.count() - 1; i >= 0; --i) {
+        // RFC 1034, section 4.3.2, step 3
+        size_t child = find_child(node, labels.folded(i), labels.size(i));
+        if (child == not_found) {
+            // A match is impossible. Step 3c.
+            size_t wildcard = find_child(node, "*", 1);
+            if (wildcard != not_found) {
+                node = wildcard;
+                result.found_wildcard = true;
+                visit(node, depth + 1);
+            } else {
+                result.found_nothing = true;
+            }
+            break;
+        }
+        node = child;
+        depth += 1;
+        visit(node, depth);
+    }
+    result.node = node;
+    return result;
+}
+
+// populate() works on either an owned Question or a QueryView into the
+// query packet, and writes either a Response or a ResponseWriter; these
+// overloads paper over the differences. An owner of nullptr is the qname.
+
+static const Name& qname(const Question& question)
+{
+    return question.qname();
+}
+
+static const QueryView& qname(const QueryView& query)
+{
+    return query;
+}
+
+static void set_question(Response& response, const Question& question)
+{
+    response.set_question(question);
+}
+
+static void set_question(ResponseWriter& response, const QueryView& query)
+{
+    response.copy_question(query.question_begin(), query.question_end());
+}
+
+static bool add_record(Response& response, const Question& question, int section, const Name *owner,
+                       RRType rrtype, RRClass rrclass, uint32_t ttl, const char *rdata, size_t rdlength)
+{
+    RR rr((owner != nullptr) ? *owner : question.qname(), rrtype, rrclass, ttl, std::string(rdata, rdlength));
+    switch (section) {
+        case 0: response.add_synthesized_answer(std::move(rr)); break;
+        case 1: response.add_synthesized_authority(std::move(rr)); break;
+        default: response.add_synthesized_additional(std::move(rr)); break;
+    }
+    return true;
+}
+
+static bool add_record(ResponseWriter& response, const QueryView&, int section, const Name *owner,
+                       RRType rrtype, RRClass rrclass, uint32_t ttl, const char *rdata, size_t rdlength)
+{
+    switch (section) {
+        case 0: return response.add_answer(owner, rrtype, rrclass, ttl, rdata, rdlength);
+        case 1: return response.add_authority(owner, rrtype, rrclass, ttl, rdata, rdlength);
+        default: return response.add_additional(owner, rrtype, rrclass, ttl, rdata, rdlength);
+    }
+}
+
+static void rollback(Response&, int) {}
+
+static int checkpoint(Response&) { return 0; }
+
+static void rollback(ResponseWriter& response, const ResponseWriter::Checkpoint& c)
+{
+    response.rollback(c);
+}
+
+static ResponseWriter::Checkpoint checkpoint(ResponseWriter& response)
+{
+    return response.checkpoint();
+}
+
+// The name in the RDATA of an NS or MX record, whose addresses belong in
+// the additional section (RFC 1035, section 3.3).
+static bool additional_name(RRType rrtype, const char *rdata, size_t rdlength, Name& name)
+{
+    size_t skip = (rrtype == RRType::MX) ? 2 : 0;
+    if (rdlength <= skip) return false;
+    SymbolTable syms;  // empty, will not be used
+    return bool(name.try_decode(syms, rdata + skip, rdata + rdlength));
+}
+
+template<class Query, class Sink>
+void CompactZone::populate(const Query& question, Sink& response) const
+{
+    set_question(response, question);
+
+    // Add all the records of an RRset, or none of them.
+    auto add_rrset = [&](int section, const Name *owner, const RRsetRef& rrset) {
+        auto c = checkpoint(response);
+        bool ok = true;
+        for_each_record(rrset, [&](RRClass rrclass, uint32_t ttl, const char *data, size_t length) {
+            ok = ok && add_record(response, question, section, owner, rrset.rrtype, rrclass, ttl, data, length);
+        });
+        if (!ok) rollback(response, c);
+    };
+
+    // RFC 1034, section 4.3.2, step 6: the addresses of the names in NS
+    // and MX records, each RRset once, found by an exact match. Once the
+    // table is full the packet is too, and we add no more.
+    static const int max_added = 32;
+    size_t added[max_added];
+    int num_added = 0;
+    auto add_additional = [&](const RRsetRef& rrset) {
+        if (rrset.rrtype != RRType::NS && rrset.rrtype != RRType::MX) return;
+        for_each_record(rrset, [&](RRClass, uint32_t, const char *data, size_t length) {
+            Name name;
+            if (!additional_name(rrset.rrtype, data, length, name)) return;
+            Labels labels;
+            labels.assign(name);
+            size_t node = 0;
+            for (int i = labels.count() - 1; i >= 0 && node != not_found; --i) {
+                node = find_child(node, labels.folded(i), labels.size(i));
+            }
+            if (node == not_found) return;
+            for (RRType type : {RRType(RRType::A), RRType(RRType::AAAA)}) {
+                RRsetRef address;
+                size_t key = 2 * node + (type == RRType::A ? 0 : 1);
+                if (!find_rrset(node, type, address)) continue;
+                if (std::find(added, added + num_added, key) != added + num_added) continue;
+                if (num_added == max_added) return;
+                added[num_added++] = key;
+                add_rrset(2, &name, address);
+            }
+        });
+    };
+
+    Labels qname_labels(qname(question));
+    const Labels *labels = &qname_labels;
+    Lookup found = lookup(*labels);
+    response.setAA(found.authoritative);
+    if (!found.authoritative) {
+        RRsetRef ns;
+        if (found.cut_depth >= 0 && find_rrset(found.cut, RRType::NS, ns)) {
+            // RFC 1034, section 4.3.2, step 3b: respond with a referral
+            response.setRCode(RCode::NOERROR);
+            Name cut = labels->suffix(labels->count() - found.cut_depth);
+            add_rrset(1, &cut, ns);
+            add_additional(ns);
+        } else {
+            // If we have no relevant authority at all, we should just refuse to answer.
+            response.setRCode(RCode::REFUSED);
+        }
+        return;
+    }
+
+    // RFC 1034, section 4.3.2, step 3a: if the name is an alias, answer
+    // with its CNAME and carry on with the canonical name, as long as it
+    // stays within our authoritative data, doesn't loop, and isn't too long.
+    size_t chain[max_cname_chain];
+    Name targets[2];
+    Labels target_labels[2];
+    const Name *owner = nullptr;  // the name being looked up, if not the qname
+    for (int links = 0; ; ++links) {
+        // The authority section of a negative answer: the zone's SOA RRset.
+        auto add_negative_authority = [&]() {
+            RRsetRef soa;
+            if (!find_rrset(found.apex, RRType::SOA, soa)) return;
+            Name apex = labels->suffix(labels->count() - found.apex_depth);
+            add_rrset(1, &apex, soa);
+        };
+        if (found.found_nothing) {
+            // RFC 6604: the RCODE is that of the last name in the chain.
+            response.setRCode(RCode::NXDOMAIN);
+            add_negative_authority();
+            return;
+        }
+        response.setRCode(RCode::NOERROR);
+        RRsetRef cname;
+        RRType qtype = question.qtype();
+        if (qtype != RRType::CNAME && qtype != RRType::ANY && find_rrset(found.node, RRType::CNAME, cname)) {
+            add_rrset(0, owner, cname);
+            chain[links] = found.node;
+            // RFC 2181, section 10.1: a name has at most one CNAME.
+            const char *data = nullptr;
+            size_t length = 0;
+            for_each_record(cname, [&](RRClass, uint32_t, const char *d, size_t n) { data = d; length = n; });
+            Name& target = targets[links % 2];
+            SymbolTable syms;  // empty, will not be used
+            if (links + 1 == max_cname_chain || !target.try_decode(syms, data, data + length)) {
+                return;
+            }
+            Labels& next = target_labels[links % 2];
+            next.assign(target);
+            Lookup next_found = lookup(next);
+            if (!next_found.authoritative ||
+                std::find(chain, chain + links + 1, next_found.node) != chain + links + 1) {
+                // The client must take it from here.
+                return;
+            }
+            owner = &target;
+            labels = &next;
+            found = next_found;
+            continue;
+        }
+        bool answered = false;
+        for_each_rrset(found.node, [&](const RRsetRef& rrset) {
+            if (qtype == RRType::ANY || rrset.rrtype == qtype) {
+                add_rrset(0, owner, rrset);
+                answered = true;
+            }
+        });
+        if (answered) {
+            for_each_rrset(found.node, [&](const RRsetRef& rrset) {
+                if (qtype == RRType::ANY || rrset.rrtype == qtype) add_additional(rrset);
+            });
+        } else {
+            // NODATA: the name exists, but has no records of this type.
+            // RFC 2308, section 2.2: the authority section holds the SOA.
+            add_negative_authority();
+        }
+        return;
+    }
+}
+
+void CompactZone::populate_response(const Question& question, Response& response) const
+{
+    populate(question, response);
+}
+
+void CompactZone::populate_response(const QueryView& query, ResponseWriter& response) const
+{
+    populate(query, response);
+}
@@ -0,0 +1,124 @@
+
+#include "bytes.h"
+#include "cache.h"
+#include "exception.h"
+#include "forwarder.h"
+#include "message.h"
+#include "question.h"
+
+#include <assert.h>
+#include <string>
+#include <string.h>
+#include <utility>
+
+using namespace dns;
+
+std::string Forwarder::RejectCounts::repr() const
+{
+    return ";; UPSTREAM REJECTED: undecodable " + std::to_string(undecodable);
+}
+
+Forwarder::Forwarder(Upstream upstream, Cache& cache, nonstd::milliseconds timeout) :
+    m_client(std::move(upstream)), m_cache(cache), m_timeout(timeout)
+{
+}
+
+void Forwarder::reply(const Client& client, const char *packet, const char *end, const SendFn& send) const
+{
+    // The response came from the cache or was coalesced from someone else's
+    // query, so patch in this client's ID, RD bit, and qname spelling.
+    // We are not authoritative for it, so clear the AA bit too.
+    char buffer[4096];
+    if ((end - packet) > sizeof buffer) {
+        return reply_servfail(client, send);
+    }
+    char *buffer_end = buffer + (end - packet);
+    memcpy(buffer, packet, (end - packet));
+    put16bits(buffer, buffer_end, client.id);
+    buffer[2] = (buffer[2] & ~0x05) | (client.rd ? 0x01 : 0x00);
+    client.question.encode(buffer + 12, buffer_end);
+    send(client.addr, buffer, buffer_end);
+}
+
+void Forwarder::reply_servfail(const Client& client, const SendFn& send) const
+{
+    Message response;
+    response.setID(client.id).setQR(true).setRD(client.rd).setRA(true).setRCode(RCode::SERVFAIL);
+    response.add_question(client.question);
+    char buffer[512];
+    const char *end = response.encode(buffer, buffer + sizeof buffer);
+    if (end != nullptr) {
+        send(client.addr, buffer, end);
+    }
+}
+
+bool Forwarder::resolve(Client client, const SendFn& send)
+{
+    std::string wire;
+    if (m_cache.lookup(client.question, wire)) {
+        reply(client, wire.data(), wire.data() + wire.size(), send);
+        return true;
+    }
+    if (!client.rd) {
+        return false;
+    }
+
+    std::string key = Cache::key_for(client.question);
+    auto it = m_pending.find(key);
+    if (it != m_pending.end()) {
+        it->second.waiters.push_back(std::move(client));
+        return true;
+    }
+    uint16_t tag;
+    if (!m_client.send(client.question, true, tag)) {
+        reply_servfail(client, send);
+        return true;
+    }
+    Pending& p = m_pending[key];
+    p.tag = tag;
+    p.waiters.push_back(std::move(client));
+    m_key_by_tag[tag] = std::move(key);
+    return true;
+}
+
+void Forwarder::on_readable(const SendFn& send)
+{
+    AsyncClient::Reply r;
+    while (m_client.receive(r)) {
+        auto kt = m_key_by_tag.find(r.tag);
+        assert(kt != m_key_by_tag.end());
+        auto it = m_pending.find(kt->second);
+        assert(it != m_pending.end());
+        std::vector<Client> waiters = std::move(it->second.waiters);
+        m_pending.erase(it);
+        m_key_by_tag.erase(kt);
+
+        Message response;
+        DecodeResult result = response.try_decode(r.packet, r.end);
+        if (result) {
+            m_cache.insert(waiters.front().question, response, r.packet, r.end);
+        } else {
+            // Counted rather than logged, since whoever sends them
+            // decides how often, and the event loop mustn't wait on output.
+            m_rejects.undecodable += 1;
+        }
+        for (auto&& client : waiters) {
+            reply(client, r.packet, r.end, send);
+        }
+    }
+}
+
+void Forwarder::on_timer(const SendFn& send)
+{
+    for (uint16_t tag : m_client.expire(m_timeout)) {
+        auto kt = m_key_by_tag.find(tag);
+        assert(kt != m_key_by_tag.end());
+        auto it = m_pending.find(kt->second);
+        assert(it != m_pending.end());
+        for (auto&& client : it->second.waiters) {
+            reply_servfail(client, send);
+        }
+        m_pending.erase(it);
+        m_key_by_tag.erase(kt);
+    }
+}
@@ -0,0 +1,470 @@
+
+#include "casefold.h"
+#include "exception.h"
+#include "generated-range.h"
+#include "name.h"
+#include "reverse-index.h"
+#include "rr.h"
+#include "rrtype.h"
+
+#include <algorithm>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace dns;
+
+static std::string next_token(const char *& p, const char *end)
+{
+    while (p != end && isspace(*p)) ++p;
+    const char *start = p;
+    while (p != end && !isspace(*p)) ++p;
+    return std::string(start, p);
+}
+
+// A decimal number, or an IPv4 address in dotted-quad notation.
+static uint32_t parse_value(const std::string& s)
+{
+    uint32_t result = 0;
+    const char *p = s.data();
+    const char *end = p + s.size();
+    if (s.find('.') != std::string::npos) {
+        for (int i = 0; i < 4; ++i) {
+            const char *dot = (i < 3) ? static_cast<const char *>(memchr(p, '.', end - p)) : end;
+            uint8_t octet;
+            if (dot == nullptr || !ReverseIndex::parse_octet(p, dot - p, octet)) {
+                throw dns::Exception("$GENERATE range has a malformed address: ", s);
+            }
+            result = (result << 8) | octet;
+            p = (dot == end) ? end : dot + 1;
+        }
+        return result;
+    }
+    uint64_t value = 0;
+    for (; p != end; ++p) {
+        if (!isdigit(*p) || value > 0xFFFFFFFFull) {
+            throw dns::Exception("$GENERATE range has a malformed number: ", s);
+        }
+        value = (value * 10) + (*p - '0');
+    }
+    if (s.empty() || value > 0xFFFFFFFFull) {
+        throw dns::Exception("$GENERATE range has a malformed number: ", s);
+    }
+    return value;
+}
+
+static int digit_value(char c)
+{
+    if ('0' <= c && c <= '9') return c - '0';
+    if ('a' <= c && c <= 'f') return c - 'a' + 10;
+    if ('A' <= c && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static int radix(char base, int octet)
+{
+    if (octet >= 0 || base == 'd') return 10;
+    return (base == 'o') ? 8 : 16;
+}
+
+GeneratedRange::Template GeneratedRange::parse_template(const char *src, const char *end)
+{
+    Template result;
+    Piece literal;
+    for (const char *p = src; p != end; ++p) {
+        if (*p == '\\' && p + 1 != end && p[1] == '$') {
+            literal.literal += '$';
+            ++p;
+            continue;
+        }
+        if (*p != '$') {
+            literal.literal += *p;
+            continue;
+        }
+        if (!literal.literal.empty()) {
+            result.push_back(literal);
+            literal.literal.clear();
+        }
+        Piece field;
+        if (p + 1 != end && p[1] == '{') {
+            const char *close = static_cast<const char *>(memchr(p, '}', end - p));
+            if (close == nullptr) {
+                throw dns::Exception("$GENERATE template has an unterminated ${");
+            }
+            std::string spec(p + 2, close);
+            if (spec.size() == 1 && 'a' <= spec[0] && spec[0] <= 'd') {
+                field.octet = spec[0] - 'a';
+            } else {
+                int width = 0;
+                char base = 'd';
+                long long offset = 0;
+                int fields = sscanf(spec.c_str(), "%lld,%d,%c", &offset, &width, &base);
+                if (fields < 1 || width < 0 || width > 63 || strchr("doxX", base) == nullptr) {
+                    throw dns::Exception("$GENERATE template has a malformed modifier: ${", spec, "}");
+                }
+                field.offset = offset;
+                field.width = width;
+                field.base = base;
+            }
+            p = close;
+        }
+        // A field is matched by taking as many digits as there are, so
+        // the next thing in the template must not be a digit.
+        if (!result.empty() && result.back().literal.empty()) {
+            throw dns::Exception("$GENERATE template has two substitutions in a row");
+        }
+        result.push_back(field);
+    }
+    if (!literal.literal.empty()) {
+        if (!result.empty() && result.back().literal.empty()) {
+            const Piece& field = result.back();
+            int d = digit_value(literal.literal[0]);
+            if (d >= 0 && d < radix(field.base, field.octet)) {
+                throw dns::Exception("$GENERATE template has a digit right after a substitution");
+            }
+        }
+        result.push_back(literal);
+    }
+    return result;
+}
+
+GeneratedRange::GeneratedRange(const char *src, const char *end)
+{
+    const char *p = src;
+    if (next_token(p, end) != "$GENERATE") {
+        throw dns::Exception("not a $GENERATE directive");
+    }
+    std::string range = next_token(p, end);
+    std::string owner = next_token(p, end);
+    std::string ttl = next_token(p, end);
+    std::string rrclass = next_token(p, end);
+    std::string rrtype = next_token(p, end);
+    while (p != end && isspace(*p)) ++p;
+    while (p != end && isspace(end[-1])) --end;
+    std::string rdata(p, end);
+    if (rdata.empty()) {
+        throw dns::Exception("$GENERATE directive has the wrong format");
+    }
+
+    size_t dash = range.find('-');
+    size_t slash = range.find('/');
+    if (dash == std::string::npos || (slash != std::string::npos && slash < dash)) {
+        throw dns::Exception("$GENERATE range has the wrong format: ", range);
+    }
+    m_first = parse_value(range.substr(0, dash));
+    m_last = parse_value(range.substr(dash + 1, slash - dash - 1));
+    if (slash != std::string::npos) {
+        m_step = parse_value(range.substr(slash + 1));
+    }
+    if (m_first > m_last || m_step == 0) {
+        throw dns::Exception("$GENERATE range is empty: ", range);
+    }
+
+    uint32_t t = parse_value(ttl);
+    if (t < 1 || t > 999999999 || ttl.find('.') != std::string::npos) {
+        throw dns::Exception("$GENERATE has an out-of-range TTL");
+    }
+    m_ttl = t;
+    m_rrclass = RRClass(rrclass);
+    if (m_rrclass != RRClass::IN) {
+        throw dns::Exception("$GENERATE has a class other than IN");
+    }
+    m_rrtype = RRType(rrtype);
+    if (m_rrtype != RRType::A && m_rrtype != RRType::CNAME && m_rrtype != RRType::PTR) {
+        throw dns::Exception("$GENERATE can't generate records of type ", rrtype);
+    }
+
+    // Split the owner into labels; those right of the last substitution
+    // are the origin.
+    if (owner.size() < 2 || owner.back() != '.') {
+        throw dns::Exception("$GENERATE owner must be an absolute name: ", owner);
+    }
+    std::vector<Template> labels;
+    size_t origin = 0;
+    for (size_t start = 0; start < owner.size(); ) {
+        size_t dot = owner.find('.', start);
+        if (dot == start) {
+            throw dns::Exception("$GENERATE owner contains an empty label");
+        }
+        labels.push_back(parse_template(owner.data() + start, owner.data() + dot));
+        for (auto&& piece : labels.back()) {
+            if (piece.literal.empty()) {
+                m_owner.resize(labels.size());
+                origin = dot + 1;
+            }
+        }
+        start = dot + 1;
+    }
+    if (m_owner.empty()) {
+        throw dns::Exception("$GENERATE owner has no substitutions");
+    }
+    std::copy(labels.begin(), labels.begin() + m_owner.size(), m_owner.begin());
+    m_origin = Name((origin == owner.size()) ? "." : owner.c_str() + origin);
+    m_rdata = parse_template(rdata.data(), rdata.data() + rdata.size());
+
+    // Every name must lead back to the one value it was made from.
+    bool has_value = false;
+    uint32_t mask = 0;
+    for (auto&& label : m_owner) {
+        for (auto&& piece : label) {
+            if (!piece.literal.empty()) continue;
+            if (piece.octet < 0) has_value = true;
+            else mask |= (0xFFu << (24 - 8 * piece.octet));
+        }
+    }
+    if (mask != 0 && m_step != 1) {
+        throw dns::Exception("$GENERATE owner can't use ${a} to ${d} with a step");
+    }
+    if (!has_value) {
+        uint32_t varying = m_first ^ m_last;
+        uint32_t needed = 0;
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            if ((varying >> shift) != 0) needed |= (0xFFu << shift);
+        }
+        if ((mask & needed) != needed) {
+            throw dns::Exception("$GENERATE owner doesn't tell the values in its range apart");
+        }
+    }
+    for (uint32_t value : {m_first, m_last - (m_last - m_first) % m_step}) {
+        const char *data[128];
+        uint8_t sizes[128];
+        char buffer[255];
+        char *dst = buffer;
+        size_t length = 1;
+        for (auto&& label : m_owner) {
+            char *e = render(label, value, dst, buffer + sizeof buffer);
+            if (e == nullptr || e == dst || (e - dst) > 63 || m_owner.size() > 127) {
+                throw dns::Exception("$GENERATE owner makes a malformed name");
+            }
+            data[&label - &m_owner[0]] = dst;
+            sizes[&label - &m_owner[0]] = e - dst;
+            length += 1 + (e - dst);
+            dst = e;
+        }
+        for (auto&& label : m_origin.labels()) {
+            length += label.empty() ? 0 : (1 + label.size());
+        }
+        uint32_t matched;
+        if (length > 255 || match(data, sizes, m_owner.size(), matched) != NAME || matched != value) {
+            throw dns::Exception("$GENERATE owner makes names that can't be told apart");
+        }
+        char rdata_wire[512];
+        if (write_rdata(value, rdata_wire, sizeof rdata_wire) == 0) {
+            throw dns::Exception("$GENERATE makes malformed ", rrtype, " records");
+        }
+    }
+    m_repr = "$GENERATE " + range + " " + owner + " " + ttl + " " + m_rrclass.repr() + " " + m_rrtype.repr() + " " + rdata;
+}
+
+// Write x in the given base, padded with zeros to `width` digits, at the
+// end of the buffer; return where it starts. (snprintf would take about
+// as long as the whole rest of a query.)
+static char *format_number(uint64_t x, char base, int width, char *buffer_end)
+{
+    static const char lower[] = "0123456789abcdef";
+    static const char upper[] = "0123456789ABCDEF";
+    const char *digits = (base == 'X') ? upper : lower;
+    unsigned r = radix(base, -1);
+    char *p = buffer_end;
+    do {
+        *--p = digits[x % r];
+        x /= r;
+    } while (x != 0);
+    while ((buffer_end - p) < width) {
+        *--p = '0';
+    }
+    return p;
+}
+
+char *GeneratedRange::render(const Template& t, uint32_t value, char *dst, const char *end) noexcept
+{
+    for (auto&& piece : t) {
+        char number[80];
+        const char *text;
+        size_t n;
+        if (!piece.literal.empty()) {
+            text = piece.literal.data();
+            n = piece.literal.size();
+        } else {
+            int64_t x = (piece.octet >= 0) ? ((value >> (24 - 8 * piece.octet)) & 0xFF) : (int64_t(value) + piece.offset);
+            if (x < 0) return nullptr;
+            text = format_number(x, piece.base, piece.width, number + sizeof number);
+            n = (number + sizeof number) - text;
+        }
+        if ((end - dst) < n) return nullptr;
+        memcpy(dst, text, n);
+        dst += n;
+    }
+    return dst;
+}
+
+bool GeneratedRange::match_label(const Template& t, const char *label, size_t n, Constraints& c) noexcept
+{
+    size_t pos = 0;
+    for (auto&& piece : t) {
+        if (!piece.literal.empty()) {
+            size_t k = piece.literal.size();
+            if (n - pos < k || !equal_ignoring_case(label + pos, piece.literal.data(), k)) return false;
+            pos += k;
+            continue;
+        }
+        int r = radix(piece.base, piece.octet);
+        uint64_t x = 0;
+        size_t start = pos;
+        for (; pos < n; ++pos) {
+            int d = digit_value(label[pos]);
+            if (d < 0 || d >= r) break;
+            x = (x * r) + d;
+            if (x > (uint64_t(1) << 40)) return false;
+        }
+        if (pos == start) return false;
+        if (piece.octet >= 0) {
+            int shift = 24 - 8 * piece.octet;
+            uint32_t m = 0xFFu << shift;
+            if (x > 255 || ((c.mask & m) && ((c.octets >> shift) & 0xFF) != x)) return false;
+            c.mask |= m;
+            c.octets |= uint32_t(x) << shift;
+        } else {
+            int64_t v = int64_t(x) - piece.offset;
+            if (v < 0 || v > 0xFFFFFFFFll || (c.has_value && c.value != v)) return false;
+            c.has_value = true;
+            c.value = v;
+        }
+    }
+    return pos == n;
+}
+
+bool GeneratedRange::in_range(uint32_t value) const noexcept
+{
+    return m_first <= value && value <= m_last && (value - m_first) % m_step == 0;
+}
+
+// The least value, not less than `first`, whose octets under `mask` are
+// those of `octets`; false if there is none below 2^32.
+static bool least_with_octets(uint32_t first, uint32_t mask, uint32_t octets, uint32_t& result)
+{
+    uint32_t v = 0;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        uint32_t m = 0xFFu << shift;
+        if (!(mask & m) || (octets & m) == (first & m)) {
+            v |= ((mask & m) ? octets : first) & m;
+            continue;
+        }
+        uint32_t below = (shift == 0) ? 0 : ((uint32_t(1) << shift) - 1);
+        if ((octets & m) > (first & m)) {
+            // Larger from here on; the free octets below can be zero.
+            result = v | (octets & m) | (octets & mask & below);
+            return true;
+        }
+        // Smaller: add one to the free octets above, carrying past the
+        // fixed ones, and start the free octets below from zero.
+        uint64_t free_above = ~uint64_t(mask) & ~uint64_t(below | m) & 0xFFFFFFFFull;
+        if (free_above == 0) return false;
+        uint64_t sum = (v | (~free_above & 0xFFFFFFFFull)) + (uint64_t(1) << (shift + 8));
+        if (sum >> 32) return false;
+        result = uint32_t(sum & free_above) | (octets & mask);
+        return true;
+    }
+    result = v;
+    return true;
+}
+
+// Match the template's labels from `first_label` on against the n labels
+// given, and find a value in the range that makes them.
+bool GeneratedRange::matches(int first_label, const char *const *labels, const uint8_t *sizes, int n,
+                             uint32_t& value) const noexcept
+{
+    Constraints c;
+    for (int j = 0; j < n; ++j) {
+        if (!match_label(m_owner[first_label + j], labels[j], sizes[j], c)) return false;
+    }
+    uint32_t v;
+    if (c.has_value) {
+        v = c.value;
+        if ((v & c.mask) != c.octets) return false;
+    } else if (first_label == 0) {
+        // The octets of the whole name pin the value down.
+        v = (m_first & ~c.mask) | c.octets;
+    } else if (!least_with_octets(m_first, c.mask, c.octets, v)) {
+        return false;
+    }
+    if (!in_range(v)) {
+        return false;
+    }
+    // The digits matched may still be spelled differently (with leading
+    // zeros, say) than they would be generated.
+    for (int j = 0; j < n; ++j) {
+        char label[63];
+        char *e = render(m_owner[first_label + j], v, label, label + sizeof label);
+        if (e == nullptr || size_t(e - label) != sizes[j] || !equal_ignoring_case(label, labels[j], sizes[j])) {
+            return false;
+        }
+    }
+    value = v;
+    return true;
+}
+
+GeneratedRange::Match GeneratedRange::match(const char *const *labels, const uint8_t *sizes, int n,
+                                            uint32_t& value) const noexcept
+{
+    int k = m_owner.size();
+    uint32_t v;
+    if (n == k) {
+        return matches(0, labels, sizes, n, value) ? NAME : NO_MATCH;
+    } else if (n < k) {
+        return matches(k - n, labels, sizes, n, v) ? ANCESTOR : NO_MATCH;
+    } else {
+        return matches(0, labels + (n - k), sizes + (n - k), k, v) ? DESCENDANT : NO_MATCH;
+    }
+}
+
+size_t GeneratedRange::write_rdata(uint32_t value, char *dst, size_t size) const noexcept
+{
+    char text[512];
+    char *end = render(m_rdata, value, text, text + sizeof text);
+    if (end == nullptr) {
+        return 0;
+    }
+    if (m_rrtype == RRType::A) {
+        const char *p = text;
+        if (size < 4) return 0;
+        for (int i = 0; i < 4; ++i) {
+            const char *dot = (i < 3) ? static_cast<const char *>(memchr(p, '.', end - p)) : end;
+            uint8_t octet;
+            if (dot == nullptr || !ReverseIndex::parse_octet(p, dot - p, octet)) return 0;
+            dst[i] = octet;
+            p = (dot == end) ? end : dot + 1;
+        }
+        return 4;
+    }
+    // A CNAME or PTR: an absolute name, written uncompressed.
+    if (end == text || end[-1] != '.') {
+        return 0;
+    }
+    if (end - text == 1) {
+        if (size < 1) return 0;
+        dst[0] = 0;
+        return 1;
+    }
+    size_t length = 0;
+    for (const char *p = text; p != end; ) {
+        const char *dot = static_cast<const char *>(memchr(p, '.', end - p));
+        size_t n = dot - p;
+        if (n == 0 || n > 63 || length + 1 + n + 1 > 255 || length + 1 + n + 1 > size) return 0;
+        dst[length] = n;
+        memcpy(dst + length + 1, p, n);
+        length += 1 + n;
+        p = dot + 1;
+    }
+    dst[length++] = 0;
+    return length;
+}
+
+RR GeneratedRange::make_rr(const Name& owner, uint32_t value) const
+{
+    char rdata[255];
+    size_t n = write_rdata(value, rdata, sizeof rdata);
+    return RR(owner, m_rrtype, m_rrclass, m_ttl, std::string(rdata, n));
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "nonstd.h"
+#include "question.h"
+#include "upstream.h"
+
+#include <chrono>
+#include <inttypes.h>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace dns {
+
+/**
+ *  AsyncClient sends queries to a single upstream over one non-blocking
+ *  UDP socket, and matches the replies to them by ID and question.
+ *  It never blocks: the caller polls @ref fd() for readability and then
+ *  drains replies with @ref receive().
+ */
+class AsyncClient {
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct Reply {
+        uint16_t tag;          // the ID that @ref send() returned
+        clock::duration rtt;   // time between send and receive
+        const char *packet;    // valid until the next call to receive()
+        const char *end;
+    };
+
+    explicit AsyncClient(Upstream upstream);
+    AsyncClient(const AsyncClient&) = delete;
+    AsyncClient& operator=(const AsyncClient&) = delete;
+    ~AsyncClient();
+
+    int fd() const noexcept { return m_sockfd; }
+    size_t in_flight() const noexcept { return m_in_flight.size(); }
+
+    /**
+     *  Send a query for the given question.
+     *  @param q The @ref Question to ask.
+     *  @param rd Whether to set the RD (recursion desired) bit.
+     *  @param tag Receives the ID of the outgoing query.
+     *  @return False if the query could not be sent (e.g. too many in flight).
+     */
+    bool send(const Question& q, bool rd, uint16_t& tag);
+
+    /**
+     *  Read the next reply that matches an outstanding query, discarding
+     *  any stray or malformed datagrams along the way.
+     *  @param reply Receives the matched reply.
+     *  @return False if there is nothing more to read right now.
+     */
+    bool receive(Reply& reply);
+
+    /**
+     *  Forget about queries that have been outstanding for too long.
+     *  @param timeout How long to wait for any one reply.
+     *  @return The tags of the queries that timed out.
+     */
+    std::vector<uint16_t> expire(nonstd::milliseconds timeout);
+
+    /**
+     *  How long until the oldest outstanding query times out.
+     *  @return A poll() timeout in milliseconds, or -1 if nothing is outstanding.
+     */
+    int next_timeout_ms(nonstd::milliseconds timeout) const;
+
+private:
+    using SendOrder = std::multimap<clock::time_point, uint16_t>;
+
+    struct InFlight {
+        std::string question;  // the question section, exactly as sent
+        SendOrder::iterator sent;
+    };
+
+    void forget(std::map<uint16_t, InFlight>::iterator it);
+
+    int m_sockfd;
+    std::mt19937 m_random;
+    std::map<uint16_t, InFlight> m_in_flight;
+    SendOrder m_by_sent;  // oldest first, so the next to time out is at the front
+    char m_buffer[4096];
+};
+
+} // namespace dns
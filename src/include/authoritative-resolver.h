@@ -1,30 +1,162 @@
 #pragma once
 
+#include "child-table.h"
+#include "compact-zone.h"
+#include "generated-range.h"
 #include "name.h"
 #include "message.h"
+#include "name-filter.h"
+#include "perfect-hash.h"
+#include "query-view.h"
 #include "question.h"
+#include "response.h"
+#include "response-writer.h"
+#include "reverse-index.h"
 #include "rr.h"
+#include "rrset.h"
 
 #include <list>
-#include <map>
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace dns {
 
+class DomainTreeNode;
+
+/**
+ *  Where a lookup of one name in the domain tree ended up
+ *  (RFC 1034, section 4.3.2, step 3): the name's node, the wildcard
+ *  matching it, or (if nothing matches) the closest encloser.
+ *  A name in the @ref ReverseIndex, or made by a @ref GeneratedRange, has
+ *  no node of its own; `node` is then the nearest node above it, whose
+ *  zone it is in.
+ */
+struct DomainTreeLookup {
+    const DomainTreeNode *node = nullptr;
+    const RRsetIndex *rrsets = nullptr;  // the name's (or wildcard's) records
+    bool found_nothing = false;
+    bool found_wildcard = false;
+    bool found_generated = false;  // the name's records are generated from `node`'s ranges
+    bool found_reverse = false;    // the name's records are [reverse_first, reverse_last) of `node`'s reverse index
+    size_t reverse_first = 0;
+    size_t reverse_last = 0;
+};
+
 class DomainTreeNode {
 public:
     DomainTreeNode() = default;
 
-    bool is_top_of_zone() const noexcept { return m_has_SOA_record; }
-    bool is_zone_cut() const noexcept { return m_has_NS_record && !m_has_SOA_record; }
+    bool is_top_of_zone() const noexcept { return m_rrsets.has_type(RRType::SOA); }
+    bool is_zone_cut() const noexcept { return m_rrsets.has_type(RRType::NS) && !is_top_of_zone(); }
+
+    /**
+     *  @param folded A label, folded to lowercase by fold_label().
+     *  @param hash Its hash, as returned by fold_label().
+     *  @return The child with that label, or nullptr if there is none.
+     */
+    const DomainTreeNode *find_child(const char *folded, size_t n, uint32_t hash) const noexcept {
+        return m_children.find(folded, n, hash);
+    }
+
+    /**
+     *  The apex of the zone this node is in, and how many labels deep
+     *  (not counting the root) that apex is.
+     */
+    const DomainTreeNode *top_of_zone() const noexcept { return m_top_of_zone; }
+    int depth() const noexcept { return m_depth; }
+
+    /**
+     *  The zone's SOA RRset: the authority section of negative answers.
+     */
+    const RRset *soa() const noexcept { return m_soa; }
+
+    /**
+     *  At a zone's apex, its SOA record pre-encoded for negative answers,
+     *  beginning with a two-byte placeholder for the owner name.
+     */
+    const std::string& negative_template() const noexcept { return m_negative_template; }
+
+    /**
+     *  At in-addr.arpa. and below it, the index of the PTR records of
+     *  addresses that have no nodes of their own.
+     */
+    const ReverseIndex *reverse_index() const noexcept { return m_reverse; }
+
+    /**
+     *  The ranges of generated records whose origin is this node.
+     */
+    const std::vector<const GeneratedRange *>& generated_ranges() const noexcept { return m_generated; }
 
 private:
     friend class AuthoritativeResolver;
 
-    bool m_has_SOA_record = false;
-    bool m_has_NS_record = false;
-    std::map<Label, DomainTreeNode> m_children;
-    std::list<RR> m_rr_list;
+    struct CNAMETarget {
+        Name name;
+        DomainTreeLookup lookup;
+    };
+
+    ChildTable<DomainTreeNode> m_children;
+    std::list<RR> m_rr_list;  // in zone-file order
+    RRsetIndex m_rrsets;      // the same records, by type
+    std::vector<const GeneratedRange *> m_generated;
+
+    // For a node that owns a CNAME: its target, and where a lookup of
+    // the target ended up when the zone was loaded.
+    std::unique_ptr<CNAMETarget> m_cname_target;
+
+    // Everything a lookup ending here needs to know about the path down
+    // to this node, worked out when the zone is loaded. m_soa is the
+    // authority section of NXDOMAIN and NODATA answers, and m_referral
+    // (whose glue hangs off it) that of referrals.
+    bool m_authoritative = false;
+    const DomainTreeNode *m_top_of_zone = nullptr;
+    const DomainTreeNode *m_zone_cut = nullptr;
+    const DomainTreeNode *m_wildcard = nullptr;
+    const RRset *m_soa = nullptr;
+    const RRset *m_referral = nullptr;
+    int m_depth = 0;
+    std::string m_negative_template;
+
+    // At in-addr.arpa. and below it: the index of the addresses' records.
+    const ReverseIndex *m_reverse = nullptr;
+
+    // At the apex of a zone without wildcards or generated ranges: a filter over the names in
+    // the zone, down to and including its zone cuts, and the hashes of the
+    // cuts themselves (sorted), so that most nonexistent names can be
+    // answered without a walk down the tree.
+    std::unique_ptr<NameFilter> m_name_filter;
+    std::vector<uint32_t> m_cut_hashes;
+    double m_false_positive_rate = 0;
+};
+
+/**
+ *  The indexes an @ref AuthoritativeResolver builds over its zones when
+ *  it loads them, besides the domain tree itself (which can answer every
+ *  query on its own).
+ */
+struct ResolverOptions {
+    /** A @ref NameFilter for each zone that allows one, to answer NXDOMAIN without a tree walk. */
+    bool name_filters = true;
+
+    /** A @ref PerfectHash over all owner names, to find exact matches without a tree walk. */
+    bool exact_index = true;
+
+    /** Intern the owner names too long to be stored inline, sharing one copy of each. */
+    bool intern_names = true;
+
+    /** Pre-encode each zone's SOA record, to be copied into negative answers as is. */
+    bool negative_templates = true;
+
+    /** Keep the PTR records of d.c.b.a.in-addr.arpa. names in a @ref ReverseIndex instead of the tree. */
+    bool reverse_index = true;
+
+    /**
+     *  Keep the zones in a @ref CompactZone instead of the domain tree,
+     *  for much less memory but slower answers; none of the indexes
+     *  above are built then, and $GENERATE isn't supported.
+     */
+    bool compact_storage = false;
 };
 
 /**
@@ -38,25 +170,88 @@ public:
      *  Open the zonefile and read it to initialize the database.
      *  @param filename Name of the file containing the zone data.
      */
-    explicit AuthoritativeResolver(const std::string& filename);
+    explicit AuthoritativeResolver(const std::string& filename, const ResolverOptions& options = ResolverOptions());
 
     /**
      *  Process the query and produce a response.
+     *  The response refers to the question and to this resolver's records
+     *  without copying them.
      *  @param question @ref Question that will be processed.
      */
-    void populate_response(const Question& question, Message& response) const;
+    void populate_response(const Question& question, Response& response) const;
 
     /**
-     *  Prints all records from the list.
+     *  Process the query and write the response directly in wire format.
+     *  @param query A @ref QueryView whose question has been parsed.
      */
-    void print_records() const;
+    void populate_response(const QueryView& query, ResponseWriter& response) const;
+
+    /**
+     *  What @ref dump_records wrote: the records, and apart from them
+     *  the $GENERATE lines, each of which stands for a range of records
+     *  that is not expanded.
+     */
+    struct DumpCounts {
+        size_t records = 0;
+        size_t generated = 0;
+    };
+
+    /**
+     *  Write every record to `fd` in zone-file format, in the order of the
+     *  domain tree (each $GENERATE range as its one line), splitting the
+     *  work by subtree across `threads` threads if it is more than one.
+     */
+    DumpCounts dump_records(int fd, int threads = 1) const;
+
+    /**
+     *  Prints each zone's name filter: its size, memory, and the
+     *  false-positive rate measured when it was built.
+     */
+    void print_name_filters() const;
 
 private:
+    struct Apex {
+        uint32_t hash;
+        const DomainTreeNode *node;
+        std::string folded_name;  // in wire format, without the root label
+    };
+
     void add_rr(RR rr);
-    void add_SOA_to_authority_section(const DomainTreeNode *node, Message& response) const;
-    void populate_with_referral(const DomainTreeNode *zone_cut_node, Message& response) const;
+    void add_generated_range(GeneratedRange range);
+    void index_reverse_records();
+    void precompute_zones(bool negative_templates);
+    void resolve_additional();
+    void resolve_cname_targets();
+    void build_name_filters();
+    void build_exact_index();
+    const DomainTreeNode *find_exact(const Name& name) const noexcept;
+    const DomainTreeNode *find_exact(const QueryView& query) const noexcept;
+    const DomainTreeNode *find_apex(const QueryView& query, int i) const noexcept;
+    const DomainTreeNode *filtered_nxdomain(const Question& question) const noexcept;
+    const DomainTreeNode *filtered_nxdomain(const QueryView& query) const noexcept;
+    const DomainTreeNode *find_node(const Name& name) const;
+    template<class QName> DomainTreeLookup lookup(const QName& qname) const;
+    template<class Query, class Sink> void populate(const Query& question, Sink& response) const;
+    template<class Sink> void populate_with_referral(const DomainTreeNode *node, Sink& response) const;
+    template<class Sink> static void add_additional_section(const RRset *const *rrsets, int n, Sink& response);
+
+    // In compact storage mode, the zones are here instead of in the tree.
+    std::unique_ptr<CompactZone> m_compact;
 
     DomainTreeNode m_root;
+    ReverseIndex m_reverse_index;
+    std::list<GeneratedRange> m_generated_ranges;
+    const DomainTreeNode *m_reverse_root = nullptr;  // in-addr.arpa.
+    std::vector<Apex> m_apexes;  // sorted by hash
+
+    // Every owner name, to find exact matches without a tree walk: the
+    // node at each index of the perfect hash, and its folded name (in wire
+    // format, without the root label) at an offset into m_exact_names,
+    // prefixed by its length.
+    PerfectHash m_exact_hash;
+    std::vector<const DomainTreeNode *> m_exact_nodes;
+    std::vector<uint32_t> m_exact_name_offsets;
+    std::string m_exact_names;
 };
 
 } // namespace dns
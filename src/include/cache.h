@@ -0,0 +1,108 @@
+#pragma once
+
+#include "message.h"
+#include "question.h"
+
+#include <chrono>
+#include <inttypes.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dns {
+
+/**
+ *  Cache is an in-process cache of DNS responses, keyed by question.
+ *  Positive answers are kept for the smallest TTL in the answer section;
+ *  NXDOMAIN and NODATA answers are kept for the SOA minimum (RFC 2308).
+ *  Entries are spread over independently locked shards, and each shard
+ *  evicts its least recently used entries to stay within its share of
+ *  the memory budget.
+ */
+class Cache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t insertions = 0;
+        uint64_t evictions = 0;
+        size_t entries = 0;
+        size_t bytes = 0;
+
+        double hit_ratio() const noexcept;
+        std::string repr() const;
+    };
+
+    /**
+     *  @param max_bytes The memory budget, shared evenly among the shards.
+     *  @param shards The number of independently locked shards.
+     */
+    explicit Cache(size_t max_bytes = 16 << 20, int shards = 16);
+
+    /**
+     *  Look up a cached response to the given question.
+     *  @param q The @ref Question to look up.
+     *  @param wire On a hit, receives the response as it came off the wire,
+     *         but with each record's TTL reduced by the time it has been cached.
+     *  @return True on a hit; false if nothing fresh was found.
+     */
+    bool lookup(const Question& q, std::string& wire);
+
+    /**
+     *  Forget any cached response to the given question.
+     */
+    void evict(const Question& q);
+
+    /**
+     *  Remember the response to the given question, if it is cacheable.
+     *  @param q The @ref Question that was asked.
+     *  @param response The decoded response.
+     *  @param packet The start of the response's wire representation.
+     *  @param end A pointer one past the end of the wire representation.
+     */
+    void insert(const Question& q, const Message& response, const char *packet, const char *end);
+
+    /**
+     *  Compute how long the response may be cached, in seconds.
+     *  @return The TTL, or 0 if the response must not be cached.
+     */
+    static uint32_t cacheable_ttl(const Message& response);
+
+    static std::string key_for(const Question& q);
+
+    Stats stats() const;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct Entry {
+        std::string key;
+        std::string wire;
+        clock::time_point stored;
+        clock::time_point expires;
+    };
+
+    struct Shard {
+        mutable std::mutex mtx;
+        std::list<Entry> lru;  // most recently used at the front
+        std::unordered_map<std::string, std::list<Entry>::iterator> index;
+        size_t bytes = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t insertions = 0;
+        uint64_t evictions = 0;
+    };
+
+    Shard& shard_for(const std::string& key);
+    static size_t footprint(const Entry& e) noexcept;
+    static void erase(Shard& shard, std::list<Entry>::iterator it);
+    static void age_ttls(std::string& wire, uint32_t age) noexcept;
+
+    size_t m_max_bytes_per_shard;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+};
+
+} // namespace dns
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <vector>
+
+namespace dns {
+
+/**
+ *  DNS compares labels case-insensitively in ASCII only (RFC 4343):
+ *  bytes outside 'A'..'Z' are left alone, whatever the locale.
+ */
+inline uint8_t ascii_tolower(uint8_t octet) noexcept
+{
+    return (octet >= 'A' && octet <= 'Z') ? (octet + ('a' - 'A')) : octet;
+}
+
+inline uint8_t ascii_toupper(uint8_t octet) noexcept
+{
+    return (octet >= 'a' && octet <= 'z') ? (octet - ('a' - 'A')) : octet;
+}
+
+/**
+ *  Hash bytes that have already been folded, eight at a time.
+ */
+uint32_t hash_folded(const char *folded, size_t n) noexcept;
+
+/**
+ *  Extend the hash of a name by the label to its left. Names are hashed
+ *  from the root outward (the root's hash is 0), so hashing a name yields
+ *  the hashes of all its suffixes along the way.
+ */
+inline uint32_t hash_name_step(uint32_t suffix_hash, uint32_t label_hash) noexcept
+{
+    return (suffix_hash * 31) + label_hash;
+}
+
+/**
+ *  One implementation of the case-folding primitives. Every kernel gives
+ *  exactly the same results as the scalar one, for every octet value;
+ *  they differ only in speed. Each takes any length: fold_label() is
+ *  given one label at a time, but equal() and compare() are also given
+ *  whole names of up to 255 bytes.
+ */
+struct CaseFoldKernel {
+    const char *name;
+
+    /**
+     *  Fold a label to lowercase and hash it (with hash_folded()).
+     *  @param dst Where to write the `n` folded bytes; may be the same as `src`.
+     */
+    uint32_t (*fold_label)(const char *src, size_t n, char *dst);
+
+    /** True if the two labels are equal ignoring ASCII case. */
+    bool (*equal)(const char *a, const char *b, size_t n);
+
+    /**
+     *  Compare the two labels as if both were folded to uppercase,
+     *  octet by octet as unsigned values.
+     *  @return Negative, zero, or positive, as for memcmp().
+     */
+    int (*compare)(const char *a, const char *b, size_t n);
+};
+
+/**
+ *  The kernels this CPU can run, the scalar one first. The last is the
+ *  one the functions below dispatch to.
+ */
+std::vector<const CaseFoldKernel *> supported_casefold_kernels();
+
+const CaseFoldKernel& casefold_kernel() noexcept;
+
+inline uint32_t fold_label(const char *src, size_t n, char *dst) noexcept
+{
+    return casefold_kernel().fold_label(src, n, dst);
+}
+
+inline bool equal_ignoring_case(const char *a, const char *b, size_t n) noexcept
+{
+    return casefold_kernel().equal(a, b, n);
+}
+
+inline int compare_ignoring_case(const char *a, const char *b, size_t n) noexcept
+{
+    return casefold_kernel().compare(a, b, n);
+}
+
+} // namespace dns
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <inttypes.h>
+#include <memory>
+#include <string>
+#include <string.h>
+#include <vector>
+
+namespace dns {
+
+/**
+ *  The children of a node in the domain tree, keyed by case-folded label.
+ *  Each key is stored folded, alongside its hash, at insertion time, so a
+ *  lookup (with a key the caller has already folded and hashed) is a hash
+ *  compare followed by a memcmp. A node with only a few children is
+ *  searched linearly; a node with many (say, a TLD apex) also keeps an
+ *  open-addressing index over them.
+ */
+template<class T>
+class ChildTable {
+public:
+    explicit ChildTable() = default;
+
+    size_t size() const noexcept { return m_entries.size(); }
+
+    /**
+     *  @param key The folded label.
+     *  @param hash The hash of the folded label, as returned by fold_label().
+     *  @return The child, or nullptr if there is none.
+     */
+    T *find(const char *key, size_t n, uint32_t hash) const noexcept {
+        if (m_slots.empty()) {
+            for (auto&& e : m_entries) {
+                if (matches(e, key, n, hash)) return e.child.get();
+            }
+            return nullptr;
+        }
+        size_t mask = m_slots.size() - 1;
+        for (size_t i = mix(hash) & mask; m_slots[i] != 0; i = (i + 1) & mask) {
+            const Entry& e = m_entries[m_slots[i] - 1];
+            if (matches(e, key, n, hash)) return e.child.get();
+        }
+        return nullptr;
+    }
+
+    /**
+     *  Find the child with the given (folded) key, creating it if need be.
+     */
+    T& find_or_insert(const char *key, size_t n, uint32_t hash) {
+        T *found = find(key, n, hash);
+        if (found != nullptr) return *found;
+        Entry e;
+        e.hash = hash;
+        e.key_offset = m_keys.size();
+        e.key_size = n;
+        e.child.reset(new T);
+        m_keys.append(key, n);
+        m_entries.push_back(std::move(e));
+        if (m_entries.size() > linear_limit && m_entries.size() * 2 > m_slots.size()) {
+            rehash(m_entries.size() * 4);
+        } else if (!m_slots.empty()) {
+            insert_slot(m_entries.size() - 1);
+        }
+        return *m_entries.back().child;
+    }
+
+    /**
+     *  Call f(key, n, child) for each child, in insertion order.
+     */
+    template<class F>
+    void for_each(const F& f) const {
+        for (auto&& e : m_entries) {
+            f(m_keys.data() + e.key_offset, size_t(e.key_size), const_cast<const T&>(*e.child));
+        }
+    }
+
+    template<class F>
+    void for_each(const F& f) {
+        for (auto&& e : m_entries) {
+            f(m_keys.data() + e.key_offset, size_t(e.key_size), *e.child);
+        }
+    }
+
+private:
+    // Beyond this many children, keep a hash index as well.
+    static constexpr size_t linear_limit = 8;
+
+    struct Entry {
+        uint32_t hash;
+        uint32_t key_offset;
+        uint8_t key_size;
+        std::unique_ptr<T> child;
+    };
+
+    static size_t mix(uint32_t h) noexcept {
+        // The slot comes from the low bits alone; MurmurHash3's fmix32
+        // spreads every bit of the hash into them.
+        h ^= h >> 16; h *= 0x85ebca6bu;
+        h ^= h >> 13; h *= 0xc2b2ae35u;
+        h ^= h >> 16;
+        return h;
+    }
+
+    bool matches(const Entry& e, const char *key, size_t n, uint32_t hash) const noexcept {
+        return e.hash == hash && e.key_size == n && memcmp(m_keys.data() + e.key_offset, key, n) == 0;
+    }
+
+    void insert_slot(size_t index) noexcept {
+        size_t mask = m_slots.size() - 1;
+        size_t i = mix(m_entries[index].hash) & mask;
+        while (m_slots[i] != 0) i = (i + 1) & mask;
+        m_slots[i] = index + 1;
+    }
+
+    void rehash(size_t minimum) {
+        size_t capacity = 16;
+        while (capacity < minimum) capacity *= 2;
+        m_slots.assign(capacity, 0);
+        for (size_t i = 0; i < m_entries.size(); ++i) {
+            insert_slot(i);
+        }
+    }
+
+    std::vector<Entry> m_entries;
+    std::string m_keys;              // every folded key, back to back
+    std::vector<uint32_t> m_slots;   // 1 + index into m_entries, or 0 if empty
+};
+
+template<class T> constexpr size_t ChildTable<T>::linear_limit;
+
+} // namespace dns
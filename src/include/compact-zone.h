@@ -0,0 +1,213 @@
+#pragma once
+
+#include "name.h"
+#include "query-view.h"
+#include "question.h"
+#include "response.h"
+#include "response-writer.h"
+#include "rr.h"
+#include "rrtype.h"
+#include "succinct-tree.h"
+#include "symboltable.h"
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace dns {
+
+/**
+ *  Zone data laid out for memory rather than speed, for servers that
+ *  must hold many millions of names. Where the default layout keeps a
+ *  node with a child table, a list of @ref RR objects (each with its own
+ *  copy of the owner name and RDATA) and an @ref RRsetIndex for every
+ *  name, this keeps four flat arrays:
+ *
+ *  - the names, in canonical order (RFC 4034, section 6.1), front-coded:
+ *    each is the name before it cut back to its parent, plus one label;
+ *  - the shape of the tree, as a @ref SuccinctTree over the same order;
+ *  - each owner name's records, packed, with their RDATA by reference;
+ *  - the RDATA itself, each distinct value once.
+ *
+ *  A lookup walks down from the root one label at a time, as in the
+ *  default layout, binary-searching each node's children by label, so
+ *  it takes O(depth * log(fanout)) steps; but each step costs more, and
+ *  whatever the default layout works out when the zone is loaded (zone
+ *  cuts, CNAME targets, glue) is worked out again for every query.
+ *
+ *  Of what this layout was asked for, the front-coded names in canonical
+ *  order, the RDATA stored once per distinct value, and the succinct tree
+ *  in place of child tables are all here, and take about 1/20 of the
+ *  default layout's heap. The lookup is not strictly O(depth): the hash
+ *  tables that make each step O(1) in the default layout are what this
+ *  leaves out to save memory, so each step is a binary search instead.
+ *  A lookup still touches only the nodes on the path, however big the
+ *  zone, but queries take 4 to 6 times as long as in the default layout.
+ *
+ *  The names' case is kept as loaded, and a name's labels are compared
+ *  after folding to lowercase.
+ */
+class CompactZone {
+public:
+    explicit CompactZone() = default;
+
+    /**
+     *  Add a record while the zone is being loaded. Nothing can be found
+     *  until @ref finish is called.
+     */
+    void add(const RR& rr);
+
+    /**
+     *  Sort the records added so far, and build the arrays.
+     */
+    void finish();
+
+    size_t name_count() const noexcept { return m_tree.size(); }
+    size_t record_count() const noexcept { return m_record_count; }
+    size_t rdata_count() const noexcept { return m_rdata_count; }
+    size_t memory_bytes() const noexcept;
+
+    /**
+     *  Answer the query, as @ref AuthoritativeResolver does with its own
+     *  zone data (except that it has no generated ranges).
+     */
+    void populate_response(const Question& question, Response& response) const;
+    void populate_response(const QueryView& query, ResponseWriter& response) const;
+
+    /**
+     *  Call f(owner, rrtype, rrclass, ttl, rdata, rdlength) for each record,
+     *  in canonical order of owner names, and by type within each name.
+     */
+    template<class F>
+    void for_each(const F& f) const;
+
+private:
+    enum : uint8_t {
+        HAS_SOA = 1,
+        HAS_NS = 2,
+        HAS_CNAME = 4,
+    };
+
+    // Where a lookup ended up: as DomainTreeLookup, plus what the default
+    // layout would have worked out for the node in advance.
+    struct Lookup {
+        size_t node = 0;
+        bool found_nothing = false;
+        bool found_wildcard = false;
+        bool authoritative = false;
+        int apex_depth = -1;  // how many labels deep the zone's apex is
+        size_t apex = 0;
+        int cut_depth = -1;   // the zone cut above the node, if any
+        size_t cut = 0;
+    };
+
+    // An owner's records are packed in m_records as its HAS_* flags and
+    // the number of its RRsets (a byte each), then each RRset, by type:
+    // its type and the number of its records, then each record's class,
+    // TTL, and the offset of its RDATA in m_rdata; all in host order.
+    static const size_t record_size = 2 + 4 + 4;
+
+    struct RRsetRef {
+        RRType rrtype;
+        int count;
+        const char *records;
+    };
+
+    template<class T>
+    static T load(const char *p) noexcept {
+        T value;
+        memcpy(&value, p, sizeof value);
+        return value;
+    }
+
+    class Labels;
+    template<class Query, class Sink> void populate(const Query& question, Sink& response) const;
+    Lookup lookup(const Labels& labels) const noexcept;
+    size_t find_child(size_t node, const char *folded, size_t n) const noexcept;
+    const char *name_entry(size_t node) const noexcept;
+    const char *owner_records(size_t node) const noexcept;
+    bool find_rrset(size_t node, RRType rrtype, RRsetRef& rrset) const noexcept;
+    template<class F> void for_each_rrset(size_t node, const F& f) const;
+    template<class F> void for_each_record(const RRsetRef& rrset, const F& f) const;
+    const char *rdata(uint32_t offset, size_t& length) const noexcept;
+
+    // While loading: each record as its folded name (labels from the
+    // root), then its name in wire format, type, class, TTL and RDATA.
+    std::string m_pending;
+    std::vector<size_t> m_pending_offsets;
+
+    SuccinctTree m_tree;
+    std::string m_names;                   // (depth - 1, label length, label), in preorder
+    std::vector<uint32_t> m_name_samples;  // the offset of every 8th name in m_names
+    std::vector<uint64_t> m_owner_bits;    // which names own records
+    std::vector<uint32_t> m_owner_ranks;   // how many do, before each word of m_owner_bits
+    std::vector<uint32_t> m_owner_offsets; // each owner's records in m_records
+    std::string m_records;
+    std::string m_rdata;                   // (length, RDATA), each distinct value once
+    size_t m_record_count = 0;
+    size_t m_rdata_count = 0;
+};
+
+template<class F>
+void CompactZone::for_each(const F& f) const
+{
+    // Rebuild each name from the one before, as it was front-coded: keep
+    // the labels of the current path, from the root.
+    const char *path[128];
+    size_t depth = 0;
+    const char *p = m_names.data();
+    for (size_t node = 0; node < m_tree.size(); ++node) {
+        if (node != 0) {
+            depth = uint8_t(p[0]) + 1;
+            path[depth] = p + 1;
+        }
+        p += 2 + uint8_t(p[1]);
+        const char *records = owner_records(node);
+        if (records == nullptr) continue;
+        char wire[255];
+        char *dst = wire;
+        for (size_t d = depth; d >= 1; --d) {
+            size_t n = uint8_t(path[d][0]);
+            memcpy(dst, path[d], 1 + n);
+            dst += 1 + n;
+        }
+        *dst++ = 0;
+        SymbolTable syms;  // empty, will not be used
+        Name owner;
+        owner.decode(syms, wire, dst);
+        for_each_rrset(node, [&](const RRsetRef& rrset) {
+            for_each_record(rrset, [&](RRClass rrclass, uint32_t ttl, const char *data, size_t length) {
+                f(owner, rrset.rrtype, rrclass, ttl, data, length);
+            });
+        });
+    }
+}
+
+template<class F>
+void CompactZone::for_each_rrset(size_t node, const F& f) const
+{
+    const char *p = owner_records(node);
+    if (p == nullptr) return;
+    int n = uint8_t(p[1]);
+    p += 2;
+    for (int i = 0; i < n; ++i) {
+        RRsetRef rrset{RRType(load<uint16_t>(p)), load<uint16_t>(p + 2), p + 4};
+        f(rrset);
+        p = rrset.records + rrset.count * record_size;
+    }
+}
+
+template<class F>
+void CompactZone::for_each_record(const RRsetRef& rrset, const F& f) const
+{
+    for (int i = 0; i < rrset.count; ++i) {
+        const char *r = rrset.records + i * record_size;
+        size_t length;
+        const char *data = rdata(load<uint32_t>(r + 6), length);
+        f(RRClass(load<uint16_t>(r)), load<uint32_t>(r + 2), data, length);
+    }
+}
+
+} // namespace dns
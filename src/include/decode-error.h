@@ -0,0 +1,62 @@
+#pragma once
+
+#include "nonstd.h"
+
+#include <inttypes.h>
+#include <string>
+
+namespace dns {
+
+/**
+ *  The reason a packet (or part of one) failed to decode. Decoding
+ *  reports these as values, never by throwing, so that a flood of
+ *  garbage packets costs no more than a flood of good ones.
+ */
+class DecodeError {
+public:
+    enum detail : uint8_t {
+        OK = 0,
+        TRUNCATED = 1,       // ran off the end of the packet
+        BAD_LABEL_TYPE = 2,  // label type 0x40 or 0x80
+        BAD_POINTER = 3,     // compression pointer out of range, or where none may appear
+        POINTER_LOOP = 4,
+        NAME_TOO_LONG = 5,
+        BAD_RDATA = 6,
+    };
+
+    explicit constexpr DecodeError() = default;
+    explicit constexpr DecodeError(int x) : m_value(x) {}
+    constexpr DecodeError(enum DecodeError::detail x) : m_value(int(x)) {}
+    explicit constexpr operator int() const { return m_value; }
+    constexpr bool operator==(DecodeError rhs) const { return m_value == rhs.m_value; }
+    constexpr bool operator!=(DecodeError rhs) const { return m_value != rhs.m_value; }
+
+    std::string repr() const {
+        switch (m_value) {
+            case OK: return "OK";
+            case TRUNCATED: return "TRUNCATED";
+            case BAD_LABEL_TYPE: return "BAD_LABEL_TYPE";
+            case BAD_POINTER: return "BAD_POINTER";
+            case POINTER_LOOP: return "POINTER_LOOP";
+            case NAME_TOO_LONG: return "NAME_TOO_LONG";
+            case BAD_RDATA: return "BAD_RDATA";
+            default: return std::to_string(int(m_value));
+        }
+    }
+
+private:
+    uint8_t m_value = 0;
+};
+
+/**
+ *  The result of decoding something from the wire: a pointer one past
+ *  the last byte consumed, or the reason decoding failed.
+ */
+using DecodeResult = nonstd::expected<const char *, DecodeError>;
+
+inline nonstd::unexpected<DecodeError> decode_error(DecodeError e) noexcept
+{
+    return nonstd::unexpected<DecodeError>(e);
+}
+
+} // namespace dns
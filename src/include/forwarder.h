@@ -0,0 +1,98 @@
+#pragma once
+
+#include "async-client.h"
+#include "cache.h"
+#include "nonstd.h"
+#include "question.h"
+#include "upstream.h"
+
+#include <functional>
+#include <inttypes.h>
+#include <map>
+#include <netinet/in.h>
+#include <string>
+#include <vector>
+
+namespace dns {
+
+/**
+ *  Forwarder answers queries outside our authority by relaying them to an
+ *  upstream resolver through an @ref AsyncClient. Answers are kept in a
+ *  shared @ref Cache, and identical questions that arrive while a query is
+ *  already outstanding are coalesced onto it, so that the upstream sees
+ *  each question only once.
+ */
+class Forwarder {
+public:
+    struct Client {
+        sockaddr_in addr;
+        uint16_t id;
+        bool rd;
+        Question question;
+    };
+
+    /**
+     *  Called with each finished response, ready to send to the client.
+     */
+    using SendFn = std::function<void(const sockaddr_in& addr, const char *packet, const char *end)>;
+
+    /**
+     *  Counts of the upstream replies that were passed on to the clients
+     *  but could not be cached, by reason.
+     */
+    struct RejectCounts {
+        uint64_t undecodable = 0;  // the reply did not decode
+
+        std::string repr() const;
+    };
+
+    explicit Forwarder(Upstream upstream, Cache& cache, nonstd::milliseconds timeout = nonstd::seconds(2));
+
+    int fd() const noexcept { return m_client.fd(); }
+
+    const Cache& cache() const noexcept { return m_cache; }
+
+    const RejectCounts& rejects() const noexcept { return m_rejects; }
+
+    /**
+     *  @return A poll() timeout in milliseconds, or -1 if nothing is outstanding.
+     */
+    int next_timeout_ms() const { return m_client.next_timeout_ms(m_timeout); }
+
+    /**
+     *  Answer the client from the cache, or else start (or join) an upstream
+     *  query on its behalf. This never blocks.
+     *  @return False if the client did not ask for recursion and the cache
+     *          could not help; the caller should then refuse the query.
+     */
+    bool resolve(Client client, const SendFn& send);
+
+    /**
+     *  Deliver any upstream replies that have arrived. Call this when
+     *  @ref fd() is readable.
+     */
+    void on_readable(const SendFn& send);
+
+    /**
+     *  Answer SERVFAIL to clients whose upstream query has timed out.
+     */
+    void on_timer(const SendFn& send);
+
+private:
+    struct Pending {
+        uint16_t tag;
+        std::vector<Client> waiters;
+    };
+
+    void reply(const Client& client, const char *packet, const char *end, const SendFn& send) const;
+    void reply_servfail(const Client& client, const SendFn& send) const;
+
+    AsyncClient m_client;
+    Cache& m_cache;
+    nonstd::milliseconds m_timeout;
+    RejectCounts m_rejects;
+    std::map<std::string, Pending> m_pending;  // keyed by Cache::key_for
+    std::map<uint16_t, std::string> m_key_by_tag;
+};
+
+} // namespace dns
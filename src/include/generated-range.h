@@ -0,0 +1,113 @@
+#pragma once
+
+#include "name.h"
+#include "rr.h"
+#include "rrtype.h"
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace dns {
+
+/**
+ *  A range of records made from one template by a $GENERATE directive,
+ *  whose owner names and RDATA are worked out when a query asks for
+ *  them rather than stored: it takes the same memory however many
+ *  records it stands for.
+ *
+ *      $GENERATE <first>-<last>[/<step>] <owner> <ttl> <class> <type> <rdata>
+ *
+ *  For each value v from first to last (by step), the owner and RDATA
+ *  templates are filled in: "$" becomes v in decimal, as does "${offset,
+ *  width,base}" after adding the offset and padding with zeros to the
+ *  width (base d, o, x or X, as in BIND). Besides, "${a}" through "${d}"
+ *  become the octets of v, from the most significant, so that a range
+ *  may be given as addresses: "10.1.0.0-10.1.255.255". "\$" is a "$".
+ *
+ *  The owner template must be absolute, and the labels to the right of
+ *  its last substitution, its origin, are fixed; the labels between a
+ *  generated name and the origin exist (as empty non-terminals) too.
+ *  Only A, CNAME and PTR records can be generated.
+ */
+class GeneratedRange {
+public:
+    enum Match {
+        NO_MATCH,
+        NAME,        // the generated name itself
+        ANCESTOR,    // a name between some generated name and the origin
+        DESCENDANT,  // a name below some generated name
+    };
+
+    /**
+     *  Parse a $GENERATE directive.
+     *  @throws dns::Exception if it's malformed, or its records would be.
+     */
+    explicit GeneratedRange(const char *src, const char *end);
+
+    const Name& origin() const noexcept { return m_origin; }
+    RRType rrtype() const noexcept { return m_rrtype; }
+    RRClass rrclass() const noexcept { return m_rrclass; }
+    uint32_t ttl() const noexcept { return m_ttl; }
+
+    /**
+     *  Match a name below the origin against the generated names.
+     *  @param labels The name's labels down to the origin, leftmost first.
+     *  @param value Set, for a NAME match, to the value it was made from.
+     */
+    Match match(const char *const *labels, const uint8_t *sizes, int n, uint32_t& value) const noexcept;
+
+    /**
+     *  Write the RDATA of the record made from `value`, in wire format.
+     *  @return Its length, or 0 if it doesn't fit or comes out malformed.
+     */
+    size_t write_rdata(uint32_t value, char *dst, size_t size) const noexcept;
+
+    /**
+     *  The record made from `value`, whose owner is taken to be `owner`.
+     */
+    RR make_rr(const Name& owner, uint32_t value) const;
+
+    /**
+     *  The directive, as it would appear in a zone file.
+     */
+    const std::string& repr() const noexcept { return m_repr; }
+
+private:
+    struct Piece {
+        std::string literal;   // if empty, a substitution:
+        int64_t offset = 0;
+        int width = 0;
+        char base = 'd';
+        int octet = -1;        // 0 for ${a}, ..., 3 for ${d}; -1 for the value itself
+    };
+    typedef std::vector<Piece> Template;
+
+    // What the labels matched so far say about the value.
+    struct Constraints {
+        bool has_value = false;
+        int64_t value = 0;
+        uint32_t mask = 0;     // the octets given by ${a}-style fields
+        uint32_t octets = 0;
+    };
+
+    static Template parse_template(const char *src, const char *end);
+    static char *render(const Template& t, uint32_t value, char *dst, const char *end) noexcept;
+    static bool match_label(const Template& t, const char *label, size_t n, Constraints& c) noexcept;
+    bool matches(int first_label, const char *const *labels, const uint8_t *sizes, int n, uint32_t& value) const noexcept;
+    bool in_range(uint32_t value) const noexcept;
+
+    uint32_t m_first = 0;
+    uint32_t m_last = 0;
+    uint32_t m_step = 1;
+    std::vector<Template> m_owner;  // the labels above the origin, leftmost first
+    Template m_rdata;
+    Name m_origin;
+    RRType m_rrtype;
+    RRClass m_rrclass;
+    uint32_t m_ttl = 0;
+    std::string m_repr;
+};
+
+} // namespace dns
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "decode-error.h"
+#include "nonstd.h"
 #include "opcode.h"
 #include "question.h"
 #include "rcode.h"
@@ -21,13 +23,27 @@ public:
     static Message beginQuery(Question question) noexcept;
     static Message beginResponseTo(const Message& query) noexcept;
 
+    /**
+     *  Turn this object into an empty response to the given query, keeping
+     *  the storage of its sections for reuse. In steady state, a Message
+     *  that is reused this way for every query never allocates.
+     */
+    Message& resetAsResponseTo(const Message& query) noexcept;
+    void clear() noexcept;
+
     bool is_query() const noexcept { return !m_qr; }
     bool is_response() const noexcept { return m_qr; }
     Opcode opcode() const noexcept { return m_opcode; }
-    const std::vector<Question>& questions() const noexcept { return m_question; }
-    const std::vector<RR>& answers() const noexcept { return m_answer; }
-    const std::vector<RR>& authority() const noexcept { return m_authority; }
-    const std::vector<RR>& additional() const noexcept { return m_additional; }
+    RCode rcode() const noexcept { return m_rcode; }
+    uint16_t id() const noexcept { return m_id; }
+    bool is_authoritative() const noexcept { return m_aa; }
+    bool is_truncated() const noexcept { return m_tc; }
+    bool is_recursion_desired() const noexcept { return m_rd; }
+    const nonstd::recycling_vector<Question>& questions() const noexcept { return m_question; }
+    const nonstd::recycling_vector<RR>& answers() const noexcept { return m_answer; }
+    const nonstd::recycling_vector<RR>& authority() const noexcept { return m_authority; }
+    const nonstd::recycling_vector<RR>& additional() const noexcept { return m_additional; }
+    const SymbolTable& symbol_table() const noexcept { return m_symbol_table; }
 
     Message& setID(uint16_t id) noexcept { m_id = id; return *this; }
     Message& setOpcode(Opcode opcode) noexcept { m_opcode = opcode; return *this; }
@@ -36,10 +52,10 @@ public:
     Message& setAA(bool aa) noexcept { m_aa = aa; return *this; }
     Message& setRD(bool rd) noexcept { m_rd = rd; return *this; }
     Message& setRA(bool ra) noexcept { m_ra = ra; return *this; }
-    Message& add_question(Question q) { m_question.emplace_back(std::move(q)); return *this; }
-    Message& add_answer(RR rr) { m_answer.emplace_back(std::move(rr)); return *this; }
-    Message& add_authority(RR rr) { m_authority.emplace_back(std::move(rr)); return *this; }
-    Message& add_additional(RR rr) { m_additional.emplace_back(std::move(rr)); return *this; }
+    Message& add_question(const Question& q) { m_question.push_back(q); return *this; }
+    Message& add_answer(const RR& rr) { m_answer.push_back(rr); return *this; }
+    Message& add_authority(const RR& rr) { m_authority.push_back(rr); return *this; }
+    Message& add_additional(const RR& rr) { m_additional.push_back(rr); return *this; }
 
     /**
      *  Function that decodes a DNS message.
@@ -49,6 +65,11 @@ public:
      */
     const char *decode(const char *packet_start, const char *end);
 
+    /**
+     *  Like @ref decode, but on failure says why.
+     */
+    DecodeResult try_decode(const char *packet_start, const char *end);
+
     /**
      *  Function that encodes a DNS message.
      *  @param dst The buffer into which to encode the message.
@@ -70,10 +91,10 @@ private:
     RCode m_rcode = RCode::NOERROR;
 
     SymbolTable m_symbol_table;
-    std::vector<Question> m_question;
-    std::vector<RR> m_answer;
-    std::vector<RR> m_authority;
-    std::vector<RR> m_additional;
+    nonstd::recycling_vector<Question> m_question;
+    nonstd::recycling_vector<RR> m_answer;
+    nonstd::recycling_vector<RR> m_authority;
+    nonstd::recycling_vector<RR> m_additional;
 };
 
 } // namespace dns
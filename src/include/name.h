@@ -1,9 +1,11 @@
 #pragma once
 
-#include "symboltable.h"
+#include "decode-error.h"
 
+#include <inttypes.h>
+#include <iterator>
+#include <stddef.h>
 #include <string>
-#include <vector>
 
 namespace dns {
 
@@ -28,6 +30,7 @@ public:
     size_t size() const noexcept { return m_str.size(); }
     bool empty() const noexcept { return m_str.empty(); }
     void clear() noexcept { m_str.clear(); }
+    void assign(const char *p, size_t n) { m_str.assign(p, n); }
     void operator+=(char c) { m_str += c; }
 
     std::string repr() const;
@@ -39,25 +42,156 @@ private:
     std::string m_str;
 };
 
+/**
+ *  One label of a @ref Name, pointing into the name's storage.
+ */
+class LabelView {
+public:
+    LabelView(const char *data, size_t size) noexcept : m_data(data), m_size(size) {}
+
+    const char *data() const noexcept { return m_data; }
+    size_t size() const noexcept { return m_size; }
+    bool empty() const noexcept { return m_size == 0; }
+    bool is_asterisk() const noexcept { return m_size == 1 && m_data[0] == '*'; }
+
+    std::string repr() const;
+
+private:
+    const char *m_data;
+    size_t m_size;
+};
+
+/**
+ *  The labels of a @ref Name, from the leftmost to the root's empty label.
+ */
+class LabelList {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = LabelView;
+        using difference_type = ptrdiff_t;
+        using pointer = void;
+        using reference = LabelView;
+
+        iterator() = default;
+        iterator(const char *wire, const uint8_t *offset) noexcept : m_wire(wire), m_offset(offset) {}
+
+        LabelView operator*() const noexcept { return LabelView(m_wire + *m_offset + 1, uint8_t(m_wire[*m_offset])); }
+        LabelView operator[](ptrdiff_t i) const noexcept { return *(*this + i); }
+        iterator& operator++() noexcept { ++m_offset; return *this; }
+        iterator& operator--() noexcept { --m_offset; return *this; }
+        iterator operator++(int) noexcept { iterator it = *this; ++m_offset; return it; }
+        iterator operator--(int) noexcept { iterator it = *this; --m_offset; return it; }
+        iterator& operator+=(ptrdiff_t n) noexcept { m_offset += n; return *this; }
+        iterator& operator-=(ptrdiff_t n) noexcept { m_offset -= n; return *this; }
+        iterator operator+(ptrdiff_t n) const noexcept { return iterator(m_wire, m_offset + n); }
+        iterator operator-(ptrdiff_t n) const noexcept { return iterator(m_wire, m_offset - n); }
+        ptrdiff_t operator-(const iterator& rhs) const noexcept { return m_offset - rhs.m_offset; }
+        bool operator==(const iterator& rhs) const noexcept { return m_offset == rhs.m_offset; }
+        bool operator!=(const iterator& rhs) const noexcept { return m_offset != rhs.m_offset; }
+        bool operator<(const iterator& rhs) const noexcept { return m_offset < rhs.m_offset; }
+
+    private:
+        const char *m_wire = nullptr;
+        const uint8_t *m_offset = nullptr;
+    };
+
+    LabelList(const char *wire, const uint8_t *offsets, size_t count) noexcept :
+        m_wire(wire), m_offsets(offsets), m_count(count) {}
+
+    size_t size() const noexcept { return m_count; }
+    bool empty() const noexcept { return m_count == 0; }
+    LabelView operator[](size_t i) const noexcept { return begin()[i]; }
+    LabelView front() const noexcept { return begin()[0]; }
+    LabelView back() const noexcept { return begin()[m_count - 1]; }
+    iterator begin() const noexcept { return iterator(m_wire, m_offsets); }
+    iterator end() const noexcept { return iterator(m_wire, m_offsets + m_count); }
+
+private:
+    const char *m_wire;
+    const uint8_t *m_offsets;
+    size_t m_count;
+};
+
 /**
  *  Class that represents a DNS domain name (a possibly empty sequence of labels).
+ *
+ *  The name is kept in wire format, uncompressed, along with the offset
+ *  of each label in it. Together they take (labels + length) bytes, which
+ *  for most names fits in the object itself; a longer name goes on the
+ *  heap, in a buffer big enough for any name, so that decoding into a
+ *  reused Name never needs to reallocate. A name that will live as long
+ *  as the program, such as a zone's, can instead be interned: its storage
+ *  is then shared with every other interned copy of the same name, and
+ *  copying it doesn't allocate.
  */
 class Name {
 public:
-    Name() = default;
+    Name() noexcept : m_size(0), m_count(0), m_storage(INLINE) {}
     explicit Name(const char *repr);
+    Name(const Name& rhs);
+    Name(Name&& rhs) noexcept;
+    Name& operator=(const Name& rhs);
+    Name& operator=(Name&& rhs) noexcept;
+    ~Name();
+
+    bool operator==(const Name& rhs) const noexcept;
+    bool operator!=(const Name& rhs) const noexcept { return !(*this == rhs); }
+    LabelList labels() const noexcept { return LabelList(wire_data(), offsets(), m_count); }
+
+    /**
+     *  The name in wire format, uncompressed, including the root label.
+     */
+    const char *wire_data() const noexcept { return storage() + m_count; }
+    size_t wire_size() const noexcept { return m_size; }
 
-    bool operator==(const Name& rhs) const noexcept { return m_labels == rhs.m_labels; }
-    bool operator!=(const Name& rhs) const noexcept { return m_labels != rhs.m_labels; }
-    const std::vector<Label>& labels() const noexcept { return m_labels; }
+    /**
+     *  Move the name's storage into the global intern table, which is
+     *  never freed, sharing it with any other interned copy of the name.
+     */
+    void intern();
+    bool is_interned() const noexcept { return m_storage == INTERNED; }
+
+    /**
+     *  The memory the name takes outside the object itself, not counting
+     *  the intern table's.
+     */
+    size_t heap_bytes() const noexcept { return (m_storage == HEAP) ? heap_capacity : 0; }
 
     char *encode(char *dst, const char *end) const noexcept;
     const char *decode(const SymbolTable& syms, const char *src, const char *end);
+    DecodeResult try_decode(const SymbolTable& syms, const char *src, const char *end);
 
     const char *decode_repr(const char *src, const char *end);
     std::string repr() const;
+
+    /**
+     *  Write what repr() returns, without allocating.
+     *  @return The end of what was written, or nullptr if it didn't fit.
+     */
+    char *repr(char *dst, const char *end) const noexcept;
+
+    // The most repr() can write: every octet but the root's escaped, and quotes.
+    static const size_t max_repr_size = 2 * 255 + 2;
+
 private:
-    std::vector<Label> m_labels;
+    enum Storage : uint8_t { INLINE, HEAP, INTERNED };
+
+    // A name has at most 128 labels (counting the root) and 255 octets.
+    static const size_t inline_capacity = 61;
+    static const size_t heap_capacity = 128 + 255;
+
+    const char *storage() const noexcept;
+    const uint8_t *offsets() const noexcept { return reinterpret_cast<const uint8_t *>(storage()); }
+    void set_pointer(const char *p) noexcept;
+    void release() noexcept;
+    void assign(const uint8_t *offsets, size_t count, const char *wire, size_t size);
+
+    uint8_t m_size;     // of the wire format
+    uint8_t m_count;    // of the labels, including the root's
+    Storage m_storage;
+    char m_inline[inline_capacity];  // the label offsets, then the wire format; or a pointer to them
 };
 
 } // namespace dns
@@ -2,10 +2,13 @@
 
 #include <chrono>
 #include <iterator>
+#include <stddef.h>
 #include <utility>
+#include <vector>
 
 namespace nonstd {
 
+using std::chrono::microseconds;
 using std::chrono::milliseconds;
 using std::chrono::seconds;
 
@@ -23,9 +26,9 @@ private:
 };
 
 template<class Container>
-drop_container<Container&&> drop(int i, Container&& container) noexcept
+drop_container<Container> drop(int i, Container&& container) noexcept
 {
-    return drop_container<Container&&>(i, std::forward<Container>(container));
+    return drop_container<Container>(i, std::forward<Container>(container));
 }
 
 template<class Container>
@@ -41,9 +44,97 @@ private:
 };
 
 template<class Container>
-reversed_container<Container&&> reversed(Container&& container) noexcept
+reversed_container<Container> reversed(Container&& container) noexcept
 {
-    return reversed_container<Container&&>(std::forward<Container>(container));
+    return reversed_container<Container>(std::forward<Container>(container));
 }
 
+/**
+ *  A vector whose clear() keeps its elements alive, heap buffers and all,
+ *  so that refilling it by assignment does not allocate in steady state.
+ */
+template<class T>
+class recycling_vector {
+public:
+    using iterator = typename std::vector<T>::const_iterator;
+
+    iterator begin() const noexcept { return m_v.begin(); }
+    iterator end() const noexcept { return m_v.begin() + m_size; }
+    size_t size() const noexcept { return m_size; }
+    bool empty() const noexcept { return m_size == 0; }
+    const T& operator[](size_t i) const noexcept { return m_v[i]; }
+    const T& front() const noexcept { return m_v[0]; }
+    const T& back() const noexcept { return m_v[m_size - 1]; }
+    T& back() noexcept { return m_v[m_size - 1]; }
+
+    // Returns a recycled element in an unspecified state, for the caller to overwrite.
+    T& emplace_back() {
+        if (m_size == m_v.size()) m_v.emplace_back();
+        return m_v[m_size++];
+    }
+    void push_back(const T& t) {
+        if (m_size == m_v.size()) m_v.push_back(t); else m_v[m_size] = t;
+        m_size += 1;
+    }
+    void clear() noexcept { m_size = 0; }
+
+private:
+    std::vector<T> m_v;
+    size_t m_size = 0;
+};
+
+template<class E>
+struct unexpected {
+    explicit unexpected(E e) : value(e) {}
+    E value;
+};
+
+/**
+ *  A pared-down std::expected: either a value or the reason there isn't
+ *  one. Both T and E must be cheap to default-construct and copy.
+ */
+template<class T, class E>
+class expected {
+public:
+    expected(T value) : m_value(value), m_has_value(true) {}
+    expected(unexpected<E> u) : m_error(u.value), m_has_value(false) {}
+
+    bool has_value() const noexcept { return m_has_value; }
+    explicit operator bool() const noexcept { return m_has_value; }
+    const T& value() const noexcept { return m_value; }
+    const T& operator*() const noexcept { return m_value; }
+    const E& error() const noexcept { return m_error; }
+
+private:
+    T m_value = T();
+    E m_error = E();
+    bool m_has_value;
+};
+
+template<int... Is>
+struct int_sequence {};
+
+template<class A, class B> struct concat_int_sequences;
+template<int... As, int... Bs>
+struct concat_int_sequences<int_sequence<As...>, int_sequence<Bs...>> {
+    using type = int_sequence<As..., int(sizeof...(As)) + Bs...>;
+};
+
+/**
+ *  int_sequence<0, 1, ..., N-1>, as C++14's std::make_integer_sequence,
+ *  built in halves so that the recursion is only log(N) deep.
+ */
+template<int N>
+struct make_int_sequence_t {
+    using type = typename concat_int_sequences<
+        typename make_int_sequence_t<N / 2>::type,
+        typename make_int_sequence_t<N - N / 2>::type
+    >::type;
+};
+template<> struct make_int_sequence_t<0> { using type = int_sequence<>; };
+template<> struct make_int_sequence_t<1> { using type = int_sequence<0>; };
+
+template<int N>
+using make_int_sequence = typename make_int_sequence_t<N>::type;
+
 } // namespace nonstd
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <utility>
+#include <vector>
+
+namespace dns {
+
+/**
+ *  A minimal perfect hash function over a fixed set of 64-bit keys, built
+ *  as in BBHash (Limasset et al., "Fast and scalable minimal perfect
+ *  hashing for massive key sets", 2017). The n keys it was built from map
+ *  to distinct indexes in [0, n); any other key maps to an arbitrary index
+ *  or to npos, so the caller must check what it finds there.
+ *
+ *  Each level is a bitmap; a key that lands alone on its bit at some level
+ *  is placed there, and its index is the number of bits set before it. The
+ *  keys that collide go on to the next level. The few left after the last
+ *  level are kept in a sorted list.
+ */
+class PerfectHash {
+public:
+    static const size_t npos = size_t(-1);
+
+    explicit PerfectHash() = default;
+
+    /**
+     *  @param keys The keys, which must be distinct.
+     *  @param gamma Bits per remaining key at each level. Larger values
+     *         build and look up faster, but take more memory; at 2.0 the
+     *         whole function takes about 3.7 bits per key.
+     */
+    explicit PerfectHash(const std::vector<uint64_t>& keys, double gamma = 2.0);
+
+    size_t size() const noexcept { return m_size; }
+    size_t memory_bytes() const noexcept;
+
+    size_t lookup(uint64_t key) const noexcept;
+
+private:
+    struct Level {
+        size_t first_bit;
+        size_t bits;
+    };
+
+    size_t rank(size_t bit) const noexcept;
+
+    std::vector<uint64_t> m_words;   // the levels' bitmaps, one after another
+    std::vector<uint32_t> m_ranks;   // the number of bits set before each 8-word block
+    std::vector<Level> m_levels;
+    std::vector<std::pair<uint64_t, size_t>> m_leftovers;  // sorted by key
+    size_t m_size = 0;
+};
+
+} // namespace dns
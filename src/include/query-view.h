@@ -0,0 +1,117 @@
+#pragma once
+
+#include "decode-error.h"
+#include "opcode.h"
+#include "question.h"
+#include "rrtype.h"
+
+#include <inttypes.h>
+#include <stddef.h>
+
+namespace dns {
+
+/**
+ *  Class that parses the parts of a query the server cares about (the
+ *  header, a single question, and an optional OPT record) without copying
+ *  anything out of the packet. The view points into the packet buffer,
+ *  which must outlive it.
+ */
+class QueryView {
+public:
+    explicit QueryView() = default;
+
+    /**
+     *  Parse the header, and then, only if its counts describe a query we
+     *  could answer, the question and OPT record. Anything else is left
+     *  for the caller to reject on the basis of the header alone.
+     *  @return A pointer one past the last byte parsed, or the reason the
+     *          packet is malformed.
+     */
+    DecodeResult parse(const char *packet, const char *end) noexcept;
+
+    uint16_t id() const noexcept { return m_id; }
+    bool is_response() const noexcept { return m_qr; }
+    Opcode opcode() const noexcept { return m_opcode; }
+    bool is_recursion_desired() const noexcept { return m_rd; }
+    int question_count() const noexcept { return m_qdcount; }
+    int answer_count() const noexcept { return m_ancount; }
+    int authority_count() const noexcept { return m_nscount; }
+    int additional_count() const noexcept { return m_arcount; }
+
+    /**
+     *  True if the question (and OPT record, if any) has been parsed;
+     *  the accessors below are meaningful only if so.
+     */
+    bool has_question() const noexcept { return m_qname != nullptr; }
+    const char *question_begin() const noexcept { return m_qname; }
+    const char *question_end() const noexcept { return m_question_end; }
+    RRType qtype() const noexcept { return RRType(m_qtype); }
+    RRClass qclass() const noexcept { return RRClass(m_qclass); }
+
+    /**
+     *  The qname's labels, not counting the root, in wire order:
+     *  label 0 is the leftmost.
+     */
+    int label_count() const noexcept { return m_label_count; }
+    size_t label_offset(int i) const noexcept { return m_label_offsets[i]; }
+    const char *label_data(int i) const noexcept { return m_qname + m_label_offsets[i] + 1; }
+    size_t label_size(int i) const noexcept { return static_cast<uint8_t>(m_qname[m_label_offsets[i]]); }
+
+    /**
+     *  The qname's labels folded to lowercase, and their hashes as
+     *  computed by fold_label(); both are computed once, during @ref parse.
+     */
+    const char *folded_label_data(int i) const noexcept { return m_folded + m_label_offsets[i] + 1; }
+    uint32_t label_hash(int i) const noexcept { return m_label_hashes[i]; }
+
+    /**
+     *  The hash (as by hash_name_step()) of the case-folded name made of
+     *  labels i through the last; suffix_hash(label_count()) is the root's.
+     */
+    uint32_t suffix_hash(int i) const noexcept { return m_suffix_hashes[i]; }
+    uint32_t qname_hash() const noexcept { return m_suffix_hashes[0]; }
+
+    /**
+     *  The folded name made of labels i through the last, in wire format
+     *  but without the terminating root label.
+     */
+    const char *folded_suffix_data(int i) const noexcept { return m_folded + m_label_offsets[i]; }
+    size_t folded_suffix_size(int i) const noexcept { return m_label_offsets[m_label_count] - m_label_offsets[i]; }
+
+    bool has_opt() const noexcept { return m_has_opt; }
+    uint16_t udp_payload_size() const noexcept { return m_udp_payload_size; }
+    int edns_version() const noexcept { return m_edns_version; }
+    bool is_dnssec_ok() const noexcept { return m_do; }
+
+    /**
+     *  Make an owning copy of the question, for the (slow) paths that need one.
+     */
+    Question question() const;
+
+private:
+    uint16_t m_id = 0;
+    bool m_qr = false;
+    Opcode m_opcode = Opcode::QUERY;
+    bool m_rd = false;
+    uint16_t m_qdcount = 0;
+    uint16_t m_ancount = 0;
+    uint16_t m_nscount = 0;
+    uint16_t m_arcount = 0;
+
+    const char *m_qname = nullptr;
+    const char *m_question_end = nullptr;
+    uint16_t m_qtype = 0;
+    uint16_t m_qclass = 0;
+    int m_label_count = 0;
+    uint8_t m_label_offsets[129];
+    uint32_t m_label_hashes[128];
+    uint32_t m_suffix_hashes[129];
+    char m_folded[255];
+
+    bool m_has_opt = false;
+    uint16_t m_udp_payload_size = 0;
+    int m_edns_version = 0;
+    bool m_do = false;
+};
+
+} // namespace dns
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "decode-error.h"
 #include "name.h"
 #include "rrtype.h"
 #include "symboltable.h"
@@ -20,6 +21,7 @@ public:
     RRClass qclass() const noexcept { return RRClass(m_qclass); }
 
     const char *decode(const SymbolTable& syms, const char *src, const char *end);
+    DecodeResult try_decode(const SymbolTable& syms, const char *src, const char *end);
     char *encode(char *dst, const char *end) const noexcept;
 
     std::string repr() const;
@@ -0,0 +1,162 @@
+#pragma once
+
+#include "name.h"
+#include "opcode.h"
+#include "query-view.h"
+#include "question.h"
+#include "rcode.h"
+#include "rr.h"
+#include "rrset.h"
+#include "rrtype.h"
+
+#include <inttypes.h>
+#include <stddef.h>
+
+namespace dns {
+
+/**
+ *  ResponseWriter streams a DNS response directly into a caller-provided
+ *  buffer, without building a @ref Message or @ref Response first.
+ *  Records must be added in section order (answer, authority, additional).
+ *  Owner names are compressed against the names already written.
+ *  If a record doesn't fit, the writer rolls back to the end of the
+ *  previous record (or, when adding a whole RRset, to the end of the
+ *  previous RRset); running out of room in the answer or authority
+ *  section sets the TC bit, whereas additional records are simply
+ *  dropped (RFC 2181, section 9).
+ */
+class ResponseWriter {
+public:
+    /**
+     *  Begin a response to the given query.
+     *  @param dst The buffer into which to write the response.
+     *  @param end A pointer one past the end of the buffer.
+     */
+    explicit ResponseWriter(const QueryView& query, char *dst, const char *end) noexcept;
+
+    RCode rcode() const noexcept { return m_rcode; }
+    bool is_truncated() const noexcept { return m_tc; }
+    int answer_count() const noexcept { return m_count[0]; }
+    int authority_count() const noexcept { return m_count[1]; }
+    int additional_count() const noexcept { return m_count[2]; }
+
+    ResponseWriter& setRCode(RCode rcode) noexcept { m_rcode = rcode; return *this; }
+    ResponseWriter& setAA(bool aa) noexcept { m_aa = aa; return *this; }
+    ResponseWriter& setRA(bool ra) noexcept { m_ra = ra; return *this; }
+
+    /**
+     *  Append an OPT record (RFC 6891) to the additional section when the
+     *  response is finished. Room for it is set aside now, so this must be
+     *  called before any records are added.
+     *  @param udp_payload_size The largest UDP payload we are willing to receive.
+     *  @param extended_rcode The upper eight bits of a 12-bit RCODE, e.g. 1 for BADVERS.
+     */
+    ResponseWriter& set_opt(uint16_t udp_payload_size, uint8_t extended_rcode = 0) noexcept;
+
+    /**
+     *  Copy the question section verbatim from the query's wire format.
+     *  @param src The start of the question in the query packet (offset 12).
+     *  @param end A pointer one past the end of the query packet.
+     *  @return False if the question is malformed, uses compression, or
+     *          doesn't fit; in that case nothing has been written.
+     */
+    bool copy_question(const char *src, const char *end) noexcept;
+
+    /**
+     *  Encode the question, unless @ref copy_question has already written it.
+     */
+    ResponseWriter& set_question(const Question& q) noexcept;
+
+    bool add_answer(const RR& rr, const Name *owner = nullptr) noexcept { return add(0, rr, owner, false); }
+    bool add_authority(const RR& rr) noexcept { return add(1, rr, nullptr, false); }
+    bool add_additional(const RR& rr) noexcept { return add(2, rr, nullptr, false); }
+
+    /**
+     *  Add an answer whose owner is the qname, e.g. one synthesized from
+     *  a wildcard. Its owner is written as a pointer to the question.
+     */
+    bool add_answer_owned_by_qname(const RR& rr) noexcept { return add(0, rr, nullptr, true); }
+
+    /**
+     *  Add an answer made up for this response, rather than taken from
+     *  the zone's records (e.g. one generated from a template).
+     *  @param owner Its owner name, or nullptr for the qname.
+     */
+    bool add_answer(const Name *owner, RRType rrtype, RRClass rrclass, uint32_t ttl,
+                    const char *rdata, size_t rdlength) noexcept;
+    bool add_authority(const Name *owner, RRType rrtype, RRClass rrclass, uint32_t ttl,
+                       const char *rdata, size_t rdlength) noexcept;
+    bool add_additional(const Name *owner, RRType rrtype, RRClass rrclass, uint32_t ttl,
+                        const char *rdata, size_t rdlength) noexcept;
+
+    /**
+     *  Where the response has got to, so that a caller adding an RRset
+     *  one record at a time can drop all of it if some record doesn't fit,
+     *  as adding an @ref RRset does. Rolling back leaves the TC bit alone.
+     */
+    struct Checkpoint {
+        char *dst;
+        int count[3];
+        int num_names;
+    };
+    Checkpoint checkpoint() const noexcept { return Checkpoint{m_dst, {m_count[0], m_count[1], m_count[2]}, m_num_names}; }
+    void rollback(const Checkpoint& c) noexcept;
+
+    /**
+     *  Add all the records of an RRset, or none of them.
+     */
+    bool add_answer(const RRset& rrset, const Name *owner = nullptr) noexcept { return add(0, rrset, owner, false); }
+    bool add_answer_owned_by_qname(const RRset& rrset) noexcept { return add(0, rrset, nullptr, true); }
+    bool add_authority(const RRset& rrset) noexcept { return add(1, rrset, nullptr, false); }
+    bool add_additional(const RRset& rrset) noexcept { return add(2, rrset, nullptr, false); }
+
+    /**
+     *  Add an authority record that was encoded ahead of time, except for
+     *  its owner name: the first two bytes of `wire` are a placeholder,
+     *  overwritten with a compression pointer to `owner_offset` (which
+     *  must be the offset of a name already in the packet).
+     */
+    bool add_authority_preencoded(const std::string& wire, uint16_t owner_offset) noexcept;
+
+    /**
+     *  Fill in the header.
+     *  @return A pointer one past the end of the response, or nullptr if
+     *          the buffer was too small even for the header.
+     */
+    char *finish() noexcept;
+
+private:
+    bool add(int section, const RR& rr, const Name *owner, bool owner_is_qname) noexcept;
+    bool add(int section, const Name *owner, bool owner_is_qname, RRType rrtype, RRClass rrclass,
+             uint32_t ttl, const char *rdata, size_t rdlength) noexcept;
+    bool add(int section, const RRset& rrset, const Name *owner, bool owner_is_qname) noexcept;
+    char *write_name(char *dst, const Name& name) noexcept;
+    bool matches(const Name& name, size_t i, int offset) const noexcept;
+    void remember(const char *label) noexcept;
+
+    char *m_start;
+    char *m_dst;
+    const char *m_end;  // less the room set aside for the OPT record
+    const char *m_real_end;
+
+    uint16_t m_id;
+    Opcode m_opcode;
+    bool m_aa = false;
+    bool m_tc = false;
+    bool m_rd;
+    bool m_ra = false;
+    RCode m_rcode = RCode::NOERROR;
+    int m_qdcount = 0;
+    int m_count[3] = {0, 0, 0};
+    int m_section = 0;
+    bool m_opt = false;
+    uint16_t m_udp_payload_size = 0;
+    uint8_t m_extended_rcode = 0;
+
+    // Offsets of names (and name suffixes) already in the packet,
+    // available as targets for compression pointers.
+    uint16_t m_names[64];
+    int m_num_names = 0;
+};
+
+} // namespace dns
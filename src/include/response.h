@@ -0,0 +1,86 @@
+#pragma once
+
+#include "message.h"
+#include "name.h"
+#include "opcode.h"
+#include "question.h"
+#include "rcode.h"
+#include "rr.h"
+#include "rrset.h"
+
+#include <inttypes.h>
+#include <list>
+#include <utility>
+#include <vector>
+
+namespace dns {
+
+/**
+ *  Class that represents a DNS response under construction. Unlike
+ *  @ref Message, it does not own its records: it holds references to
+ *  the question in the query and to RRs in the (immutable) zone data,
+ *  and @ref encode writes them straight from there into the output buffer.
+ *  The referenced objects must outlive the Response. The exception is
+ *  records made up for this response alone, which it keeps until reset.
+ */
+class Response {
+public:
+    struct RRRef {
+        const RR *rr;
+        const Name *owner;  // if non-null, overrides rr->name(), e.g. for wildcard synthesis
+
+        const Name& name() const noexcept { return (owner != nullptr) ? *owner : rr->name(); }
+    };
+
+    explicit Response() = default;
+
+    /**
+     *  Turn this object into an empty response to the given query.
+     *  The storage of its sections is kept for reuse.
+     */
+    Response& resetAsResponseTo(const Message& query) noexcept;
+
+    RCode rcode() const noexcept { return m_rcode; }
+    const Question *question() const noexcept { return m_question; }
+    const std::vector<RRRef>& answers() const noexcept { return m_answer; }
+    const std::vector<RRRef>& authority() const noexcept { return m_authority; }
+    const std::vector<RRRef>& additional() const noexcept { return m_additional; }
+
+    Response& setRCode(RCode rcode) noexcept { m_rcode = rcode; return *this; }
+    Response& setAA(bool aa) noexcept { m_aa = aa; return *this; }
+    Response& setRA(bool ra) noexcept { m_ra = ra; return *this; }
+    Response& set_question(const Question& q) noexcept { m_question = &q; return *this; }
+    Response& add_answer(const RR& rr, const Name *owner = nullptr) { m_answer.push_back(RRRef{&rr, owner}); return *this; }
+    Response& add_authority(const RR& rr) { m_authority.push_back(RRRef{&rr, nullptr}); return *this; }
+    Response& add_additional(const RR& rr) { m_additional.push_back(RRRef{&rr, nullptr}); return *this; }
+    Response& add_answer(const RRset& rrset, const Name *owner = nullptr);
+    Response& add_synthesized_answer(RR rr) { m_synthesized.push_back(std::move(rr)); return add_answer(m_synthesized.back()); }
+    Response& add_synthesized_authority(RR rr) { m_synthesized.push_back(std::move(rr)); return add_authority(m_synthesized.back()); }
+    Response& add_synthesized_additional(RR rr) { m_synthesized.push_back(std::move(rr)); return add_additional(m_synthesized.back()); }
+    Response& add_authority(const RRset& rrset);
+    Response& add_additional(const RRset& rrset);
+
+    /**
+     *  Function that encodes the response.
+     *  @param dst The buffer into which to encode the response.
+     *  @param end A pointer one past the end of the buffer.
+     *  @return A pointer one past the end of the encoded representation.
+     */
+    char *encode(char *dst, const char *end) const noexcept;
+
+private:
+    uint16_t m_id = 0;
+    Opcode m_opcode = Opcode::QUERY;
+    bool m_aa = false;
+    bool m_rd = false;
+    bool m_ra = false;
+    RCode m_rcode = RCode::NOERROR;
+
+    const Question *m_question = nullptr;
+    std::vector<RRRef> m_answer;
+    std::vector<RRRef> m_authority;
+    std::vector<RRRef> m_additional;
+    std::list<RR> m_synthesized;
+};
+
+} // namespace dns
@@ -0,0 +1,169 @@
+#pragma once
+
+#include "exception.h"
+#include "name.h"
+#include "rr.h"
+#include "rrtype.h"
+
+#include <algorithm>
+#include <inttypes.h>
+#include <stddef.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace dns {
+
+/**
+ *  The PTR records of the in-addr.arpa tree, kept in arrays sorted by
+ *  IPv4 address rather than as four levels of domain tree nodes each.
+ *  Only names of exactly the form d.c.b.a.in-addr.arpa. (with decimal
+ *  octets, as written by convention) go here; anything else, or any name
+ *  that also owns other records or has names below it, stays in the tree.
+ *
+ *  Each record is its address, in one sorted array, and its class, TTL
+ *  and RDATA (the PTR target, in wire format) in another alongside it;
+ *  the owner names aren't kept, since @ref make_name can rebuild them.
+ *
+ *  The names between in-addr.arpa. and the addresses (a.in-addr.arpa.
+ *  and so on) exist implicitly whenever some address begins with them.
+ */
+class ReverseIndex {
+public:
+    explicit ReverseIndex() = default;
+
+    /**
+     *  Parse a label as a decimal octet: "0" to "255", without leading zeros.
+     */
+    static bool parse_octet(const char *data, size_t n, uint8_t& octet) noexcept;
+
+    /**
+     *  If the name is d.c.b.a.in-addr.arpa. (in any case), set `address`
+     *  to a.b.c.d and return true.
+     */
+    static bool parse_name(const Name& name, uint32_t& address) noexcept;
+
+    /**
+     *  The name d.c.b.a.in-addr.arpa. of the address a.b.c.d.
+     */
+    static Name make_name(uint32_t address);
+
+    bool empty() const noexcept { return m_addresses.empty() && m_pending.empty(); }
+
+    /**
+     *  The number of records, which are numbered from 0 in address order.
+     */
+    size_t size() const noexcept { return m_addresses.size(); }
+
+    uint32_t address(size_t i) const noexcept { return m_addresses[i]; }
+    RRClass rrclass(size_t i) const noexcept { return RRClass(m_records[i].rrclass); }
+    uint32_t ttl(size_t i) const noexcept { return m_records[i].ttl; }
+    const char *rdata(size_t i) const noexcept { return m_rdata.data() + m_records[i].rdata_offset; }
+    size_t rdlength(size_t i) const noexcept { return m_records[i].rdlength; }
+
+    /**
+     *  Add a record while the zone is being loaded. Nothing can be found
+     *  until @ref finish is called.
+     */
+    void add(uint32_t address, RR rr) { m_pending.emplace_back(address, std::move(rr)); }
+
+    /**
+     *  Sort and index the records added so far, in file order within each
+     *  address. The records of any address for which `in_tree(address)`
+     *  is true are returned instead, for the caller to put in the tree.
+     *  @throws dns::Exception if any record's RDATA is too long to be a PTR target.
+     */
+    template<class F>
+    std::vector<RR> finish(const F& in_tree);
+
+    /**
+     *  Find the records owned by the name of `address`.
+     *  @return False if it owns none; otherwise true, with the records
+     *          numbered [first, last).
+     */
+    bool find(uint32_t address, size_t& first, size_t& last) const noexcept;
+
+    /**
+     *  True if the name made of the first `octets` octets of `prefix`
+     *  (in its low-order bits) exists: that is, if some address begins with them.
+     */
+    bool has_prefix(uint32_t prefix, int octets) const noexcept;
+
+    /**
+     *  Call f(address) for each address that begins with the first
+     *  `octets` octets of `prefix`, once each, in order.
+     */
+    template<class F>
+    void for_each_address(uint32_t prefix, int octets, const F& f) const {
+        uint32_t first = (octets == 0) ? 0 : (prefix << (32 - 8 * octets));
+        auto it = std::lower_bound(m_addresses.begin(), m_addresses.end(), first);
+        for (; it != m_addresses.end() && has_prefix(*it, octets, prefix); ++it) {
+            if (it == m_addresses.begin() || it[-1] != *it) {
+                f(*it);
+            }
+        }
+    }
+
+    /**
+     *  Call f(address, rrclass, ttl, rdata, rdlength) for the records
+     *  numbered [first, last), in order.
+     */
+    template<class F>
+    void for_each(size_t first, size_t last, const F& f) const {
+        for (size_t i = first; i < last; ++i) {
+            f(address(i), rrclass(i), ttl(i), rdata(i), rdlength(i));
+        }
+    }
+
+private:
+    static bool has_prefix(uint32_t address, int octets, uint32_t prefix) noexcept {
+        return octets == 0 || (address >> (32 - 8 * octets)) == prefix;
+    }
+
+    struct Record {
+        uint32_t rdata_offset;  // into m_rdata
+        uint32_t ttl;
+        uint16_t rrclass;
+        uint8_t rdlength;
+    };
+
+    std::vector<std::pair<uint32_t, RR>> m_pending;
+    std::vector<uint32_t> m_addresses;  // sorted, one for each record
+    std::vector<Record> m_records;      // alongside m_addresses
+    std::string m_rdata;                // the records' RDATA, back to back
+};
+
+template<class F>
+std::vector<RR> ReverseIndex::finish(const F& in_tree)
+{
+    std::stable_sort(m_pending.begin(), m_pending.end(), [](const std::pair<uint32_t, RR>& a,
+                                                            const std::pair<uint32_t, RR>& b) {
+        return a.first < b.first;
+    });
+    std::vector<RR> rejected;
+    for (auto&& kv : m_pending) {
+        const RR& rr = kv.second;
+        if (in_tree(kv.first)) {
+            rejected.push_back(std::move(kv.second));
+            continue;
+        }
+        if (rr.rdata().size() > 255) {
+            throw dns::Exception("PTR record's RDATA is too long to be a name");
+        }
+        Record record;
+        record.rdata_offset = uint32_t(m_rdata.size());
+        record.ttl = rr.ttl();
+        record.rrclass = uint16_t(int(rr.rrclass()));
+        record.rdlength = uint8_t(rr.rdata().size());
+        m_addresses.push_back(kv.first);
+        m_records.push_back(record);
+        m_rdata += rr.rdata();
+    }
+    std::vector<std::pair<uint32_t, RR>>().swap(m_pending);
+    m_addresses.shrink_to_fit();
+    m_records.shrink_to_fit();
+    m_rdata.shrink_to_fit();
+    return rejected;
+}
+
+} // namespace dns
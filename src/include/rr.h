@@ -1,6 +1,8 @@
 #pragma once
 
+#include "decode-error.h"
 #include "name.h"
+#include "nonstd.h"
 #include "rrtype.h"
 #include "symboltable.h"
 
@@ -22,22 +24,58 @@ public:
 
     const Name& name() const noexcept { return m_name; }
     RRType rrtype() const noexcept { return RRType(m_rrtype); }
+    RRClass rrclass() const noexcept { return RRClass(m_rrclass); }
+    uint32_t ttl() const noexcept { return m_ttl; }
+    const std::string& rdata() const noexcept { return m_rdata; }
     bool is_SOA_record() const noexcept { return m_rrtype == RRType::SOA; }
     bool is_NS_record() const noexcept { return m_rrtype == RRType::NS; }
 
-    void set_name(Name name) { m_name = std::move(name); }
+    void set_name(const Name& name) { m_name = name; }
 
     /**
      *  Meaningful only for NS and CNAME records. Decode and return
      *  the single domain name encoded in this object's RDATA.
-     *  @return The decoded NSDNAME or CNAME domain name.
+     *  @return The decoded NSDNAME or CNAME domain name, or BAD_RDATA
+     *          if the RDATA is malformed.
      */
-    Name rhs_name(const SymbolTable& syms) const;
+    nonstd::expected<Name, DecodeError> rhs_name(const SymbolTable& syms) const;
+
+    /**
+     *  Meaningful only for NS and MX records. Decode and return the domain
+     *  name whose addresses belong in the additional section (RFC 1035,
+     *  section 3.3): the NSDNAME, or the MX record's EXCHANGE.
+     *  @return The decoded name, or BAD_RDATA if the RDATA is malformed.
+     */
+    nonstd::expected<Name, DecodeError> additional_name(const SymbolTable& syms) const;
+
+    /**
+     *  Meaningful only for SOA records. Decode and return the MINIMUM
+     *  field, which RFC 2308 redefines as the TTL for negative answers.
+     *  @return The decoded MINIMUM field, or BAD_RDATA if the RDATA is malformed.
+     */
+    nonstd::expected<uint32_t, DecodeError> soa_minimum(const SymbolTable& syms) const;
 
     const char *decode(const SymbolTable& syms, const char *src, const char *end);
-    char *encode(char *dst, const char *end) const noexcept;
+    DecodeResult try_decode(const SymbolTable& syms, const char *src, const char *end);
+    char *encode(char *dst, const char *end) const noexcept { return encode(m_name, dst, end); }
+
+    /**
+     *  Encode this RR as if its owner name were `owner` (e.g. when
+     *  synthesizing an answer from a wildcard).
+     */
+    char *encode(const Name& owner, char *dst, const char *end) const noexcept;
 
     std::string repr(const SymbolTable& syms) const;
+
+    /**
+     *  Write what repr() returns for a record with these fields, without
+     *  allocating, into a buffer with room for max_repr_size(rdlength).
+     *  @return The end of what was written.
+     */
+    static char *repr(const SymbolTable& syms, const Name& owner, RRType rrtype, RRClass rrclass, uint32_t ttl,
+                      const char *rdata, size_t rdlength, char *dst) noexcept;
+    static size_t max_repr_size(size_t rdlength) noexcept;
+
     const char *decode_repr(const char *src, const char *end);
 
 private:
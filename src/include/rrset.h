@@ -0,0 +1,128 @@
+#pragma once
+
+#include "rr.h"
+#include "rrtype.h"
+
+#include <algorithm>
+#include <inttypes.h>
+#include <vector>
+
+namespace dns {
+
+/**
+ *  The records of one type at one owner name. The records themselves
+ *  live elsewhere (in the zone data) and must outlive the RRset.
+ */
+class RRset {
+public:
+    explicit RRset(RRType rrtype) : m_rrtype(rrtype) {}
+
+    RRType rrtype() const noexcept { return m_rrtype; }
+    const std::vector<const RR *>& records() const noexcept { return m_records; }
+    const RR& front() const noexcept { return *m_records.front(); }
+
+    /**
+     *  The length of all the records in wire format, without compression:
+     *  an upper bound on the room they take in a response.
+     */
+    size_t wire_length() const noexcept { return m_wire_length; }
+
+    /**
+     *  The RRsets to put in the additional section whenever this one is
+     *  in the response, e.g. the addresses of an NS RRset's name servers.
+     *  They are resolved once, when the zone is loaded.
+     */
+    const std::vector<const RRset *>& additional() const noexcept { return m_additional; }
+
+    void add_additional(const RRset *rrset) {
+        if (std::find(m_additional.begin(), m_additional.end(), rrset) == m_additional.end()) {
+            m_additional.push_back(rrset);
+        }
+    }
+
+    void add(const RR& rr) {
+        size_t length = 10 + rr.rdata().size();
+        for (auto&& label : rr.name().labels()) {
+            length += 1 + label.size();
+        }
+        m_records.push_back(&rr);
+        m_wire_length += length;
+    }
+
+private:
+    RRType m_rrtype;
+    size_t m_wire_length = 0;
+    std::vector<const RR *> m_records;
+    std::vector<const RRset *> m_additional;
+};
+
+/**
+ *  A node's RRsets, sorted by type. For the types below 256 (which is
+ *  all the common ones), a bitmap records which are present, so that
+ *  both "is there an RRset of this type?" and "where is it?" take
+ *  constant time: the RRset's index is the number of bits set below its
+ *  own. Any larger types follow, and are searched linearly.
+ */
+class RRsetIndex {
+public:
+    explicit RRsetIndex() = default;
+
+    bool empty() const noexcept { return m_rrsets.empty(); }
+    const std::vector<RRset>& rrsets() const noexcept { return m_rrsets; }
+    std::vector<RRset>& rrsets() noexcept { return m_rrsets; }
+
+    bool has_type(RRType rrtype) const noexcept {
+        int t = int(rrtype);
+        if (t < 256) {
+            return (m_bitmap[t / 64] >> (t % 64)) & 1;
+        }
+        return find(rrtype) != nullptr;
+    }
+
+    const RRset *find(RRType rrtype) const noexcept {
+        int t = int(rrtype);
+        if (t < 256) {
+            return has_type(rrtype) ? &m_rrsets[rank(t)] : nullptr;
+        }
+        for (size_t i = rank(256); i < m_rrsets.size(); ++i) {
+            if (m_rrsets[i].rrtype() == rrtype) return &m_rrsets[i];
+        }
+        return nullptr;
+    }
+
+    /**
+     *  Add a record to the RRset of its type, creating the RRset if need be.
+     *  Pointers to RRsets are invalidated; pointers to records are not.
+     */
+    void add(const RR& rr) {
+        int t = int(rr.rrtype());
+        auto it = std::lower_bound(m_rrsets.begin(), m_rrsets.end(), t, [](const RRset& s, int t) {
+            return int(s.rrtype()) < t;
+        });
+        if (it == m_rrsets.end() || int(it->rrtype()) != t) {
+            it = m_rrsets.insert(it, RRset(rr.rrtype()));
+            if (t < 256) {
+                m_bitmap[t / 64] |= (uint64_t(1) << (t % 64));
+            }
+        }
+        it->add(rr);
+    }
+
+private:
+    // The number of types present below `t`, for t <= 256.
+    size_t rank(int t) const noexcept {
+        size_t n = 0;
+        for (int i = 0; i < t / 64; ++i) {
+            n += __builtin_popcountll(m_bitmap[i]);
+        }
+        if (t % 64 != 0) {
+            n += __builtin_popcountll(m_bitmap[t / 64] & ((uint64_t(1) << (t % 64)) - 1));
+        }
+        return n;
+    }
+
+    uint64_t m_bitmap[4] = {0, 0, 0, 0};
+    std::vector<RRset> m_rrsets;
+};
+
+} // namespace dns
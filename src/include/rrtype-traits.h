@@ -0,0 +1,97 @@
+#pragma once
+
+#include "name.h"
+#include "symboltable.h"
+
+#include <string>
+#include <string.h>
+
+namespace dns {
+
+/**
+ *  Where an RR type's handler writes RDATA in presentation format: a
+ *  buffer that the caller has made big enough, whatever the RDATA (see
+ *  @ref max_rdata_repr_size), so that nothing is checked or allocated.
+ */
+class ReprWriter {
+public:
+    explicit ReprWriter(char *dst) noexcept : m_dst(dst) {}
+
+    void operator+=(char ch) noexcept { *m_dst++ = ch; }
+    void operator+=(const char *s) noexcept { append(s, strlen(s)); }
+    void append(const char *s, size_t n) noexcept { memcpy(m_dst, s, n); m_dst += n; }
+    void append_name(const Name& name) noexcept { m_dst = name.repr(m_dst, m_dst + Name::max_repr_size); }
+    void append_number(uint32_t n) noexcept;
+    char *end() const noexcept { return m_dst; }
+
+private:
+    char *m_dst;
+};
+
+/**
+ *  The most that may be written for `rdlength` octets of RDATA: each
+ *  octet as a four-character \DDD escape, and up to two names, which
+ *  compression pointers may make longer than the RDATA itself.
+ */
+inline size_t max_rdata_repr_size(size_t rdlength) noexcept
+{
+    return 4 * rdlength + 2 * Name::max_repr_size + 16;
+}
+
+/**
+ *  What the zone-file parser and printer need to know about an RR type.
+ *  Each member is null (or false) for a type we know nothing about, whose
+ *  records are written as TYPEnnn with RFC 3597 RDATA.
+ */
+struct RRTypeHandlers {
+    using DecodeReprFn = std::string (*)(const char *src, const char *end);
+    using EncodeReprFn = bool (*)(const SymbolTable& syms, const char *src, const char *end, ReprWriter& out);
+
+    const char *mnemonic;
+
+    // Whether the names in the RDATA may be compressed (RFC 3597,
+    // section 4); if not, a compression pointer in them is malformed.
+    bool compressible;
+
+    // Turn the RDATA's presentation format into wire format; throws
+    // dns::UnsupportedException if it is malformed.
+    DecodeReprFn decode_rdata_repr;
+
+    // Append the RDATA's presentation format to `out`; returns false
+    // (having appended who knows what) if the RDATA is malformed.
+    EncodeReprFn encode_rdata_repr;
+};
+
+/**
+ *  The RR types that are known by name, but whose records can't be
+ *  written in a zone file (OPT, ANY) start from this.
+ */
+struct RRTypeTraitsBase {
+    static constexpr const char *mnemonic = nullptr;
+    static constexpr bool compressible = false;
+    static constexpr RRTypeHandlers::DecodeReprFn decode_rdata_repr = nullptr;
+    static constexpr RRTypeHandlers::EncodeReprFn encode_rdata_repr = nullptr;
+};
+
+/**
+ *  Specialize this, in rrtype-traits.cpp, to teach the server an RR type
+ *  whose code is below @ref rrtype_table_size; the dispatch table is
+ *  built from the specializations at compile time.
+ */
+template<int Code>
+struct RRTypeTraits : RRTypeTraitsBase {};
+
+static constexpr int rrtype_table_size = 512;
+
+/**
+ *  The handlers for `code`, from a table indexed by type code, or the
+ *  all-null handlers of an unknown type.
+ */
+const RRTypeHandlers& rrtype_handlers(int code) noexcept;
+
+/**
+ *  The code of the type whose mnemonic is [src, end), or -1.
+ */
+int rrtype_from_mnemonic(const char *src, const char *end) noexcept;
+
+} // namespace dns
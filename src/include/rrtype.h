@@ -20,14 +20,19 @@ public:
     constexpr bool operator==(RRClass rhs) const noexcept { return m_value == rhs.m_value; }
     constexpr bool operator!=(RRClass rhs) const noexcept { return m_value != rhs.m_value; }
 
-    std::string repr() const {
+    const char *mnemonic() const noexcept {
         switch (m_value) {
             case IN: return "IN";
             case ANY: return "ANY";
-            default: return "CLASS" + std::to_string(int(m_value));
+            default: return nullptr;
         }
     }
 
+    std::string repr() const {
+        const char *m = mnemonic();
+        return (m != nullptr) ? std::string(m) : "CLASS" + std::to_string(int(m_value));
+    }
+
 private:
     uint16_t m_value = 0;
 };
@@ -42,7 +47,12 @@ public:
         PTR = 12,
         MX = 15,
         TXT = 16,
+        AAAA = 28,
+        SRV = 33,
+        OPT = 41,
+        DS = 43,
         ANY = 255,
+        CAA = 257,
     };
 
     explicit constexpr RRType() noexcept = default;
@@ -53,19 +63,12 @@ public:
     constexpr bool operator==(RRType rhs) const noexcept { return m_value == rhs.m_value; }
     constexpr bool operator!=(RRType rhs) const noexcept { return m_value != rhs.m_value; }
 
-    std::string repr() const {
-        switch (m_value) {
-            case A: return "A";
-            case NS: return "NS";
-            case CNAME: return "CNAME";
-            case SOA: return "SOA";
-            case PTR: return "PTR";
-            case MX: return "MX";
-            case TXT: return "TXT";
-            case ANY: return "ANY";
-            default: return "TYPE" + std::to_string(int(m_value));
-        }
-    }
+    /**
+     *  The type's mnemonic, from the table in rrtype-traits.cpp, or
+     *  nullptr if it has none.
+     */
+    const char *mnemonic() const noexcept;
+    std::string repr() const;
 
 private:
     uint16_t m_value = 0;
@@ -1,6 +1,14 @@
 #pragma once
 
 #include "authoritative-resolver.h"
+#include "forwarder.h"
+#include "query-view.h"
+#include "response-writer.h"
+#include "stage-tracer.h"
+
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <string>
 
 namespace dns {
 
@@ -10,12 +18,47 @@ namespace dns {
  */
 class Server {
 public:
+    /**
+     *  How many packets were dropped, or answered with an error, for each
+     *  reason. They are counted rather than logged, so that a flood of
+     *  garbage costs no more than parsing it.
+     */
+    struct RejectCounts {
+        uint64_t malformed = 0;       // dropped: did not parse
+        uint64_t responses = 0;       // dropped: QR was set
+        uint64_t not_query = 0;       // NOTIMP: opcode other than QUERY
+        uint64_t formerr = 0;         // FORMERR: bad section counts
+        uint64_t badvers = 0;         // BADVERS: EDNS version other than 0
+        uint64_t trailing_bytes = 0;  // answered, but had bytes after the message
+        uint64_t no_room = 0;         // dropped: the response did not fit
+
+        /** The packets dropped or answered with an error, all told. */
+        uint64_t total() const noexcept {
+            return malformed + responses + not_query + formerr + badvers + no_room;
+        }
+        std::string repr() const;
+    };
+
+    /**
+     *  Per-worker scratch space. Its members keep their storage from one
+     *  query to the next, so that in steady state handling a query does
+     *  not allocate.
+     */
+    struct Workspace {
+        QueryView query;
+        StageTracing trace;
+        RejectCounts rejects;
+    };
+
     /**
      *  Constructor.
      *  Creates a socket Server.
      *  @param resolver The object @ref Resolver from the application.
+     *  @param forwarder If non-null, the @ref Forwarder that handles queries
+     *         for which we have no authority, instead of refusing them.
      */
-    explicit Server(AuthoritativeResolver& resolver) : m_resolver(resolver) {}
+    explicit Server(AuthoritativeResolver& resolver, Forwarder *forwarder = nullptr) :
+        m_resolver(resolver), m_forwarder(forwarder) {}
 
     /**
      *  Initializes the server creating a UDP datagram socket and binding it to
@@ -27,12 +70,37 @@ public:
     /**
      *  The socket server runs in an infinite loop, waiting for queries and
      *  handling them through the @ref Resolver and sending back the responses.
+     *  SIGUSR1 makes it print how many packets it has rejected, the
+     *  forwarder's cache statistics, and (if it was built with stage
+     *  tracing) the histograms of its stage times.
      */
     void run() noexcept;
 
+    /**
+     *  Handle a single incoming packet, writing any response into `out`.
+     *  @param ws The calling worker's @ref Workspace.
+     *  @param client The address the packet came from.
+     *  @return A pointer one past the end of the response, or nullptr if
+     *          there is nothing to send back (yet).
+     */
+    char *handle_packet(Workspace& ws, const char *packet, const char *end,
+                        char *out, const char *out_end, const sockaddr_in& client) noexcept;
+
+    /**
+     *  The same, timing the stages with `trace` rather than the
+     *  workspace's own tracer; instantiated for StageTracing and for
+     *  StageTracer<0>, <1> and <64>.
+     */
+    template<class Tracer>
+    char *handle_packet(Workspace& ws, Tracer& trace, const char *packet, const char *end,
+                        char *out, const char *out_end, const sockaddr_in& client) noexcept;
+
 private:
-    int m_sockfd;
+    void send_to_client(const sockaddr_in& addr, const char *packet, const char *end) noexcept;
+
+    int m_sockfd = -1;
     AuthoritativeResolver& m_resolver;
+    Forwarder *m_forwarder;
 };
 
 } // namespace dns
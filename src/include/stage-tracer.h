@@ -0,0 +1,175 @@
+#pragma once
+
+#include <inttypes.h>
+#include <ostream>
+#include <stddef.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DNS_STAGE_TRACER_TSC 1
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+// With `make STAGE_TRACING=1` the server times the stages of 1 in
+// DNS_STAGE_SAMPLE_EVERY queries (`make STAGE_SAMPLE_EVERY=<n>`, 64 by
+// default); the default, 0, compiles the timing out altogether. Timing
+// every query costs far more than 1 in 64 does (see README.md).
+#ifndef DNS_STAGE_TRACING
+#define DNS_STAGE_TRACING 0
+#endif
+#ifndef DNS_STAGE_SAMPLE_EVERY
+#define DNS_STAGE_SAMPLE_EVERY 64
+#endif
+#define DNS_STAGE_SAMPLING (DNS_STAGE_TRACING ? DNS_STAGE_SAMPLE_EVERY : 0)
+
+namespace dns {
+
+/**
+ *  The stages of handling a query on the server's hot path, in order.
+ */
+enum class Stage {
+    RECV,     // recvfrom(), once the query is waiting
+    PARSE,    // QueryView::parse(), whether the packet is a query or not
+    RESOLVE,  // the checks on the header, and AuthoritativeResolver::populate_response()
+    ENCODE,   // ResponseWriter::finish()
+    SEND,     // sendto()
+    TOTAL,    // all of the above, for the queries answered
+};
+
+static constexpr int stage_count = int(Stage::TOTAL) + 1;
+
+/**
+ *  The time-stamp counter, or (where there is none) nanoseconds.
+ */
+inline uint64_t read_tsc() noexcept
+{
+#if DNS_STAGE_TRACER_TSC
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/**
+ *  How many ticks of read_tsc() there are in a nanosecond, measured
+ *  against the steady clock the first time it is asked for (which takes
+ *  about 20 ms).
+ */
+double tsc_ticks_per_ns();
+
+/**
+ *  A histogram of durations in ticks, in log-linear buckets: four to each
+ *  power of two, so that each bucket is at most 25% wider than its low end.
+ */
+class StageHistogram {
+public:
+    static constexpr int bucket_count = 252;
+
+    void add(uint64_t ticks) noexcept {
+        m_buckets[bucket(ticks)] += 1;
+        m_count += 1;
+        m_sum += ticks;
+        if (ticks > m_max) m_max = ticks;
+    }
+
+    uint64_t count() const noexcept { return m_count; }
+    uint64_t sum() const noexcept { return m_sum; }
+    uint64_t max() const noexcept { return m_max; }
+
+    /**
+     *  The upper end of the bucket holding the q-th quantile (0 < q <= 1).
+     */
+    uint64_t quantile(double q) const noexcept;
+
+private:
+    static int bucket(uint64_t ticks) noexcept {
+        if (ticks < 4) return int(ticks);
+        int msb = 63 - __builtin_clzll(ticks);
+        return 4 * msb - 4 + int((ticks >> (msb - 2)) & 3);
+    }
+
+    uint64_t m_buckets[bucket_count] = {};
+    uint64_t m_count = 0;
+    uint64_t m_sum = 0;
+    uint64_t m_max = 0;
+};
+
+/**
+ *  Print one worker's histograms, one line per stage, in nanoseconds.
+ */
+void dump_stage_histograms(std::ostream& os, int worker, const StageHistogram *histograms, unsigned sample_every);
+
+/**
+ *  Times each @ref Stage of 1 in `SampleEvery` queries with the
+ *  time-stamp counter, into a histogram per stage. Each worker keeps its
+ *  own, so nothing is shared. StageTracer<0> does nothing at all, and
+ *  every call to it compiles away.
+ *
+ *  For each query: next_query(), then start(), then lap() as each stage
+ *  ends, then finish() if it was answered. A packet that is dropped or
+ *  forwarded is not finished, so its stages so far are counted but not
+ *  its total.
+ */
+template<unsigned SampleEvery>
+class StageTracer {
+public:
+    static constexpr bool enabled = true;
+
+    /**
+     *  Decide whether this query is timed.
+     */
+    bool next_query() noexcept {
+        m_sampled = (++m_queries % SampleEvery == 0);
+        return m_sampled;
+    }
+
+    void start() noexcept {
+        if (m_sampled) m_start = m_last = read_tsc();
+    }
+
+    void lap(Stage stage) noexcept {
+        if (m_sampled) {
+            uint64_t now = read_tsc();
+            m_histograms[int(stage)].add(now - m_last);
+            m_last = now;
+        }
+    }
+
+    void finish() noexcept {
+        if (m_sampled) m_histograms[int(Stage::TOTAL)].add(m_last - m_start);
+    }
+
+    const StageHistogram& histogram(Stage stage) const noexcept { return m_histograms[int(stage)]; }
+
+    void dump(std::ostream& os, int worker) const {
+        dump_stage_histograms(os, worker, m_histograms, SampleEvery);
+    }
+
+private:
+    bool m_sampled = false;
+    uint64_t m_queries = 0;
+    uint64_t m_start = 0;
+    uint64_t m_last = 0;
+    StageHistogram m_histograms[stage_count];
+};
+
+template<>
+class StageTracer<0> {
+public:
+    static constexpr bool enabled = false;
+
+    bool next_query() noexcept { return false; }
+    void start() noexcept {}
+    void lap(Stage) noexcept {}
+    void finish() noexcept {}
+    void dump(std::ostream&, int) const {}
+};
+
+/**
+ *  The tracer the server is built with.
+ */
+using StageTracing = StageTracer<DNS_STAGE_SAMPLING>;
+
+} // namespace dns
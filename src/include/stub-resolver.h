@@ -16,10 +16,23 @@ namespace dns {
  */
 class StubResolver {
 public:
+    struct Reply {
+        Message message;
+        size_t bytes_received = 0;
+        nonstd::microseconds rtt{0};
+    };
+
     explicit StubResolver(Upstream upstream);
 
     std::future<Message> async_resolve(const Message& query, nonstd::milliseconds timeout) const;
 
+    /**
+     *  Like @ref async_resolve, but also report the size of the response
+     *  as received and the time it took to arrive.
+     *  The future throws a @ref dns::Exception if no response arrives in time.
+     */
+    std::future<Reply> async_query(const Message& query, nonstd::milliseconds timeout) const;
+
 private:
     std::vector<Upstream> m_upstreams;
 };
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <vector>
+
+namespace dns {
+
+/**
+ *  An ordered tree in about 3.5 bits per node, encoded as a depth-first
+ *  unary degree sequence (DFUDS; Benoit et al., "Representing trees of
+ *  higher degree", 2005). Nodes are numbered in preorder, the root being
+ *  node 0, and the k-th child of any node can be found directly, so that
+ *  a caller can binary-search a node's children.
+ *
+ *  Each node in turn is written as one '(' per child followed by a ')',
+ *  after a leading '('. The k-th child of a node starts right after the
+ *  ')' matching its (d-k)-th '(', where d is its degree; matching
+ *  parentheses are found with a range min-max tree over 128-bit blocks
+ *  (Navarro and Sadakane, "Fully functional static and dynamic succinct
+ *  trees", 2014).
+ */
+class SuccinctTree {
+public:
+    explicit SuccinctTree() = default;
+
+    /**
+     *  @param degrees The number of children of each node, in preorder.
+     */
+    explicit SuccinctTree(const std::vector<uint32_t>& degrees);
+
+    size_t size() const noexcept { return m_size; }
+    size_t memory_bytes() const noexcept;
+
+    /**
+     *  A node's children, located once so that each of them can be
+     *  reached without locating the node again.
+     */
+    struct Children {
+        size_t node;
+        size_t position;  // of the node's first '('
+        size_t count;
+    };
+
+    Children children(size_t node) const noexcept;
+    size_t degree(size_t node) const noexcept { return children(node).count; }
+
+    /**
+     *  The k-th of the children (counting from 0), of which there must be more than k.
+     */
+    size_t child(const Children& children, size_t k) const noexcept;
+    size_t child(size_t node, size_t k) const noexcept { return child(children(node), k); }
+
+private:
+    static const size_t block_bits = 128;
+
+    bool bit(size_t i) const noexcept { return (m_words[i / 64] >> (i % 64)) & 1; }
+    size_t rank1(size_t i) const noexcept;  // of the bits before i
+    size_t select0(size_t k) const noexcept;  // the position of the k-th ')', from 0
+    size_t position(size_t node) const noexcept;
+    size_t find_close(size_t i) const noexcept;
+    bool scan(size_t from, size_t to, long& excess, long target, size_t& found) const noexcept;
+    long first_block(size_t node, size_t lo, size_t hi, size_t from, long target) const noexcept;
+
+    size_t m_size = 0;
+    size_t m_bits = 0;
+    std::vector<uint64_t> m_words;     // bit i is 1 for '('
+    std::vector<uint32_t> m_ranks;     // the number of '(' before each block
+    std::vector<int32_t> m_min_tree;   // the least excess in each block, and in each range of blocks
+    size_t m_leaves = 0;               // the index of the first block's entry in m_min_tree
+};
+
+} // namespace dns
@@ -1,29 +1,34 @@
 #pragma once
 
-#include "name.h"
-
-#include <map>
+#include <string>
 
 namespace dns {
 
-class Name;
-
 /**
- *  Class that represents a DNS message (a query or a response).
+ *  Class that resolves the compression pointers in a DNS message.
+ *  It keeps a copy of the message, so that names in RDATA can still be
+ *  decoded after the original packet buffer has gone away. The copy's
+ *  storage is reused from one call to @ref build to the next, so
+ *  rebuilding it does not allocate in steady state.
  */
 class SymbolTable {
 public:
     explicit SymbolTable() = default;
 
-    void build(const char *packet_start, const char *end);
+    void build(const char *packet_start, const char *end) { m_packet.assign(packet_start, end); }
+    void clear() noexcept { m_packet.clear(); }
 
-    auto find(int key) const noexcept -> std::map<int, Name>::const_iterator {
-        return m_table.find(key);
+    /**
+     *  @param offset The 14-bit offset from a compression pointer.
+     *  @return The position it points to, or nullptr if it is out of range.
+     */
+    const char *find(int offset) const noexcept {
+        return (offset < m_packet.size()) ? m_packet.data() + offset : nullptr;
     }
-    auto end() const noexcept -> std::map<int, Name>::const_iterator { return m_table.end(); }
+    const char *end() const noexcept { return m_packet.data() + m_packet.size(); }
 
 private:
-    std::map<int, Name> m_table;
+    std::string m_packet;
 };
 
 } // namespace dns
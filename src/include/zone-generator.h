@@ -0,0 +1,154 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace dns {
+
+/**
+ *  Draws k from 1 to n with probability proportional to 1/k^s, in
+ *  constant time whatever n is, by rejection-inversion (Hormann and
+ *  Derflinger, "Rejection-inversion to generate variates from monotone
+ *  discrete distributions", 1996).
+ */
+class ZipfSampler {
+public:
+    explicit ZipfSampler() = default;
+    explicit ZipfSampler(uint64_t n, double s);
+
+    /**
+     *  @param next A function returning uniform doubles in [0, 1),
+     *         called as many times as the rejections take.
+     */
+    template<class F>
+    uint64_t operator()(const F& next) const;
+
+private:
+    double h(double x) const noexcept;
+    double integral(double x) const noexcept;
+    double integral_inverse(double x) const noexcept;
+
+    uint64_t m_n = 1;
+    double m_s = 1;
+    double m_integral_x1 = 0;
+    double m_integral_n = 0;
+    double m_threshold = 0;
+};
+
+/**
+ *  What a @ref ZoneGenerator makes.
+ */
+struct GeneratorOptions {
+    /** The zone's apex, an absolute name. */
+    std::string origin = "gen.example.";
+
+    /** About how many records to write, counting delegations' glue and the apex's. */
+    uint64_t records = 100000;
+
+    /** How many levels of names there are below the apex. */
+    int depth = 3;
+
+    /**
+     *  How a name's parent is picked from the level above: uniformly
+     *  (so fan-outs are about equal), or with Zipf-distributed
+     *  popularity of this exponent (so a few names have most of the children).
+     */
+    bool zipf_fanout = false;
+    double fanout_skew = 1.0;
+
+    /** The fraction of names that own a wildcard just below them. */
+    double wildcard_fraction = 0.01;
+
+    /** The fraction of names that are delegated, with an NS record and its glue. */
+    double delegation_fraction = 0.05;
+
+    /** The RR types of the other names, and their relative weights: A, AAAA, MX, TXT or CNAME. */
+    std::vector<std::pair<std::string, double>> types = {
+        {"A", 60}, {"AAAA", 15}, {"MX", 5}, {"TXT", 10}, {"CNAME", 10},
+    };
+
+    /** The exponent of the queried names' Zipf-distributed popularity. */
+    double query_skew = 1.0;
+
+    /** The fraction of queries for names that don't exist. */
+    double nxdomain_fraction = 0.1;
+
+    uint64_t seed = 1;
+};
+
+/**
+ *  Makes a synthetic zone, and a stream of queries for it, for testing at
+ *  scale. Everything about the i-th name (its level, parent, label and
+ *  records) is a function of i and the seed, so the same options always
+ *  make the same zone, and neither the zone nor the queries need the
+ *  names to be kept in memory.
+ *
+ *  The names are laid out level by level, each level about N^(1/depth)
+ *  times bigger than the one above; every name but a delegation, a CNAME
+ *  or the owner of a wildcard can have children.
+ */
+class ZoneGenerator {
+public:
+    /**
+     *  @throws dns::Exception if the options make no sense.
+     */
+    explicit ZoneGenerator(const GeneratorOptions& options);
+
+    uint64_t names() const noexcept { return m_level_start.back(); }
+    int levels() const noexcept { return int(m_level_start.size()) - 1; }
+    uint64_t level_size(int level) const noexcept { return m_level_start[level] - m_level_start[level - 1]; }
+
+    /**
+     *  Write the zone in zone-file format.
+     *  @return The number of records written.
+     */
+    uint64_t write_zone(FILE *out) const;
+
+    /**
+     *  Write `count` queries, one "<qname> <qtype>" per line as `dns-dig -f` reads them.
+     *  @return The number of them for nonexistent names.
+     */
+    uint64_t write_queries(FILE *out, uint64_t count) const;
+
+private:
+    enum Kind { PLAIN, WILDCARD, DELEGATION };
+
+    uint64_t hash(uint64_t i, uint64_t salt) const noexcept;
+    Kind kind(uint64_t i) const noexcept;
+    size_t type(uint64_t i) const noexcept;
+    bool can_have_children(uint64_t i) const noexcept;
+    int level(uint64_t i) const noexcept;
+    uint64_t parent(uint64_t i) const noexcept;
+    void append_label(std::string& s, uint64_t i) const;
+    void append_name(std::string& s, uint64_t i) const;
+    void append_rdata(std::string& s, uint64_t i, size_t type) const;
+
+    static const uint64_t no_parent = uint64_t(-1);  // the apex
+
+    GeneratorOptions m_options;
+    std::vector<uint64_t> m_level_start;  // the first name of each level, then the number of names
+    std::vector<ZipfSampler> m_parent_samplers;  // for each level
+    std::vector<double> m_type_cdf;
+    ZipfSampler m_query_sampler;
+};
+
+template<class F>
+uint64_t ZipfSampler::operator()(const F& next) const
+{
+    while (true) {
+        double u = m_integral_n + next() * (m_integral_x1 - m_integral_n);
+        double x = integral_inverse(u);
+        uint64_t k = uint64_t(x + 0.5);
+        if (k < 1) k = 1;
+        if (k > m_n) k = m_n;
+        if (k - x <= m_threshold || u >= integral(k + 0.5) - h(k)) {
+            return k;
+        }
+    }
+}
+
+} // namespace dns
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "name.h"
+#include "rr.h"
+#include "rrtype.h"
+
+#include <functional>
+#include <inttypes.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace dns {
+
+/**
+ *  Writes records in zone-file format, one per line, into a large buffer
+ *  that is handed to a sink whenever it fills up. Each record is
+ *  formatted in place by RR::repr(), so nothing is allocated per record.
+ *  Whatever is still buffered is lost unless @ref flush is called.
+ */
+class ZoneWriter {
+public:
+    using Sink = std::function<void(const char *data, size_t n)>;
+
+    explicit ZoneWriter(Sink sink, size_t buffer_size = 1 << 20);
+
+    /**
+     *  A sink that writes everything to a file descriptor, throwing
+     *  dns::Exception if it can't.
+     */
+    static Sink to_fd(int fd);
+
+    void write(const RR& rr);
+    void write(const Name& owner, RRType rrtype, RRClass rrclass, uint32_t ttl, const char *rdata, size_t rdlength);
+
+    /**
+     *  Write a line that stands for records, such as a $GENERATE directive.
+     */
+    void write_line(const std::string& line);
+
+    void flush();
+
+    /**
+     *  The number of records written so far, not counting the lines
+     *  written by @ref write_line.
+     */
+    size_t records() const noexcept { return m_records; }
+
+    /**
+     *  The number of lines written by @ref write_line so far.
+     */
+    size_t directives() const noexcept { return m_directives; }
+
+private:
+    void reserve(size_t n);
+
+    Sink m_sink;
+    std::vector<char> m_buffer;
+    size_t m_used = 0;
+    size_t m_records = 0;
+    size_t m_directives = 0;
+};
+
+} // namespace dns
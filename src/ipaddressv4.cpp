@@ -2,8 +2,7 @@
 #include "exception.h"
 #include "ipaddressv4.h"
 
-#include <regex>
-#include <stdlib.h>
+#include <ctype.h>
 #include <string>
 #include <string.h>
 
@@ -11,22 +10,29 @@ using namespace dns;
 
 const char *IPAddressV4::decode_repr(const char *src, const char *end)
 {
-    std::regex rx("(\\d+)\\.(\\d+)\\.(\\d+)\\.(\\d+)");
-    std::cmatch m;
-    bool success = std::regex_match(src, end, m, rx);
-    if (!success) return nullptr;
-    int quad1 = atoi(m[1].first);
-    int quad2 = atoi(m[2].first);
-    int quad3 = atoi(m[3].first);
-    int quad4 = atoi(m[4].str().c_str());
-    if (quad1 > 255 || quad2 > 255 || quad3 > 255 || quad4 > 255) {
+    // Four dotted decimal numbers, and nothing else.
+    int quads[4];
+    const char *p = src;
+    for (int i = 0; i < 4; ++i) {
+        if (i != 0) {
+            if (p == end || *p != '.') return nullptr;
+            ++p;
+        }
+        if (p == end || !isdigit(*p)) return nullptr;
+        quads[i] = 0;
+        while (p != end && isdigit(*p)) {
+            if (quads[i] <= 255) quads[i] = (quads[i] * 10) + (*p - '0');
+            ++p;
+        }
+    }
+    if (p != end) return nullptr;
+    if (quads[0] > 255 || quads[1] > 255 || quads[2] > 255 || quads[3] > 255) {
         throw dns::UnsupportedException("IPv4 address contains byte values over 255");
     }
-    m_bytes[0] = quad1;
-    m_bytes[1] = quad2;
-    m_bytes[2] = quad3;
-    m_bytes[3] = quad4;
-    return m[0].second;
+    for (int i = 0; i < 4; ++i) {
+        m_bytes[i] = quads[i];
+    }
+    return p;
 }
 
 std::string IPAddressV4::repr() const
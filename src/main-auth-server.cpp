@@ -1,10 +1,20 @@
 
 #include "authoritative-resolver.h"
+#include "cache.h"
+#include "exception.h"
+#include "forwarder.h"
 #include "server.h"
+#include "upstream.h"
 
+#include <chrono>
+#include <fcntl.h>
 #include <iostream>
+#include <memory>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <string.h>
+#include <unistd.h>
 
 void exit_with_message(const char *msg)
 {
@@ -12,13 +22,91 @@ void exit_with_message(const char *msg)
     exit(1);
 }
 
+static const char usage[] =
+    "Usage: dnsServer [--compact] [--print-records] <port> <zonefile> [<forwarder-ip>:<forwarder-port>]\n"
+    "       dnsServer dump [--compact] [--threads <n>] <zonefile> [<outfile>]\n"
+    "  --compact        keep the zones in less memory, at some cost in speed\n"
+    "  --print-records  print every record once the zones are loaded\n"
+    "  --threads <n>    dump the zones on n threads, splitting them by subtree\n"
+    "Example: dnsServer 9000 zone.txt\n"
+    "Example: dnsServer 9000 zone.txt 127.0.0.1:9001\n"
+    "Example: dnsServer dump --threads 4 zone.txt zone-out.txt\n";
+
+static int dump(int argc, char **argv)
+{
+    dns::ResolverOptions options;
+    int threads = 1;
+    while (argc >= 2 && argv[1][0] == '-') {
+        if (strcmp(argv[1], "--compact") == 0) {
+            options.compact_storage = true;
+        } else if (strcmp(argv[1], "--threads") == 0 && argc >= 3) {
+            threads = atoi(argv[2]);
+            argc -= 1;
+            argv += 1;
+        } else {
+            exit_with_message(usage);
+        }
+        argc -= 1;
+        argv += 1;
+    }
+    if (argc != 2 && argc != 3) {
+        exit_with_message(usage);
+    }
+    if (threads < 1 || threads > 256) {
+        exit_with_message("Error: Invalid number of threads.\n");
+    }
+
+    try {
+        dns::AuthoritativeResolver resolver(argv[1], options);
+        int fd = 1;
+        if (argc == 3) {
+            fd = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                throw dns::Exception("Could not open file: ", argv[2]);
+            }
+        }
+        auto start = std::chrono::steady_clock::now();
+        dns::AuthoritativeResolver::DumpCounts counts = resolver.dump_records(fd, threads);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (fd != 1 && close(fd) != 0) {
+            throw dns::Exception("Could not write file: ", argv[2]);
+        }
+        // A $GENERATE line is written as it is, not expanded, so it
+        // doesn't count towards the rate.
+        char line[160];
+        int n = snprintf(line, sizeof line, "dumped %zu records in %.3f s (%.0f records/sec)",
+                         counts.records, elapsed.count(), counts.records / elapsed.count());
+        if (counts.generated != 0) {
+            snprintf(line + n, sizeof line - n, ", and %zu $GENERATE lines", counts.generated);
+        }
+        std::cerr << line << std::endl;
+    } catch (const std::exception& e) {
+        exit_with_message(e.what());
+    }
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
-    if (argc != 3) {
-        exit_with_message(
-            "Usage: dnsServer <port> <zonefile>\n"
-            "Example: dnsServer 9000 zone.txt\n"
-        );
+    if (argc >= 2 && strcmp(argv[1], "dump") == 0) {
+        return dump(argc - 1, argv + 1);
+    }
+
+    dns::ResolverOptions options;
+    bool print_records = false;
+    while (argc >= 2 && argv[1][0] == '-') {
+        if (strcmp(argv[1], "--compact") == 0) {
+            options.compact_storage = true;
+        } else if (strcmp(argv[1], "--print-records") == 0) {
+            print_records = true;
+        } else {
+            exit_with_message(usage);
+        }
+        argc -= 1;
+        argv += 1;
+    }
+    if (argc != 3 && argc != 4) {
+        exit_with_message(usage);
     }
 
     int port = atoi(argv[1]);
@@ -28,10 +116,35 @@ int main(int argc, char **argv)
         exit_with_message("Error: Invalid port number.\n");
     }
 
+    std::string forwarder_ip;
+    int forwarder_port = 0;
+    if (argc == 4) {
+        std::string arg = argv[3];
+        size_t colon = arg.find(':');
+        if (colon == std::string::npos) {
+            exit_with_message("Error: Forwarder must be given as <ip>:<port>.\n");
+        }
+        forwarder_ip = arg.substr(0, colon);
+        forwarder_port = atoi(arg.c_str() + colon + 1);
+        if (forwarder_port < 1 || forwarder_port > 65535) {
+            exit_with_message("Error: Invalid forwarder port number.\n");
+        }
+    }
+
     try {
-        dns::AuthoritativeResolver resolver(zonefile);
-        resolver.print_records();
-        dns::Server server(resolver);
+        dns::AuthoritativeResolver resolver(zonefile, options);
+        if (print_records) {
+            std::cout.flush();
+            resolver.dump_records(1);
+        }
+        resolver.print_name_filters();
+        dns::Cache cache;
+        std::unique_ptr<dns::Forwarder> forwarder;
+        if (forwarder_port != 0) {
+            forwarder.reset(new dns::Forwarder(dns::Upstream(forwarder_ip.c_str(), forwarder_port), cache));
+            std::cout << "Forwarding to: " << forwarder_ip << "#" << forwarder_port << std::endl;
+        }
+        dns::Server server(resolver, forwarder.get());
         server.bind_to(port);
         std::cout << "Listening on port: " << port << std::endl;
         server.run();
@@ -0,0 +1,1026 @@
+
+#include "authoritative-resolver.h"
+#include "casefold.h"
+#include "child-table.h"
+#include "decode-error.h"
+#include "exception.h"
+#include "message.h"
+#include "name.h"
+#include "query-view.h"
+#include "question.h"
+#include "rcode.h"
+#include "response.h"
+#include "reverse-index.h"
+#include "rr.h"
+#include "rrtype.h"
+#include "server.h"
+#include "stage-tracer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <fstream>
+#include <iostream>
+#include <malloc.h>
+#include <map>
+#include <new>
+#include <random>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <vector>
+
+// Count every heap allocation made by this process, so that benchmarks
+// can report allocations per query alongside time per query.
+static size_t g_allocations = 0;
+
+void *operator new(size_t n)
+{
+    g_allocations += 1;
+    void *p = malloc(n ? n : 1);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+static size_t heap_bytes_in_use()
+{
+    return mallinfo2().uordblks;
+}
+
+void exit_with_message(const char *msg)
+{
+    std::cerr << msg << std::endl;
+    exit(1);
+}
+
+/**
+ *  Build a mix of query packets from the owner names in the zonefile:
+ *  one for each record as written, and one for a nonexistent child of
+ *  each owner (which exercises the NXDOMAIN, wildcard and referral paths).
+ */
+static std::vector<std::string> make_queries_from_zonefile(const std::string& filename)
+{
+    std::ifstream file(filename.c_str());
+    if (!file) {
+        throw dns::Exception("Could not open file: ", filename);
+    }
+    std::vector<std::string> result;
+    auto add = [&](const std::string& qname, dns::RRType qtype) {
+        dns::Message query = dns::Message::beginQuery(
+            dns::Question(dns::Name(qname.c_str()), qtype, dns::RRClass::IN)
+        );
+        char buffer[512];
+        char *end = query.encode(buffer, buffer + sizeof buffer);
+        result.emplace_back(buffer, end);
+    };
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty()) continue;
+        dns::RR rr;
+        rr.decode_repr(line.data(), line.data() + line.size());
+        std::string owner = rr.name().repr();
+        if (owner.empty() || owner[0] == '"') continue;
+        add(owner, rr.rrtype());
+        add("no-such-name." + owner, dns::RRType::A);
+    }
+    add("www.example.net.", dns::RRType::A);
+    return result;
+}
+
+static int bench_allocs(const std::string& zonefile, int iterations)
+{
+    using clock = std::chrono::steady_clock;
+
+    dns::AuthoritativeResolver resolver(zonefile);
+    dns::Server server(resolver);
+    std::vector<std::string> queries = make_queries_from_zonefile(zonefile);
+    struct sockaddr_in client {};
+
+    dns::Server::Workspace ws;
+    char out[512];
+    auto run_once = [&]() {
+        for (auto&& q : queries) {
+            server.handle_packet(ws, q.data(), q.data() + q.size(), out, out + sizeof out, client);
+        }
+    };
+
+    // Let the workspace grow to its steady-state size.
+    run_once();
+    run_once();
+
+    size_t allocations_before = g_allocations;
+    auto start = clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        run_once();
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+    size_t allocations = g_allocations - allocations_before;
+    double nqueries = double(iterations) * queries.size();
+
+    std::cout << "queries: " << size_t(nqueries) << " (" << queries.size() << " distinct)" << std::endl;
+    std::cout << "allocations: " << allocations << " (" << (allocations / nqueries) << " per query)" << std::endl;
+    std::cout << "time: " << (elapsed.count() / nqueries) << " ns per query" << std::endl;
+    return (allocations == 0) ? 0 : 1;
+}
+
+/**
+ *  Measure what names cost: allocations to decode each query packet and
+ *  each response packet into a fresh Message, and the heap a zone takes
+ *  once loaded, with and without interning its owner names.
+ */
+static int bench_names(const std::string& zonefile, int iterations)
+{
+    std::vector<std::string> queries = make_queries_from_zonefile(zonefile);
+    std::vector<std::string> responses;
+    {
+        dns::AuthoritativeResolver resolver(zonefile);
+        dns::Server server(resolver);
+        dns::Server::Workspace ws;
+        struct sockaddr_in client {};
+        char out[512];
+        for (auto&& q : queries) {
+            char *end = server.handle_packet(ws, q.data(), q.data() + q.size(), out, out + sizeof out, client);
+            if (end != nullptr) responses.emplace_back(out, end);
+        }
+    }
+
+    char line[200];
+    snprintf(line, sizeof line, "sizeof(Name): %zu bytes", sizeof(dns::Name));
+    std::cout << line << std::endl;
+
+    auto cold_decode = [&](const char *what, const std::vector<std::string>& packets) {
+        size_t allocations_before = g_allocations;
+        for (int i = 0; i < iterations; ++i) {
+            for (auto&& packet : packets) {
+                dns::Message m;
+                if (m.decode(packet.data(), packet.data() + packet.size()) == nullptr) {
+                    exit_with_message("Failed to decode a packet");
+                }
+            }
+        }
+        double npackets = double(iterations) * packets.size();
+        snprintf(line, sizeof line, "%-9s decoded into a fresh Message: %5.2f allocations per packet",
+                 what, (g_allocations - allocations_before) / npackets);
+        std::cout << line << std::endl;
+    };
+    cold_decode("queries", queries);
+    cold_decode("responses", responses);
+
+    for (bool intern : {false, true}) {
+        dns::ResolverOptions options;
+        options.intern_names = intern;
+        size_t allocations_before = g_allocations;
+        size_t bytes_before = heap_bytes_in_use();
+        dns::AuthoritativeResolver resolver(zonefile, options);
+        snprintf(line, sizeof line, "zone, %-13s %8.2f MB on the heap, %zu allocations to load",
+                 intern ? "interned:" : "not interned:",
+                 (heap_bytes_in_use() - bytes_before) / 1048576.0, g_allocations - allocations_before);
+        std::cout << line << std::endl;
+    }
+    return 0;
+}
+
+/**
+ *  Load the zone in the default layout and in compact storage, and
+ *  compare the heap each takes, the time per query on the server's hot
+ *  path, and the responses themselves, which must be the same.
+ */
+static int bench_compact(const std::string& zonefile, int iterations)
+{
+    using clock = std::chrono::steady_clock;
+
+    std::vector<std::string> queries = make_queries_from_zonefile(zonefile);
+    struct sockaddr_in client {};
+    dns::Server::Workspace ws;
+    char line[200];
+    std::vector<std::string> responses[2];
+
+    for (bool compact : {false, true}) {
+        dns::ResolverOptions options;
+        options.compact_storage = compact;
+        size_t bytes_before = heap_bytes_in_use();
+        auto start = clock::now();
+        dns::AuthoritativeResolver resolver(zonefile, options);
+        auto load_time = std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - start);
+        size_t bytes = heap_bytes_in_use() - bytes_before;
+        dns::Server server(resolver);
+
+        char out[512];
+        for (auto&& q : queries) {
+            char *end = server.handle_packet(ws, q.data(), q.data() + q.size(), out, out + sizeof out, client);
+            responses[compact].emplace_back(out, (end != nullptr) ? end : out);
+        }
+        start = clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            for (auto&& q : queries) {
+                server.handle_packet(ws, q.data(), q.data() + q.size(), out, out + sizeof out, client);
+            }
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+        snprintf(line, sizeof line, "%-8s %8.2f MB on the heap, loaded in %6ld ms, %7.1f ns per query",
+                 compact ? "compact:" : "default:", bytes / 1048576.0, long(load_time.count()),
+                 double(elapsed.count()) / (double(iterations) * queries.size()));
+        std::cout << line << std::endl;
+    }
+
+    size_t differ = 0;
+    for (size_t i = 0; i < queries.size(); ++i) {
+        differ += (responses[0][i] != responses[1][i]);
+    }
+    std::cout << "responses that differ: " << differ << " of " << queries.size() << std::endl;
+    return (differ == 0) ? 0 : 1;
+}
+
+/**
+ *  The queries make_queries_from_zonefile() makes, and for each name of
+ *  the form d.c.b.a.in-addr.arpa. that owns a PTR record, queries for its
+ *  other types, for the names above and below it, and for its neighbour.
+ */
+static std::vector<std::string> make_reverse_queries(const std::string& filename)
+{
+    std::vector<std::string> result = make_queries_from_zonefile(filename);
+    std::ifstream file(filename.c_str());
+    auto add = [&](const dns::Name& qname, dns::RRType qtype) {
+        dns::Message query = dns::Message::beginQuery(dns::Question(qname, qtype, dns::RRClass::IN));
+        char buffer[512];
+        char *end = query.encode(buffer, buffer + sizeof buffer);
+        result.emplace_back(buffer, end);
+    };
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '$') continue;
+        dns::RR rr;
+        rr.decode_repr(line.data(), line.data() + line.size());
+        uint32_t address;
+        if (rr.rrtype() != dns::RRType::PTR || !dns::ReverseIndex::parse_name(rr.name(), address)) continue;
+        for (dns::RRType qtype : {dns::RRType(dns::RRType::ANY), dns::RRType(dns::RRType::A)}) {
+            add(rr.name(), qtype);
+        }
+        add(dns::ReverseIndex::make_name(address ^ 1), dns::RRType::PTR);
+        std::string name = rr.name().repr();
+        for (size_t dot = name.find('.'); dot + 1 < name.size(); dot = name.find('.', dot + 1)) {
+            add(dns::Name(name.c_str() + dot + 1), dns::RRType::PTR);
+        }
+        add(dns::Name(("x." + name).c_str()), dns::RRType::PTR);
+    }
+    return result;
+}
+
+/**
+ *  Load the zone with its in-addr.arpa. PTR records in the reverse index
+ *  and in the domain tree, and compare the heap each takes, the time per
+ *  query on the server's hot path, and the responses, which must be the same.
+ */
+static int bench_reverse(const std::string& zonefile, int iterations)
+{
+    using clock = std::chrono::steady_clock;
+
+    std::vector<std::string> queries = make_reverse_queries(zonefile);
+    struct sockaddr_in client {};
+    dns::Server::Workspace ws;
+    char line[200];
+    std::vector<std::string> responses[2];
+
+    for (bool indexed : {false, true}) {
+        dns::ResolverOptions options;
+        options.reverse_index = indexed;
+        size_t bytes_before = heap_bytes_in_use();
+        auto start = clock::now();
+        dns::AuthoritativeResolver resolver(zonefile, options);
+        auto load_time = std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - start);
+        size_t bytes = heap_bytes_in_use() - bytes_before;
+        dns::Server server(resolver);
+
+        char out[512];
+        for (auto&& q : queries) {
+            char *end = server.handle_packet(ws, q.data(), q.data() + q.size(), out, out + sizeof out, client);
+            responses[indexed].emplace_back(out, (end != nullptr) ? end : out);
+        }
+        start = clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            for (auto&& q : queries) {
+                server.handle_packet(ws, q.data(), q.data() + q.size(), out, out + sizeof out, client);
+            }
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+        snprintf(line, sizeof line, "%-7s %8.2f MB on the heap, loaded in %6ld ms, %7.1f ns per query",
+                 indexed ? "index:" : "tree:", bytes / 1048576.0, long(load_time.count()),
+                 double(elapsed.count()) / (double(iterations) * queries.size()));
+        std::cout << line << std::endl;
+    }
+
+    size_t differ = 0;
+    for (size_t i = 0; i < queries.size(); ++i) {
+        differ += (responses[0][i] != responses[1][i]);
+    }
+    std::cout << "responses that differ: " << differ << " of " << queries.size() << std::endl;
+    return (differ == 0) ? 0 : 1;
+}
+
+static int bench_records(const std::string& zonefile, int iterations)
+{
+    using clock = std::chrono::steady_clock;
+
+    std::ifstream file(zonefile.c_str());
+    if (!file) {
+        throw dns::Exception("Could not open file: ", zonefile);
+    }
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '$') continue;
+        lines.push_back(line);
+    }
+
+    std::vector<dns::RR> rrs(lines.size());
+    auto start = clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        for (size_t j = 0; j < lines.size(); ++j) {
+            rrs[j].decode_repr(lines[j].data(), lines[j].data() + lines[j].size());
+        }
+    }
+    auto parse_elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+
+    dns::SymbolTable syms;
+    size_t bytes = 0;
+    start = clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        for (auto&& rr : rrs) {
+            bytes += rr.repr(syms).size();
+        }
+    }
+    auto print_elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+
+    // Each record must read back as it was printed.
+    size_t differ = 0;
+    for (auto&& rr : rrs) {
+        std::string repr = rr.repr(syms);
+        dns::RR again;
+        again.decode_repr(repr.data(), repr.data() + repr.size());
+        differ += (again.rrtype() != rr.rrtype() || again.rdata() != rr.rdata());
+    }
+
+    double nrecords = double(iterations) * rrs.size();
+    char buffer[200];
+    snprintf(buffer, sizeof buffer, "parse: %8.1f ns per record", parse_elapsed.count() / nrecords);
+    std::cout << buffer << std::endl;
+    snprintf(buffer, sizeof buffer, "print: %8.1f ns per record (%zu bytes)", print_elapsed.count() / nrecords, bytes);
+    std::cout << buffer << std::endl;
+    std::cout << "records that don't read back as printed: " << differ << " of " << rrs.size() << std::endl;
+    return (differ == 0) ? 0 : 1;
+}
+
+template<class Tracer>
+static double time_traced_queries(dns::Server& server, const std::vector<std::string>& queries, int iterations,
+                                  Tracer& trace)
+{
+    using clock = std::chrono::steady_clock;
+
+    struct sockaddr_in client {};
+    dns::Server::Workspace ws;
+    char out[512];
+    auto start = clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        for (auto&& q : queries) {
+            trace.next_query();
+            trace.start();
+            if (server.handle_packet(ws, trace, q.data(), q.data() + q.size(), out, out + sizeof out, client)) {
+                trace.finish();
+            }
+        }
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+    return elapsed.count() / (double(iterations) * queries.size());
+}
+
+/**
+ *  Measure what stage tracing costs on the hot path (without the
+ *  sockets, whose system calls would hide it): untraced, tracing 1 in
+ *  64 queries, and tracing every query, taking the best of several
+ *  rounds of each. Then print the stage times of every query.
+ */
+static int bench_stages(const std::string& zonefile, int iterations)
+{
+    dns::AuthoritativeResolver resolver(zonefile);
+    dns::Server server(resolver);
+    std::vector<std::string> queries = make_queries_from_zonefile(zonefile);
+
+    dns::StageTracer<0> untraced;
+    dns::StageTracer<64> sampled;
+    dns::StageTracer<1> traced;
+    double best[3] = {1e300, 1e300, 1e300};
+    for (int round = 0; round < 5; ++round) {
+        best[0] = std::min(best[0], time_traced_queries(server, queries, iterations, untraced));
+        best[1] = std::min(best[1], time_traced_queries(server, queries, iterations, sampled));
+        best[2] = std::min(best[2], time_traced_queries(server, queries, iterations, traced));
+    }
+
+    char line[200];
+    snprintf(line, sizeof line, "untraced:           %7.1f ns per query", best[0]);
+    std::cout << line << std::endl;
+    snprintf(line, sizeof line, "traced 1 in 64:     %7.1f ns per query (%+.2f%%)",
+             best[1], 100 * (best[1] / best[0] - 1));
+    std::cout << line << std::endl;
+    snprintf(line, sizeof line, "traced every query: %7.1f ns per query (%+.2f%%)",
+             best[2], 100 * (best[2] / best[0] - 1));
+    std::cout << line << std::endl;
+    traced.dump(std::cout, 0);
+    return 0;
+}
+
+/**
+ *  Load a zone, then answer each query of a file of "<qname> [<qtype>]"
+ *  lines (as dns-gen writes them, and dns-dig -f reads them) in order,
+ *  `iterations` times over, counting the responses by RCODE.
+ */
+static int bench_replay(const std::string& zonefile, const std::string& queryfile, int iterations)
+{
+    using clock = std::chrono::steady_clock;
+
+    std::ifstream file(queryfile.c_str());
+    if (!file) {
+        throw dns::Exception("Could not open file: ", queryfile);
+    }
+    std::vector<std::string> queries;
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t space = line.find(' ');
+        if (line.empty()) continue;
+        std::string qname = line.substr(0, space);
+        dns::RRType qtype = (space == std::string::npos) ? dns::RRType::A : dns::RRType(line.substr(space + 1));
+        dns::Message query = dns::Message::beginQuery(
+            dns::Question(dns::Name(qname.c_str()), qtype, dns::RRClass::IN)
+        );
+        char buffer[512];
+        char *end = query.encode(buffer, buffer + sizeof buffer);
+        queries.emplace_back(buffer, end);
+    }
+
+    size_t bytes_before = heap_bytes_in_use();
+    auto start = clock::now();
+    dns::AuthoritativeResolver resolver(zonefile);
+    auto load_time = std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - start);
+    size_t bytes = heap_bytes_in_use() - bytes_before;
+    dns::Server server(resolver);
+    struct sockaddr_in client {};
+    dns::Server::Workspace ws;
+
+    size_t rcodes[16] = {};
+    size_t dropped = 0;
+    char out[512];
+    start = clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        for (auto&& q : queries) {
+            char *end = server.handle_packet(ws, q.data(), q.data() + q.size(), out, out + sizeof out, client);
+            if (end == nullptr) {
+                dropped += 1;
+            } else {
+                rcodes[out[3] & 0xF] += 1;
+            }
+        }
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+    double nqueries = double(iterations) * queries.size();
+
+    char buffer[200];
+    snprintf(buffer, sizeof buffer, "loaded in %ld ms, %.2f MB on the heap", long(load_time.count()), bytes / 1048576.0);
+    std::cout << buffer << std::endl;
+    snprintf(buffer, sizeof buffer, "queries: %.0f, %.1f ns per query", nqueries, elapsed.count() / nqueries);
+    std::cout << buffer << std::endl;
+    snprintf(buffer, sizeof buffer, "NOERROR: %zu, NXDOMAIN: %zu, other: %zu, dropped: %zu",
+             rcodes[0], rcodes[3], size_t(nqueries) - rcodes[0] - rcodes[3] - dropped, dropped);
+    std::cout << buffer << std::endl;
+    return 0;
+}
+
+/**
+ *  Build a flood of malformed packets: a third random bytes, a third
+ *  well-formed queries with a few bytes corrupted, and a third well-formed
+ *  queries cut short.
+ */
+static std::vector<std::string> make_garbage(const std::vector<std::string>& queries, size_t count)
+{
+    std::mt19937 gen(12345);
+    auto random_byte = [&]() { return char(gen() & 0xFF); };
+    std::vector<std::string> result;
+    for (size_t i = 0; i < count; ++i) {
+        const std::string& q = queries[gen() % queries.size()];
+        std::string packet;
+        switch (i % 3) {
+            case 0:
+                packet.resize(12 + gen() % 500);
+                for (char& c : packet) c = random_byte();
+                packet[2] &= 0x7F;  // a query, not a response
+                break;
+            case 1:
+                packet = q;
+                for (int j = 0; j < 3; ++j) {
+                    packet[gen() % packet.size()] = random_byte();
+                }
+                break;
+            case 2:
+                packet = q.substr(0, gen() % q.size());
+                break;
+        }
+        result.push_back(packet);
+    }
+    return result;
+}
+
+static int bench_garbage(const std::string& zonefile, int iterations)
+{
+    using clock = std::chrono::steady_clock;
+
+    std::vector<std::string> packets = make_garbage(make_queries_from_zonefile(zonefile), 3000);
+
+    auto measure = [&](const char *label, const std::function<bool(const std::string&)>& parse) {
+        size_t rejected = 0;
+        auto start = clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            for (auto&& p : packets) {
+                rejected += !parse(p);
+            }
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+        double npackets = double(iterations) * packets.size();
+        std::cout << label << ": " << (elapsed.count() / npackets) << " ns per packet, "
+                  << (npackets * 1e3 / elapsed.count()) << " Mpps, "
+                  << (100.0 * rejected / npackets) << "% rejected" << std::endl;
+    };
+
+    // The old way: Message::decode, with failures surfacing as exceptions
+    // that the caller catches per packet.
+    dns::Message message;
+    measure("Message::decode, throwing", [&](const std::string& p) {
+        try {
+            if (message.decode(p.data(), p.data() + p.size()) == nullptr) {
+                throw dns::Exception("Failed to parse packet");
+            }
+            return true;
+        } catch (const dns::Exception&) {
+            return false;
+        }
+    });
+    measure("Message::try_decode", [&](const std::string& p) {
+        return bool(message.try_decode(p.data(), p.data() + p.size()));
+    });
+    // What the server does now: reject on the header, or in one pass
+    // over the question, with no exceptions and nothing logged.
+    dns::AuthoritativeResolver resolver(zonefile);
+    dns::Server server(resolver);
+    dns::Server::Workspace ws;
+    struct sockaddr_in client {};
+    char out[512];
+    measure("Server::handle_packet", [&](const std::string& p) {
+        uint64_t before = ws.rejects.total();
+        server.handle_packet(ws, p.data(), p.data() + p.size(), out, out + sizeof out, client);
+        return ws.rejects.total() == before;
+    });
+
+    ws.rejects = dns::Server::RejectCounts();
+    for (auto&& p : packets) {
+        server.handle_packet(ws, p.data(), p.data() + p.size(), out, out + sizeof out, client);
+    }
+    std::cout << ws.rejects.repr() << std::endl;
+    return 0;
+}
+
+/**
+ *  Build a random-subdomain ("water torture") flood: queries for random
+ *  nonexistent names under each zone apex in the zonefile.
+ */
+static std::vector<std::string> make_nxdomain_flood(const std::string& filename, size_t count)
+{
+    std::ifstream file(filename.c_str());
+    if (!file) {
+        throw dns::Exception("Could not open file: ", filename);
+    }
+    std::vector<std::string> apexes;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty()) continue;
+        dns::RR rr;
+        rr.decode_repr(line.data(), line.data() + line.size());
+        if (rr.is_SOA_record()) apexes.push_back(rr.name().repr());
+    }
+    if (apexes.empty()) {
+        throw dns::Exception("No SOA records in file: ", filename);
+    }
+    std::mt19937 gen(12345);
+    std::vector<std::string> result;
+    for (size_t i = 0; i < count; ++i) {
+        char label[13];
+        for (int j = 0; j < 12; ++j) label[j] = "abcdefghijklmnopqrstuvwxyz0123456789"[gen() % 36];
+        label[12] = '\0';
+        std::string qname = std::string(label) + "." + apexes[i % apexes.size()];
+        if (qname.size() > 2 && qname.substr(qname.size() - 2) == "..") qname.pop_back();
+        dns::Message query = dns::Message::beginQuery(
+            dns::Question(dns::Name(qname.c_str()), dns::RRType::A, dns::RRClass::IN)
+        );
+        char buffer[512];
+        char *end = query.encode(buffer, buffer + sizeof buffer);
+        result.emplace_back(buffer, end);
+    }
+    return result;
+}
+
+/**
+ *  Answer a flood of queries for nonexistent names, both the old way
+ *  (decode a Message, populate a Response, encode it) and on the server's
+ *  hot path, with and without the name filters, and compare the queries
+ *  per second.
+ */
+static int bench_nxdomain(const std::string& zonefile, int iterations)
+{
+    using clock = std::chrono::steady_clock;
+
+    // Each configuration differs from its neighbours in one thing only:
+    // walking the tree or consulting the name filter, and encoding the
+    // SOA record for each response or copying the zone's pre-encoded one.
+    struct Config {
+        const char *name;
+        bool name_filters;
+        bool negative_templates;
+    };
+    static const Config configs[] = {
+        { "tree walk, SOA encoded", false, false },
+        { "tree walk, SOA template", false, true },
+        { "name filter, SOA encoded", true, false },
+        { "name filter, SOA template", true, true },
+    };
+
+    std::vector<std::string> queries = make_nxdomain_flood(zonefile, 1000);
+    struct sockaddr_in client {};
+    char out[512];
+    double nqueries = double(iterations) * queries.size();
+    std::string expected;
+
+    dns::AuthoritativeResolver(zonefile).print_name_filters();
+    char line[100];
+    snprintf(line, sizeof line, "%-26s %11s %19s", "path", "qps", "allocations/query");
+    std::cout << line << std::endl;
+    for (auto&& config : configs) {
+        dns::ResolverOptions options;
+        options.name_filters = config.name_filters;
+        options.negative_templates = config.negative_templates;
+        dns::AuthoritativeResolver resolver(zonefile, options);
+        dns::Server server(resolver);
+        dns::Server::Workspace ws;
+
+        // Every configuration must answer every query the same way.
+        std::string responses;
+        for (auto&& q : queries) {
+            char *end = server.handle_packet(ws, q.data(), q.data() + q.size(), out, out + sizeof out, client);
+            if (end == nullptr || (end - out) < 12 || (out[3] & 0xF) != int(dns::RCode::NXDOMAIN)) {
+                exit_with_message("Expected an NXDOMAIN response");
+            }
+            responses.append(out, end);
+        }
+        if (expected.empty()) {
+            expected = responses;
+        } else if (responses != expected) {
+            exit_with_message("Responses differ between configurations");
+        }
+
+        size_t allocations_before = g_allocations;
+        auto start = clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            for (auto&& q : queries) {
+                server.handle_packet(ws, q.data(), q.data() + q.size(), out, out + sizeof out, client);
+            }
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+        size_t allocations = g_allocations - allocations_before;
+        snprintf(line, sizeof line, "%-26s %11.0f %19.2f", config.name,
+                 nqueries / (elapsed.count() * 1e-9), allocations / nqueries);
+        std::cout << line << std::endl;
+    }
+    return 0;
+}
+
+/**
+ *  Time a child lookup (one step of the tree walk) at each fan-out from
+ *  2 to 10M, against the std::map<Label, ...> the tree used to use.
+ */
+static int bench_lookup(int lookups)
+{
+    using clock = std::chrono::steady_clock;
+    struct Leaf { int value = 0; };
+
+    std::mt19937 gen(12345);
+    std::cout << "fan-out      ChildTable   std::map" << std::endl;
+    for (size_t fanout : {2, 4, 8, 16, 64, 256, 1024, 10000, 100000, 1000000, 10000000}) {
+        auto label_for = [](size_t i) {
+            char buffer[32];
+            snprintf(buffer, sizeof buffer, "Host-%zu", i);
+            return std::string(buffer);
+        };
+
+        // Look up existing children, in random order, by their folded keys.
+        std::string keys;
+        std::vector<std::pair<size_t, uint32_t>> probes;  // (offset into keys, hash)
+        std::vector<size_t> sizes;
+        for (int i = 0; i < lookups; ++i) {
+            std::string label = label_for(gen() % fanout);
+            std::string folded(label.size(), '\0');
+            uint32_t hash = dns::fold_label(label.data(), label.size(), &folded[0]);
+            probes.emplace_back(keys.size(), hash);
+            sizes.push_back(label.size());
+            keys += folded;
+        }
+
+        double table_ns;
+        {
+            dns::ChildTable<Leaf> table;
+            for (size_t i = 0; i < fanout; ++i) {
+                std::string label = label_for(i);
+                uint32_t hash = dns::fold_label(label.data(), label.size(), &label[0]);
+                table.find_or_insert(label.data(), label.size(), hash).value = 1;
+            }
+            int found = 0;
+            auto start = clock::now();
+            for (int i = 0; i < lookups; ++i) {
+                found += table.find(keys.data() + probes[i].first, sizes[i], probes[i].second)->value;
+            }
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+            if (found != lookups) exit_with_message("ChildTable lookup failed");
+            table_ns = double(elapsed.count()) / lookups;
+        }
+
+        double map_ns = -1;
+        if (fanout <= 1000000) {
+            std::map<dns::Label, Leaf> map;
+            for (size_t i = 0; i < fanout; ++i) {
+                map[dns::Label(label_for(i))].value = 1;
+            }
+            std::vector<dns::Label> labels;
+            for (int i = 0; i < lookups; ++i) {
+                labels.emplace_back(keys.substr(probes[i].first, sizes[i]));
+            }
+            int found = 0;
+            auto start = clock::now();
+            for (auto&& label : labels) {
+                found += map.find(label)->second.value;
+            }
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+            if (found != lookups) exit_with_message("std::map lookup failed");
+            map_ns = double(elapsed.count()) / lookups;
+        }
+
+        char line[100];
+        snprintf(line, sizeof line, "%-10zu %9.1f ns", fanout, table_ns);
+        std::cout << line;
+        if (map_ns >= 0) {
+            snprintf(line, sizeof line, " %9.1f ns", map_ns);
+            std::cout << line;
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
+
+/**
+ *  Check that every case-folding kernel this CPU supports agrees exactly
+ *  with the scalar one, for every octet value at the head, middle and
+ *  tail of every label length and of longer runs up to a whole name's
+ *  length; then time each of them.
+ */
+static int bench_casefold(int iterations)
+{
+    using clock = std::chrono::steady_clock;
+    auto kernels = dns::supported_casefold_kernels();
+    const dns::CaseFoldKernel& scalar = *kernels.front();
+
+    // Each label ends at a page boundary, so the kernels can't simply
+    // read a whole register past it.
+    alignas(4096) static char pages[2 * 4096];
+    std::mt19937 gen(12345);
+    char fa[255], fb[255];
+    int mismatches = 0;
+    for (auto&& k : kernels) {
+        for (size_t n = 1; n <= 255; n += (n < 63) ? 1 : 16) {
+            char *a = pages + 4096 - n;
+            char *b = pages + 2 * 4096 - n;
+            for (size_t p : {size_t(0), n / 2, n - 1}) {
+                for (int x = 0; x < 256; ++x) {
+                    for (size_t i = 0; i < n; ++i) a[i] = char(gen());
+                    a[p] = char(x);
+                    if (k->fold_label(a, n, fa) != scalar.fold_label(a, n, fb) || memcmp(fa, fb, n) != 0) {
+                        mismatches += 1;
+                    }
+                    for (int y = 0; y < 256; ++y) {
+                        memcpy(b, a, n);
+                        b[p] = char(y);
+                        if (k->equal(a, b, n) != scalar.equal(a, b, n) ||
+                            k->compare(a, b, n) != scalar.compare(a, b, n)) {
+                            mismatches += 1;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    if (mismatches != 0) {
+        std::cout << mismatches << " results differ from the scalar kernel" << std::endl;
+        return 1;
+    }
+    std::cout << "all kernels agree with the scalar kernel on every octet value" << std::endl;
+
+    // Labels of realistic lengths, compared against case-flipped copies of themselves.
+    std::vector<std::string> labels, flipped;
+    for (int i = 0; i < 1024; ++i) {
+        std::string label(1 + gen() % 20, '\0');
+        for (auto&& ch : label) ch = "abcdefghijklmnopqrstuvwxyz0123456789-"[gen() % 37];
+        labels.push_back(label);
+        for (auto&& ch : label) ch = dns::ascii_toupper(ch);
+        flipped.push_back(label);
+    }
+    std::cout << "kernel       fold+hash      equal    compare" << std::endl;
+    for (auto&& k : kernels) {
+        double ns[3];
+        for (int which = 0; which < 3; ++which) {
+            uint32_t sink = 0;
+            auto start = clock::now();
+            for (int it = 0; it < iterations; ++it) {
+                for (size_t i = 0; i < labels.size(); ++i) {
+                    const std::string& x = labels[i];
+                    const std::string& y = flipped[i];
+                    if (which == 0) sink += k->fold_label(x.data(), x.size(), fa);
+                    if (which == 1) sink += k->equal(x.data(), y.data(), x.size());
+                    if (which == 2) sink += k->compare(x.data(), y.data(), x.size());
+                }
+            }
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+            ns[which] = double(elapsed.count()) / (double(iterations) * labels.size());
+            if (sink == 1) std::cout << "";  // keep the loop from being optimized away
+        }
+        char line[100];
+        snprintf(line, sizeof line, "%-8s %9.1f ns %7.1f ns %7.1f ns%s", k->name, ns[0], ns[1], ns[2],
+                 (k == &dns::casefold_kernel()) ? "  (in use)" : "");
+        std::cout << line << std::endl;
+    }
+    return 0;
+}
+
+/**
+ *  Find exact matches among `names` owner names with the resolver itself,
+ *  loaded once with its perfect hash over the owner names and once
+ *  without (so that every lookup walks the tree), and compare the time
+ *  per query. Both answer the same queries, each parsed by a QueryView
+ *  just as the server does.
+ */
+static int bench_exact(size_t names, int lookups)
+{
+    using clock = std::chrono::steady_clock;
+
+    // host-<i>.d<i % 1000>.example., one A record each.
+    auto make_name = [](size_t i) {
+        char buffer[64];
+        snprintf(buffer, sizeof buffer, "host-%zu.d%zu.example.", i, i % 1000);
+        return std::string(buffer);
+    };
+
+    char zonefile[] = "/tmp/dns-bench-exact-XXXXXX";
+    int fd = mkstemp(zonefile);
+    FILE *zone = (fd == -1) ? nullptr : fdopen(fd, "w");
+    if (zone == nullptr) {
+        exit_with_message("Could not create a temporary zone file");
+    }
+    std::cout << "writing " << names << " names to " << zonefile << "..." << std::endl;
+    fprintf(zone, "example. 3600 IN SOA ns.example. hostmaster.example. 1 3600 900 604800 300\n");
+    fprintf(zone, "example. 3600 IN NS ns.example.\n");
+    for (size_t i = 0; i < names; ++i) {
+        fprintf(zone, "%s 3600 IN A 10.%zu.%zu.%zu\n", make_name(i).c_str(), (i >> 16) & 0xFF, (i >> 8) & 0xFF, i & 0xFF);
+    }
+    if (fclose(zone) != 0) {
+        unlink(zonefile);
+        exit_with_message("Could not write the temporary zone file");
+    }
+
+    std::mt19937 gen(12345);
+    std::vector<std::string> queries;
+    for (int i = 0; i < lookups; ++i) {
+        dns::Message query = dns::Message::beginQuery(
+            dns::Question(dns::Name(make_name(gen() % names).c_str()), dns::RRType::A, dns::RRClass::IN)
+        );
+        char buffer[512];
+        char *end = query.encode(buffer, buffer + sizeof buffer);
+        queries.emplace_back(buffer, end);
+    }
+
+    double ns[2];
+    for (int which = 0; which < 2; ++which) {
+        dns::ResolverOptions options;
+        options.exact_index = (which == 1);
+        auto start = clock::now();
+        dns::AuthoritativeResolver resolver(zonefile, options);
+        double load_s = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count() * 1e-9;
+
+        dns::QueryView view;
+        char out[512];
+        int found = 0;
+        start = clock::now();
+        for (auto&& q : queries) {
+            view.parse(q.data(), q.data() + q.size());
+            dns::ResponseWriter response(view, out, out + sizeof out);
+            resolver.populate_response(view, response);
+            found += (response.rcode() == dns::RCode::NOERROR && response.answer_count() == 1);
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+        if (found != lookups) {
+            unlink(zonefile);
+            exit_with_message("Exact lookup failed");
+        }
+        ns[which] = double(elapsed.count()) / lookups;
+        char line[120];
+        snprintf(line, sizeof line, "%s: loaded in %.2f s, %7.1f ns per query",
+                 (which == 0) ? "tree walk   " : "perfect hash", load_s, ns[which]);
+        std::cout << line << std::endl;
+    }
+    unlink(zonefile);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if ((argc == 2 || argc == 3) && strcmp(argv[1], "lookup") == 0) {
+        return bench_lookup((argc == 3) ? atoi(argv[2]) : 1000000);
+    }
+    if ((argc == 2 || argc == 3) && strcmp(argv[1], "casefold") == 0) {
+        return bench_casefold((argc == 3) ? atoi(argv[2]) : 10000);
+    }
+    if ((argc == 2 || argc == 3) && strcmp(argv[1], "exact") == 0) {
+        return bench_exact((argc == 3) ? atol(argv[2]) : 1000000, 1000000);
+    }
+    if ((argc == 4 || argc == 5) && strcmp(argv[1], "replay") == 0) {
+        try {
+            return bench_replay(argv[2], argv[3], (argc == 5) ? atoi(argv[4]) : 1);
+        } catch (const std::exception& e) {
+            exit_with_message(e.what());
+        }
+    }
+    if (argc != 3 && argc != 4) {
+        exit_with_message(
+            "Usage: dns-bench <benchmark> <zonefile> [<iterations>]\n"
+            "       dns-bench replay <zonefile> <queryfile> [<iterations>]\n"
+            "       dns-bench lookup [<lookups>]\n"
+            "       dns-bench casefold [<iterations>]\n"
+            "       dns-bench exact [<names>]\n"
+            "Benchmarks:\n"
+            "  allocs    heap allocations and time per query on the server's hot path;\n"
+            "            exits with status 1 if any allocations happen in steady state\n"
+            "  garbage   throughput of rejecting malformed packets, old decoders and the server\n"
+            "  nxdomain  queries per second answering a random-subdomain flood, with and without\n"
+            "            the name filters and the pre-encoded SOA records;\n"
+            "            exits with status 1 if any response differs\n"
+            "  lookup    time per child lookup in the domain tree, for fan-outs from 2 to 10M\n"
+            "  casefold  check the SIMD case-folding kernels against the scalar one, and time them;\n"
+            "            exits with status 1 if any result differs\n"
+            "  exact     time per query for exact matches among 1M names, tree walk vs. perfect hash\n"
+            "  names     sizeof(Name), allocations per decoded packet, and the heap a zone takes,\n"
+            "            with and without interning\n"
+            "  compact   heap, load time and time per query, default layout vs. compact storage;\n"
+            "            exits with status 1 if any response differs\n"
+            "  reverse   heap, load time and time per query, PTR records in the tree vs. the reverse\n"
+            "            index; exits with status 1 if any response differs\n"
+            "  records   time to parse and to print each record of the zone file;\n"
+            "            exits with status 1 if any record doesn't read back as printed\n"
+            "  replay    load time, heap and time per query for a query file, such as dns-gen writes\n"
+            "  stages    the cost of stage tracing on the hot path, and the time of each stage\n"
+            "Example: dns-bench allocs zone.txt 10000\n"
+        );
+    }
+
+    std::string benchmark = argv[1];
+    std::string zonefile = argv[2];
+    int iterations = (argc == 4) ? atoi(argv[3]) : 10000;
+
+    try {
+        if (benchmark == "allocs") {
+            return bench_allocs(zonefile, iterations);
+        } else if (benchmark == "garbage") {
+            return bench_garbage(zonefile, iterations);
+        } else if (benchmark == "nxdomain") {
+            return bench_nxdomain(zonefile, iterations);
+        } else if (benchmark == "names") {
+            return bench_names(zonefile, iterations);
+        } else if (benchmark == "compact") {
+            return bench_compact(zonefile, iterations);
+        } else if (benchmark == "reverse") {
+            return bench_reverse(zonefile, iterations);
+        } else if (benchmark == "records") {
+            return bench_records(zonefile, iterations);
+        } else if (benchmark == "stages") {
+            return bench_stages(zonefile, iterations);
+        } else {
+            exit_with_message("Error: Unknown benchmark.\n");
+        }
+    } catch (const std::exception& e) {
+        exit_with_message(e.what());
+    }
+}
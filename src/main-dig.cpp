@@ -1,14 +1,28 @@
 
+#include "async-client.h"
+#include "cache.h"
+#include "exception.h"
 #include "message.h"
 #include "nonstd.h"
 #include "question.h"
 #include "rrtype.h"
 #include "stub-resolver.h"
+#include "upstream.h"
 
+#include <algorithm>
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <poll.h>
+#include <sstream>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <string.h>
 #include <thread>
+#include <time.h>
+#include <vector>
 
 void exit_with_message(const char *msg)
 {
@@ -16,44 +30,217 @@ void exit_with_message(const char *msg)
     exit(1);
 }
 
+static std::string format_msec(nonstd::microseconds us)
+{
+    char buffer[32];
+    snprintf(buffer, sizeof buffer, "%.3f", us.count() / 1000.0);
+    return buffer;
+}
+
+static std::string current_time_repr()
+{
+    char buffer[64];
+    time_t now = time(nullptr);
+    strftime(buffer, sizeof buffer, "%a %b %d %H:%M:%S %Z %Y", localtime(&now));
+    return buffer;
+}
+
+static int run_single_query(int port, const std::string& qname_str, const std::string& qtype_str)
+{
+    dns::StubResolver stubresolver(
+        dns::Upstream("127.0.0.1", port)
+    );
+
+    dns::Name qname(qname_str.c_str());
+    dns::RRType qtype(qtype_str);
+    dns::Question question(qname, qtype, dns::RRClass::IN);
+    dns::Message query = dns::Message::beginQuery(std::move(question));
+
+    // Here is where we'd set the query-id or the RD bit, if we wanted to do that.
+    query.setRD(true);
+
+    dns::StubResolver::Reply reply = stubresolver.async_query(query, nonstd::seconds(1)).get();
+
+    std::cout << reply.message.repr() << std::endl;
+    std::cout << ";; Query time: " << format_msec(reply.rtt) << " msec\n" << std::endl;
+    std::cout << ";; SERVER: 127.0.0.1#" << port << "(127.0.0.1)" << std::endl;
+    std::cout << ";; WHEN: " << current_time_repr() << std::endl;
+    std::cout << ";; MSG SIZE  rcvd: " << reply.bytes_received << std::endl;
+    std::cout << std::endl;
+    return 0;
+}
+
+/**
+ *  Read "<qname> [<qtype>]" lines, keep up to `concurrency` queries in
+ *  flight on a single socket, and print one line per query as its
+ *  response arrives, followed by a summary. Repeated questions are
+ *  answered from a @ref Cache while their responses are fresh.
+ */
+static int run_batch(int port, std::istream& in, int concurrency)
+{
+    using clock = std::chrono::steady_clock;
+    const auto timeout = nonstd::seconds(2);
+
+    struct Outstanding {
+        std::string qname;
+        std::string qtype;
+        dns::Question question;
+    };
+
+    dns::AsyncClient client(dns::Upstream("127.0.0.1", port));
+    dns::Cache cache;
+    std::map<uint16_t, Outstanding> outstanding;
+    std::map<std::string, int> rcode_counts;
+    std::vector<nonstd::microseconds> rtts;
+    size_t bytes_received = 0;
+    int sent = 0;
+    int cached = 0;
+    int timeouts = 0;
+    int errors = 0;
+    bool more_input = true;
+    auto start = clock::now();
+
+    while (more_input || !outstanding.empty()) {
+        while (more_input && client.in_flight() < concurrency) {
+            std::string line;
+            if (!std::getline(in, line)) {
+                more_input = false;
+                break;
+            }
+            std::istringstream fields(line);
+            Outstanding o;
+            if (!(fields >> o.qname) || o.qname[0] == '#' || o.qname[0] == ';') {
+                continue;
+            }
+            if (!(fields >> o.qtype)) {
+                o.qtype = "A";
+            }
+            uint16_t tag;
+            try {
+                o.question = dns::Question(dns::Name(o.qname.c_str()), dns::RRType(o.qtype), dns::RRClass::IN);
+                std::string wire;
+                dns::Message response;
+                if (cache.lookup(o.question, wire)) {
+                    if (response.try_decode(wire.data(), wire.data() + wire.size())) {
+                        std::cout << o.qname << " " << o.qtype << " " << response.rcode().repr()
+                                  << " ANSWER: " << response.answers().size()
+                                  << " rcvd: " << wire.size() << " cached" << std::endl;
+                        rcode_counts[response.rcode().repr()] += 1;
+                        cached += 1;
+                        continue;
+                    }
+                    cache.evict(o.question);
+                }
+                if (!client.send(o.question, true, tag)) {
+                    throw dns::Exception("send failed");
+                }
+            } catch (const std::exception& e) {
+                std::cout << o.qname << " " << o.qtype << " ERROR " << e.what() << std::endl;
+                errors += 1;
+                continue;
+            }
+            outstanding[tag] = std::move(o);
+            sent += 1;
+        }
+
+        if (outstanding.empty()) {
+            continue;
+        }
+        struct pollfd pfd = { client.fd(), POLLIN, 0 };
+        poll(&pfd, 1, client.next_timeout_ms(timeout));
+
+        dns::AsyncClient::Reply r;
+        while (client.receive(r)) {
+            auto it = outstanding.find(r.tag);
+            auto rtt = std::chrono::duration_cast<nonstd::microseconds>(r.rtt);
+            dns::Message response;
+            dns::DecodeResult result = response.try_decode(r.packet, r.end);
+            std::string status = result ? response.rcode().repr() : "MALFORMED(" + result.error().repr() + ")";
+            if (result) {
+                cache.insert(it->second.question, response, r.packet, r.end);
+            }
+            std::cout << it->second.qname << " " << it->second.qtype << " " << status
+                      << " ANSWER: " << response.answers().size()
+                      << " rcvd: " << (r.end - r.packet)
+                      << " time: " << format_msec(rtt) << " msec" << std::endl;
+            rcode_counts[status] += 1;
+            rtts.push_back(rtt);
+            bytes_received += (r.end - r.packet);
+            outstanding.erase(it);
+        }
+        for (uint16_t tag : client.expire(timeout)) {
+            auto it = outstanding.find(tag);
+            std::cout << it->second.qname << " " << it->second.qtype << " TIMEOUT" << std::endl;
+            timeouts += 1;
+            outstanding.erase(it);
+        }
+    }
+
+    auto elapsed = std::chrono::duration_cast<nonstd::microseconds>(clock::now() - start);
+    std::sort(rtts.begin(), rtts.end());
+    auto percentile = [&](double p) {
+        return rtts.empty() ? nonstd::microseconds(0) : rtts[std::min<size_t>(rtts.size() - 1, p * rtts.size())];
+    };
+    nonstd::microseconds total(0);
+    for (auto&& rtt : rtts) total += rtt;
+
+    std::cout << "\n;; SUMMARY: " << sent << " queries sent, " << rtts.size() << " answered, "
+              << timeouts << " timed out, " << errors << " not sent, "
+              << cached << " answered from cache" << std::endl;
+    for (auto&& kv : rcode_counts) {
+        std::cout << ";;   " << kv.first << ": " << kv.second << std::endl;
+    }
+    if (!rtts.empty()) {
+        std::cout << ";; RTT (msec): min " << format_msec(rtts.front())
+                  << ", avg " << format_msec(total / rtts.size())
+                  << ", p50 " << format_msec(percentile(0.50))
+                  << ", p99 " << format_msec(percentile(0.99))
+                  << ", max " << format_msec(rtts.back()) << std::endl;
+    }
+    std::cout << ";; MSG SIZE  rcvd: " << bytes_received << " bytes total" << std::endl;
+    std::cout << ";; Elapsed: " << format_msec(elapsed) << " msec, "
+              << int(rtts.size() / std::max(elapsed.count() / 1e6, 1e-6)) << " queries/sec" << std::endl;
+    std::cout << cache.stats().repr() << std::endl;
+    return (timeouts == 0 && errors == 0) ? 0 : 1;
+}
+
 int main(int argc, char **argv)
 {
-    if (argc != 4) {
+    bool batch = (argc == 4 || argc == 5) && strcmp(argv[2], "-f") == 0;
+    if (argc != 4 && !batch) {
         exit_with_message(
             "Usage: dns-dig <port> <qname> <qtype>\n"
+            "       dns-dig <port> -f <file> [<concurrency>]\n"
             "Example: dns-dig 9000 google.com. A\n"
+            "Example: dns-dig 9000 -f names.txt 100\n"
+            "In batch mode, <file> contains one \"<qname> [<qtype>]\" per line; use - for stdin.\n"
         );
     }
 
     int port = atoi(argv[1]);
-    std::string qname_str = argv[2];
-    std::string qtype_str = argv[3];
 
     if (port < 1 || port > 65535) {
         exit_with_message("Error: Invalid port number.\n");
     }
 
     try {
-        dns::StubResolver stubresolver(
-            dns::Upstream("127.0.0.1", port)
-        );
-
-        dns::Name qname(qname_str.c_str());
-        dns::RRType qtype(qtype_str);
-        dns::Question question(qname, qtype, dns::RRClass::IN);
-        dns::Message query = dns::Message::beginQuery(std::move(question));
-
-        // Here is where we'd set the query-id or the RD bit, if we wanted to do that.
-        query.setRD(true);
-
-        dns::Message response = stubresolver.async_resolve(query, nonstd::seconds(1)).get();
-
-        std::cout << response.repr() << std::endl;
-        std::cout << ";; Query time: <FAKE>msec\n" << std::endl;
-        std::cout << ";; SERVER: 127.0.0.1#" << port << "(127.0.0.1)" << std::endl;
-        std::cout << ";; WHEN: <FAKE>" << std::endl;
-        std::cout << ";; MSG SIZE  rcvd: <FAKE>" << std::endl;
-        std::cout << std::endl;
+        if (batch) {
+            std::string filename = argv[3];
+            int concurrency = (argc == 5) ? atoi(argv[4]) : 100;
+            if (concurrency < 1) {
+                exit_with_message("Error: Invalid concurrency limit.\n");
+            }
+            if (filename == "-") {
+                return run_batch(port, std::cin, concurrency);
+            }
+            std::ifstream file(filename.c_str());
+            if (!file) {
+                throw dns::Exception("Could not open file: ", filename);
+            }
+            return run_batch(port, file, concurrency);
+        } else {
+            return run_single_query(port, argv[2], argv[3]);
+        }
     } catch (const std::exception& e) {
         exit_with_message(e.what());
     }
@@ -0,0 +1,137 @@
+
+#include "zone-generator.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <vector>
+
+void exit_with_message(const char *msg)
+{
+    std::cerr << msg << std::endl;
+    exit(1);
+}
+
+static const char usage[] =
+    "Usage: dns-gen [<options>] <zonefile> [<queryfile>]\n"
+    "  --origin <name>        the zone's apex (default gen.example.)\n"
+    "  --records <n>          about how many records to write (default 100000)\n"
+    "  --depth <n>            levels of names below the apex (default 3)\n"
+    "  --fanout uniform|<s>   pick each name's parent uniformly from the level above,\n"
+    "                         or with Zipf popularity of exponent s (default uniform)\n"
+    "  --wildcards <f>        fraction of names owning a wildcard (default 0.01)\n"
+    "  --delegations <f>      fraction of names delegated, with glue (default 0.05)\n"
+    "  --types <t>:<w>,...    RR types of the other names, by weight, from A, AAAA, MX,\n"
+    "                         TXT and CNAME (default A:60,AAAA:15,MX:5,TXT:10,CNAME:10)\n"
+    "  --queries <n>          how many queries to write (default 100000)\n"
+    "  --zipf <s>             exponent of the queried names' popularity (default 1.0)\n"
+    "  --nxdomain <f>         fraction of queries for nonexistent names (default 0.1)\n"
+    "  --seed <n>             the same seed and options always make the same output (default 1)\n"
+    "Either file may be - for standard output.\n"
+    "Example: dns-gen --records 1000000 --depth 4 --fanout 1.2 big.txt queries.txt\n";
+
+static std::vector<std::pair<std::string, double>> parse_types(const char *arg)
+{
+    std::vector<std::pair<std::string, double>> result;
+    std::string s = arg;
+    size_t start = 0;
+    while (start <= s.size()) {
+        size_t comma = std::min(s.find(',', start), s.size());
+        std::string item = s.substr(start, comma - start);
+        size_t colon = item.find(':');
+        if (colon == std::string::npos) {
+            exit_with_message("Error: Types must be given as <type>:<weight>,...\n");
+        }
+        result.emplace_back(item.substr(0, colon), atof(item.c_str() + colon + 1));
+        start = comma + 1;
+    }
+    return result;
+}
+
+static FILE *open_output(const char *filename)
+{
+    FILE *f = (strcmp(filename, "-") == 0) ? stdout : fopen(filename, "w");
+    if (f == nullptr) {
+        std::cerr << "Error: Could not open file: " << filename << std::endl;
+        exit(1);
+    }
+    static char buffers[2][1 << 20];
+    static int n = 0;
+    setvbuf(f, buffers[n++], _IOFBF, sizeof buffers[0]);
+    return f;
+}
+
+static void close_output(FILE *f, const char *filename)
+{
+    if (fflush(f) != 0 || (f != stdout && fclose(f) != 0)) {
+        std::cerr << "Error: Could not write file: " << filename << std::endl;
+        exit(1);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    dns::GeneratorOptions options;
+    uint64_t queries = 100000;
+    while (argc >= 3 && strncmp(argv[1], "--", 2) == 0) {
+        const char *opt = argv[1];
+        const char *arg = argv[2];
+        if (strcmp(opt, "--origin") == 0) {
+            options.origin = arg;
+        } else if (strcmp(opt, "--records") == 0) {
+            options.records = strtoull(arg, nullptr, 10);
+        } else if (strcmp(opt, "--depth") == 0) {
+            options.depth = atoi(arg);
+        } else if (strcmp(opt, "--fanout") == 0) {
+            options.zipf_fanout = (strcmp(arg, "uniform") != 0);
+            if (options.zipf_fanout) options.fanout_skew = atof(arg);
+        } else if (strcmp(opt, "--wildcards") == 0) {
+            options.wildcard_fraction = atof(arg);
+        } else if (strcmp(opt, "--delegations") == 0) {
+            options.delegation_fraction = atof(arg);
+        } else if (strcmp(opt, "--types") == 0) {
+            options.types = parse_types(arg);
+        } else if (strcmp(opt, "--queries") == 0) {
+            queries = strtoull(arg, nullptr, 10);
+        } else if (strcmp(opt, "--zipf") == 0) {
+            options.query_skew = atof(arg);
+        } else if (strcmp(opt, "--nxdomain") == 0) {
+            options.nxdomain_fraction = atof(arg);
+        } else if (strcmp(opt, "--seed") == 0) {
+            options.seed = strtoull(arg, nullptr, 10);
+        } else {
+            exit_with_message(usage);
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc != 2 && argc != 3) {
+        exit_with_message(usage);
+    }
+
+    try {
+        dns::ZoneGenerator generator(options);
+        FILE *zone = open_output(argv[1]);
+        uint64_t records = generator.write_zone(zone);
+        close_output(zone, argv[1]);
+        fprintf(stderr, "wrote %llu records for %llu names, in levels of",
+                (unsigned long long)records, (unsigned long long)generator.names());
+        for (int level = 1; level <= generator.levels(); ++level) {
+            fprintf(stderr, " %llu", (unsigned long long)generator.level_size(level));
+        }
+        fprintf(stderr, "\n");
+
+        if (argc == 3) {
+            FILE *out = open_output(argv[2]);
+            uint64_t nxdomains = generator.write_queries(out, queries);
+            close_output(out, argv[2]);
+            fprintf(stderr, "wrote %llu queries, %llu of them for nonexistent names\n",
+                    (unsigned long long)queries, (unsigned long long)nxdomains);
+        }
+    } catch (const std::exception& e) {
+        exit_with_message(e.what());
+    }
+}
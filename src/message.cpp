@@ -4,16 +4,31 @@
 #include "opcode.h"
 #include "rcode.h"
 
-#include <stdlib.h>
+#include <chrono>
+#include <random>
 #include <string>
 #include <utility>
 
 using namespace dns;
 
+static uint16_t random_query_id() noexcept
+{
+    // An unpredictable ID is what stops an off-path attacker from forging
+    // the reply, so seed from the OS; rand() would give the same IDs on every run.
+    static thread_local std::mt19937 gen = []() {
+        try {
+            return std::mt19937(std::random_device()());
+        } catch (...) {
+            return std::mt19937(uint32_t(std::chrono::steady_clock::now().time_since_epoch().count()));
+        }
+    }();
+    return uint16_t(gen());
+}
+
 Message Message::beginQuery(Question question) noexcept
 {
     Message query;
-    query.setID(rand());
+    query.setID(random_query_id());
     query.setOpcode(Opcode::QUERY);
     query.setQR(false);
     query.add_question(std::move(question));
@@ -23,16 +38,47 @@ Message Message::beginQuery(Question question) noexcept
 Message Message::beginResponseTo(const Message& query) noexcept
 {
     Message response;
-    response.m_id = query.m_id;
-    response.m_qr = true;
-    response.m_opcode = query.m_opcode;
-    response.m_rd = query.m_rd;
+    response.resetAsResponseTo(query);
     return response;
 }
 
+Message& Message::resetAsResponseTo(const Message& query) noexcept
+{
+    clear();
+    m_id = query.m_id;
+    m_qr = true;
+    m_opcode = query.m_opcode;
+    m_rd = query.m_rd;
+    return *this;
+}
+
+void Message::clear() noexcept
+{
+    m_id = 0;
+    m_qr = false;
+    m_opcode = Opcode::QUERY;
+    m_aa = false;
+    m_tc = false;
+    m_rd = false;
+    m_ra = false;
+    m_rcode = RCode::NOERROR;
+    m_symbol_table.clear();
+    m_question.clear();
+    m_answer.clear();
+    m_authority.clear();
+    m_additional.clear();
+}
+
 const char *Message::decode(const char *packet_start, const char *end)
+{
+    DecodeResult result = try_decode(packet_start, end);
+    return result ? *result : nullptr;
+}
+
+DecodeResult Message::try_decode(const char *packet_start, const char *end)
 {
     const char *src = packet_start;
+    clear();
 
     uint16_t fields;
     uint16_t qdcount, ancount, nscount, arcount;
@@ -44,7 +90,13 @@ const char *Message::decode(const char *packet_start, const char *end)
     src = get16bits(src, end, nscount);
     src = get16bits(src, end, arcount);
 
-    if (src == nullptr) return nullptr;
+    if (src == nullptr) return decode_error(DecodeError::TRUNCATED);
+
+    // Every question takes at least 5 bytes and every RR at least 11, so
+    // reject counts the packet can't possibly hold before decoding anything.
+    if (qdcount * 5 + (ancount + nscount + arcount) * 11 > (end - src)) {
+        return decode_error(DecodeError::TRUNCATED);
+    }
 
     m_qr = ((fields >> 15) & 0x1);
     m_opcode = static_cast<Opcode>((fields >> 11) & 0xF);
@@ -54,30 +106,33 @@ const char *Message::decode(const char *packet_start, const char *end)
     m_ra = ((fields >> 7) & 0x1);
     m_rcode = static_cast<RCode>((fields >> 0) & 0xF);
 
-    // Now, before parsing any other names, build a "symbol table"
-    // consisting of all the names that could possibly be encoded
-    // in this packet's bytes.
+    // Now, before parsing any names, keep a copy of the packet through
+    // which compression pointers (including those in RDATA) can be followed.
     m_symbol_table.build(packet_start, end);
 
     for (uint16_t i=0; i < qdcount; ++i) {
         m_question.emplace_back();
-        src = m_question.back().decode(m_symbol_table, src, end);
-        if (src == nullptr) return nullptr;
+        DecodeResult result = m_question.back().try_decode(m_symbol_table, src, end);
+        if (!result) return result;
+        src = *result;
     }
     for (uint16_t i=0; i < ancount; ++i) {
         m_answer.emplace_back();
-        src = m_answer.back().decode(m_symbol_table, src, end);
-        if (src == nullptr) return nullptr;
+        DecodeResult result = m_answer.back().try_decode(m_symbol_table, src, end);
+        if (!result) return result;
+        src = *result;
     }
     for (uint16_t i=0; i < nscount; ++i) {
         m_authority.emplace_back();
-        src = m_authority.back().decode(m_symbol_table, src, end);
-        if (src == nullptr) return nullptr;
+        DecodeResult result = m_authority.back().try_decode(m_symbol_table, src, end);
+        if (!result) return result;
+        src = *result;
     }
     for (uint16_t i=0; i < arcount; ++i) {
         m_additional.emplace_back();
-        src = m_additional.back().decode(m_symbol_table, src, end);
-        if (src == nullptr) return nullptr;
+        DecodeResult result = m_additional.back().try_decode(m_symbol_table, src, end);
+        if (!result) return result;
+        src = *result;
     }
     return src;
 }
@@ -142,6 +197,18 @@ std::string Message::repr() const
         result += ";; WARNING: recursion requested but not available\n";
     }
 
+    for (auto&& rr : m_additional) {
+        if (rr.rrtype() == RRType::OPT) {
+            // RFC 6891, section 6.1.3: the OPT record's CLASS and TTL are
+            // really the UDP payload size, extended RCODE, version, and flags.
+            result += "\n;; OPT PSEUDOSECTION:\n";
+            result += "; EDNS: version: " + std::to_string((rr.ttl() >> 16) & 0xFF);
+            result += ", flags:";
+            if ((rr.ttl() >> 15) & 0x1) result += " do";
+            result += "; udp: " + std::to_string(int(rr.rrclass())) + "\n";
+        }
+    }
+
     if (!m_question.empty()) {
         result += "\n;; QUESTION SECTION:\n";
         for (auto&& q : m_question) {
@@ -163,11 +230,14 @@ std::string Message::repr() const
         }
     }
 
-    if (!m_additional.empty()) {
-        result += "\n;; AUTHORITY SECTION:\n";
-        for (auto&& rr : m_additional) {
-            result += rr.repr(m_symbol_table) + "\n";
+    bool printed_header = false;
+    for (auto&& rr : m_additional) {
+        if (rr.rrtype() == RRType::OPT) continue;
+        if (!printed_header) {
+            result += "\n;; ADDITIONAL SECTION:\n";
+            printed_header = true;
         }
+        result += rr.repr(m_symbol_table) + "\n";
     }
 
     return result;
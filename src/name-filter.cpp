@@ -0,0 +1,69 @@
+
+#include "name-filter.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace dns;
+
+// The name hashes combine label hashes arithmetically, so spread their
+// bits out before using them (this is MurmurHash3's 64-bit finalizer).
+static uint64_t mix(uint32_t hash)
+{
+    uint64_t h = hash;
+    h ^= (h >> 33);
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= (h >> 33);
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= (h >> 33);
+    return h;
+}
+
+// One odd multiplier per word of a block, to pick each word's bit.
+static const uint32_t salt[8] = {
+    0x47B6137Bu, 0x44974D91u, 0x8824AD5Bu, 0xA2B7289Du,
+    0x705495C7u, 0x2DF1424Bu, 0x9EFC4947u, 0x5C6BFB31u,
+};
+
+NameFilter::NameFilter(const std::vector<uint32_t>& hashes, int bits_per_name) :
+    m_size(hashes.size())
+{
+    m_blocks = std::max<size_t>(1, (hashes.size() * bits_per_name + 511) / 512);
+    m_words.assign(m_blocks * 8, 0);
+    for (uint32_t hash : hashes) {
+        uint64_t h = mix(hash);
+        uint64_t *block = &m_words[8 * (((h >> 32) * m_blocks) >> 32)];
+        for (int j = 0; j < 8; ++j) {
+            block[j] |= uint64_t(1) << ((uint32_t(h) * salt[j]) >> 26);
+        }
+    }
+}
+
+bool NameFilter::may_contain(uint32_t hash) const noexcept
+{
+    uint64_t h = mix(hash);
+    const uint64_t *block = &m_words[8 * (((h >> 32) * m_blocks) >> 32)];
+    for (int j = 0; j < 8; ++j) {
+        if (!((block[j] >> ((uint32_t(h) * salt[j]) >> 26)) & 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+double NameFilter::measure_false_positive_rate(const std::vector<uint32_t>& hashes, size_t probes) const
+{
+    std::vector<uint32_t> members(hashes);
+    std::sort(members.begin(), members.end());
+    std::mt19937 gen(12345);
+    size_t tried = 0;
+    size_t passed = 0;
+    while (tried < probes) {
+        uint32_t hash = gen();
+        if (std::binary_search(members.begin(), members.end(), hash)) continue;
+        tried += 1;
+        passed += may_contain(hash);
+    }
+    return (probes == 0) ? 0.0 : double(passed) / double(probes);
+}
@@ -1,9 +1,13 @@
 
+#include "casefold.h"
 #include "exception.h"
 #include "name.h"
 #include "symboltable.h"
 
 #include <algorithm>
+#include <mutex>
+#include <unordered_set>
+#include <utility>
 #include <assert.h>
 #include <ctype.h>
 #include <string>
@@ -16,21 +20,15 @@ bool Label::operator==(const Label& rhs) const noexcept
     if (m_str.size() != rhs.m_str.size()) {
         return false;
     }
-    for (int i = 0; i < m_str.size(); ++i) {
-        if (toupper(m_str[i]) != toupper(rhs.m_str[i])) {
-            return false;
-        }
-    }
-    return true;
+    return equal_ignoring_case(m_str.data(), rhs.m_str.data(), m_str.size());
 }
 
 bool Label::operator<(const Label& rhs) const noexcept
 {
-    int n = std::min(m_str.size(), rhs.m_str.size());
-    for (int i = 0; i < n; ++i) {
-        if (toupper(m_str[i]) != toupper(rhs.m_str[i])) {
-            return (toupper(m_str[i]) < toupper(rhs.m_str[i]));
-        }
+    size_t n = std::min(m_str.size(), rhs.m_str.size());
+    int cmp = compare_ignoring_case(m_str.data(), rhs.m_str.data(), n);
+    if (cmp != 0) {
+        return (cmp < 0);
     }
     return n < rhs.m_str.size();
 }
@@ -43,7 +41,7 @@ static bool can_appear_unquoted_in_label(char ch)
     }
 }
 
-Name::Name(const char *repr)
+Name::Name(const char *repr) : Name()
 {
     const char *end = strchr(repr, '\0');
     const char *parsed = decode_repr(repr, end);
@@ -52,14 +50,142 @@ Name::Name(const char *repr)
     }
 }
 
+Name::Name(const Name& rhs) : Name()
+{
+    *this = rhs;
+}
+
+Name::Name(Name&& rhs) noexcept : Name()
+{
+    *this = std::move(rhs);
+}
+
+Name& Name::operator=(const Name& rhs)
+{
+    if (this == &rhs) {
+        return *this;
+    }
+    if (rhs.m_storage == INTERNED) {
+        release();
+        m_storage = INTERNED;
+        set_pointer(rhs.storage());
+        m_size = rhs.m_size;
+        m_count = rhs.m_count;
+        return *this;
+    }
+    assign(rhs.offsets(), rhs.m_count, rhs.wire_data(), rhs.m_size);
+    return *this;
+}
+
+Name& Name::operator=(Name&& rhs) noexcept
+{
+    if (this == &rhs) {
+        return *this;
+    }
+    release();
+    m_size = rhs.m_size;
+    m_count = rhs.m_count;
+    m_storage = rhs.m_storage;
+    memcpy(m_inline, rhs.m_inline, sizeof m_inline);
+    rhs.m_storage = INLINE;
+    rhs.m_size = 0;
+    rhs.m_count = 0;
+    return *this;
+}
+
+Name::~Name()
+{
+    release();
+}
+
+const char *Name::storage() const noexcept
+{
+    if (m_storage == INLINE) {
+        return m_inline;
+    }
+    const char *p;
+    memcpy(&p, m_inline, sizeof p);
+    return p;
+}
+
+void Name::set_pointer(const char *p) noexcept
+{
+    memcpy(m_inline, &p, sizeof p);
+}
+
+void Name::release() noexcept
+{
+    if (m_storage == HEAP) {
+        delete [] storage();
+    }
+    m_storage = INLINE;
+}
+
+void Name::assign(const uint8_t *offsets, size_t count, const char *wire, size_t size)
+{
+    char *dst;
+    if (m_storage == HEAP) {
+        dst = const_cast<char *>(storage());
+    } else if (count + size <= inline_capacity) {
+        m_storage = INLINE;
+        dst = m_inline;
+    } else {
+        dst = new char[heap_capacity];
+        m_storage = HEAP;
+        set_pointer(dst);
+    }
+    memcpy(dst, offsets, count);
+    memcpy(dst + count, wire, size);
+    m_count = count;
+    m_size = size;
+}
+
+static std::mutex intern_mutex;
+
+void Name::intern()
+{
+    if (m_storage != HEAP) {
+        // A name that fits in the object would take no less memory shared.
+        return;
+    }
+    static std::unordered_set<std::string> *table = new std::unordered_set<std::string>;
+    std::string key(storage(), m_count + m_size);
+    const char *p;
+    {
+        std::lock_guard<std::mutex> lock(intern_mutex);
+        p = table->insert(std::move(key)).first->data();
+    }
+    release();
+    m_storage = INTERNED;
+    set_pointer(p);
+}
+
+bool Name::operator==(const Name& rhs) const noexcept
+{
+    // The length octets are all below 64, so folding case leaves them alone.
+    return m_count == rhs.m_count && m_size == rhs.m_size &&
+           equal_ignoring_case(wire_data(), rhs.wire_data(), m_size);
+}
+
 const char *Name::decode_repr(const char *repr, const char *end)
 {
+    uint8_t offsets[128];
+    char wire[255];
+    size_t count = 0;
+    size_t size = 0;
     bool saw_double_quotes = false;
     if (repr != end && *repr == '"') {
         saw_double_quotes = true;
         ++repr;
     }
-    Label current_label;
+    char current_label[63];
+    size_t n = 0;
+    auto append = [&](char ch) {
+        if (n == 63) {
+            throw dns::Exception("name contains a label longer than 63 characters");
+        }
+        current_label[n++] = ch;
+    };
     const char *p = repr;
     while (true) {
         if (p == end) {
@@ -72,52 +198,53 @@ const char *Name::decode_repr(const char *repr, const char *end)
             break;
         }
         if (*p == '.') {
-            if (!m_labels.empty() && m_labels.back().empty()) {
+            if (count != 0 && wire[offsets[count - 1]] == 0) {
                 throw dns::Exception("name contains an empty label");
             }
-            m_labels.emplace_back(std::move(current_label));
-            current_label.clear();
-            if (m_labels.size() > 255) {
-                throw dns::Exception("name contains more than 255 labels");
+            // Leave room for the root label, unless this is it.
+            if (size + 1 + n + ((n != 0) ? 1 : 0) > 255) {
+                throw dns::Exception("name is longer than 255 octets");
             }
+            offsets[count++] = size;
+            wire[size++] = n;
+            memcpy(wire + size, current_label, n);
+            size += n;
+            n = 0;
         } else if (*p == '\\') {
             ++p;
             if (p == end) {
                 throw dns::Exception("name ends with unterminated backslash-escape");
             }
-            current_label += (*p);
-            if (current_label.size() > 63) {
-                throw dns::Exception("name contains a label longer than 63 characters");
-            }
+            append(*p);
         } else if (saw_double_quotes && *p == '"') {
             ++p;
             break;
         } else if (!saw_double_quotes && !can_appear_unquoted_in_label(*p)) {
             throw dns::Exception("unusual name requires double quotes");
         } else {
-            current_label += (*p);
-            if (current_label.size() > 63) {
-                throw dns::Exception("name contains a label longer than 63 characters");
-            }
+            append(*p);
         }
         ++p;
     }
-    if (!current_label.empty()) {
+    if (n != 0) {
         throw dns::UnsupportedException("name " + std::string(repr, p) + " without trailing dot is confusing");
     }
-    if (m_labels.empty()) {
+    if (count == 0) {
         throw dns::Exception("empty name is not allowed; did you mean \".\"?");
     }
-    if (!m_labels.back().empty()) {
-        m_labels.emplace_back("");
+    if (wire[offsets[count - 1]] != 0) {
+        offsets[count++] = size;
+        wire[size++] = 0;
     }
+    assign(offsets, count, wire, size);
     return p;
 }
 
-std::string Label::repr() const
+static std::string label_repr(const char *data, size_t n)
 {
     std::string result;
-    for (char ch : m_str) {
+    for (size_t i = 0; i < n; ++i) {
+        char ch = data[i];
         switch (ch) {
             default: result += ch; break;
             case '\\': result += "\\\\"; break;
@@ -128,74 +255,115 @@ std::string Label::repr() const
     return result;
 }
 
+std::string Label::repr() const
+{
+    return label_repr(m_str.data(), m_str.size());
+}
+
+std::string LabelView::repr() const
+{
+    return label_repr(m_data, m_size);
+}
+
 std::string Name::repr() const
 {
-    std::string result;
-    for (auto&& label : m_labels) {
-        result += label.repr();
-        if (!label.empty()) result += '.';
-    }
+    char buffer[max_repr_size];
+    char *end = repr(buffer, buffer + sizeof buffer);
+    assert(end != nullptr);
+    return std::string(buffer, end);
+}
+
+char *Name::repr(char *dst, const char *end) const noexcept
+{
+    if (dst == nullptr) return nullptr;
+    char *start = dst;
     bool require_double_quotes = false;
-    for (char ch : result) {
-        if (!can_appear_unquoted_in_label(ch)) {
-            require_double_quotes = true;
-            break;
+    auto put = [&](char ch) {
+        if (!can_appear_unquoted_in_label(ch)) require_double_quotes = true;
+        *dst++ = ch;
+    };
+    // Leave room for the quotes, in case they turn out to be needed.
+    if (end - dst < 2) return nullptr;
+    end -= 2;
+    for (auto&& label : labels()) {
+        if (end - dst < 2 * label.size() + 1) return nullptr;
+        for (size_t i = 0; i < label.size(); ++i) {
+            char ch = label.data()[i];
+            switch (ch) {
+                default: put(ch); break;
+                case '\\': put('\\'); put('\\'); break;
+                case '.': put('\\'); put('.'); break;
+                case '"': put('\\'); put('"'); break;
+            }
         }
+        if (!label.empty()) put('.');
     }
     if (require_double_quotes) {
-        return '"' + result + '"';
-    } else {
-        return result;
+        memmove(start + 1, start, dst - start);
+        *start = '"';
+        dst += 1;
+        *dst++ = '"';
     }
+    return dst;
 }
 
 char *Name::encode(char *dst, const char *end) const noexcept
 {
-    if (dst == nullptr) return nullptr;
-    for (auto&& label : m_labels) {
-        if ((end - dst) < label.size() + 1) return nullptr;
-        *dst++ = label.size();
-        if (label.size() != 0) {
-            memcpy(dst, label.data(), label.size());
-            dst += label.size();
-        }
-    }
-    return dst;
+    if (dst == nullptr || (end - dst) < m_size) return nullptr;
+    memcpy(dst, wire_data(), m_size);
+    return dst + m_size;
 }
 
 const char *Name::decode(const SymbolTable& syms, const char *src, const char *end)
 {
-    if (src == nullptr || src == end) return nullptr;
-    m_labels.clear();
-    int length = -1;
-    do {
-        if (src == end) return nullptr;
-        length = static_cast<uint8_t>(*src++);
+    DecodeResult result = try_decode(syms, src, end);
+    return result ? *result : nullptr;
+}
+
+DecodeResult Name::try_decode(const SymbolTable& syms, const char *src, const char *end)
+{
+    if (src == nullptr || src == end) return decode_error(DecodeError::TRUNCATED);
+    // Gather the labels on the stack, then copy them into our storage,
+    // which a reused Name already has; so decoding into one does not allocate.
+    uint8_t offsets[128];
+    char wire[255];
+    size_t count = 0;
+    const char *result = nullptr;  // where the name ends in the original buffer
+    int wire_length = 0;
+    int hops = 0;
+    while (true) {
+        if (src == end) return decode_error(DecodeError::TRUNCATED);
+        int length = static_cast<uint8_t>(*src++);
         if ((length & 0xC0) == 0x00) {
-            if (end - src < length) return nullptr;
-            std::string label(length, '\0');
-            memcpy(&label[0], src, length);
-            m_labels.emplace_back(std::move(label));
+            if (end - src < length) return decode_error(DecodeError::TRUNCATED);
+            if (wire_length + 1 + length > 255) return decode_error(DecodeError::NAME_TOO_LONG);
+            offsets[count++] = wire_length;
+            wire[wire_length] = length;
+            memcpy(wire + wire_length + 1, src, length);
+            wire_length += 1 + length;
             src += length;
+            if (length == 0) break;
         } else if ((length & 0xC0) == 0xC0) {
-            auto it = syms.find(length);
-            if (it == syms.end()) {
-                return nullptr;
+            if (src == end) return decode_error(DecodeError::TRUNCATED);
+            int offset = ((length & 0x3F) << 8) | static_cast<uint8_t>(*src++);
+            if (result == nullptr) {
+                result = src;
             }
-            const Name& target = it->second;
-            m_labels.insert(m_labels.end(), target.labels().begin(), target.labels().end());
-            break;
+            // A loop of pointers would otherwise never terminate.
+            if (++hops > 127) return decode_error(DecodeError::POINTER_LOOP);
+            src = syms.find(offset);
+            end = syms.end();
+            if (src == nullptr) return decode_error(DecodeError::BAD_POINTER);
         } else if ((length & 0xC0) == 0x40) {
             // Unrecognized encoding scheme (possibly the one described in
             // now-obsolete RFC 2673 "Binary Labels in the Domain Name System")
-            return nullptr;
-        } else if ((length & 0xC0) == 0x80) {
+            return decode_error(DecodeError::BAD_LABEL_TYPE);
+        } else {
             // Unrecognized encoding scheme (possibly the one described in
             // RFC-draft "A New Scheme for the Compression of Domain Names")
-            return nullptr;
-        } else {
-            assert(false);
+            return decode_error(DecodeError::BAD_LABEL_TYPE);
         }
-    } while (length != 0);
-    return src;
+    }
+    assign(offsets, count, wire, wire_length);
+    return (result != nullptr) ? result : src;
 }
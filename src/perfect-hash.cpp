@@ -0,0 +1,107 @@
+
+#include "perfect-hash.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+using namespace dns;
+
+const size_t PerfectHash::npos;
+
+// The most levels we build; BBHash's authors find that at gamma = 2, only
+// about one key in a million is left over after 25.
+static const int max_levels = 25;
+
+// Where `key` lands in a level of `bits` bits: an independent hash for
+// each level (MurmurHash3's 64-bit finalizer of the salted key), mapped
+// onto the range by a multiply rather than a divide.
+static size_t position(uint64_t key, int level, size_t bits)
+{
+    uint64_t h = key + (uint64_t(level) + 1) * 0x9E3779B97F4A7C15ull;
+    h ^= (h >> 33);
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= (h >> 33);
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= (h >> 33);
+    return ((h >> 32) * bits) >> 32;
+}
+
+PerfectHash::PerfectHash(const std::vector<uint64_t>& keys, double gamma) :
+    m_size(keys.size())
+{
+    std::vector<uint64_t> remaining(keys);
+    std::vector<uint64_t> next;
+    for (int level = 0; level < max_levels && !remaining.empty(); ++level) {
+        size_t words = std::max<size_t>(1, (size_t(gamma * remaining.size()) + 63) / 64);
+        Level l = { m_words.size() * 64, words * 64 };
+        std::vector<uint64_t> taken(words, 0);
+        std::vector<uint64_t> collided(words, 0);
+        for (uint64_t key : remaining) {
+            size_t pos = position(key, level, l.bits);
+            uint64_t mask = uint64_t(1) << (pos % 64);
+            if (taken[pos / 64] & mask) {
+                collided[pos / 64] |= mask;
+            }
+            taken[pos / 64] |= mask;
+        }
+        next.clear();
+        for (uint64_t key : remaining) {
+            size_t pos = position(key, level, l.bits);
+            if ((collided[pos / 64] >> (pos % 64)) & 1) {
+                next.push_back(key);
+            }
+        }
+        for (size_t i = 0; i < words; ++i) {
+            m_words.push_back(taken[i] & ~collided[i]);
+        }
+        m_levels.push_back(l);
+        remaining.swap(next);
+    }
+
+    uint32_t count = 0;
+    for (size_t i = 0; i < m_words.size(); ++i) {
+        if (i % 8 == 0) {
+            m_ranks.push_back(count);
+        }
+        count += __builtin_popcountll(m_words[i]);
+    }
+    for (uint64_t key : remaining) {
+        m_leftovers.emplace_back(key, 0);
+    }
+    std::sort(m_leftovers.begin(), m_leftovers.end());
+    for (auto&& kv : m_leftovers) {
+        kv.second = count++;
+    }
+}
+
+size_t PerfectHash::memory_bytes() const noexcept
+{
+    return m_words.size() * sizeof(uint64_t) + m_ranks.size() * sizeof(uint32_t) +
+           m_levels.size() * sizeof(Level) + m_leftovers.size() * sizeof(m_leftovers[0]);
+}
+
+size_t PerfectHash::rank(size_t bit) const noexcept
+{
+    size_t word = bit / 64;
+    size_t n = m_ranks[word / 8];
+    for (size_t i = word & ~size_t(7); i < word; ++i) {
+        n += __builtin_popcountll(m_words[i]);
+    }
+    return n + __builtin_popcountll(m_words[word] & ((uint64_t(1) << (bit % 64)) - 1));
+}
+
+size_t PerfectHash::lookup(uint64_t key) const noexcept
+{
+    for (size_t i = 0; i < m_levels.size(); ++i) {
+        size_t bit = m_levels[i].first_bit + position(key, i, m_levels[i].bits);
+        if ((m_words[bit / 64] >> (bit % 64)) & 1) {
+            return rank(bit);
+        }
+    }
+    auto it = std::lower_bound(m_leftovers.begin(), m_leftovers.end(), std::make_pair(key, size_t(0)));
+    if (it != m_leftovers.end() && it->first == key) {
+        return it->second;
+    }
+    return npos;
+}
@@ -0,0 +1,105 @@
+
+#include "bytes.h"
+#include "casefold.h"
+#include "query-view.h"
+#include "question.h"
+#include "rrtype.h"
+
+using namespace dns;
+
+DecodeResult QueryView::parse(const char *packet, const char *end) noexcept
+{
+    m_qname = nullptr;
+    m_question_end = nullptr;
+    m_label_count = 0;
+    m_has_opt = false;
+
+    uint16_t fields;
+    const char *src = packet;
+    src = get16bits(src, end, m_id);
+    src = get16bits(src, end, fields);
+    src = get16bits(src, end, m_qdcount);
+    src = get16bits(src, end, m_ancount);
+    src = get16bits(src, end, m_nscount);
+    src = get16bits(src, end, m_arcount);
+    if (src == nullptr) return decode_error(DecodeError::TRUNCATED);
+
+    m_qr = ((fields >> 15) & 0x1);
+    m_opcode = static_cast<Opcode>((fields >> 11) & 0xF);
+    m_rd = ((fields >> 8) & 0x1);
+
+    // Reject on the header alone whatever we'd refuse to answer anyway.
+    if (m_qr || m_opcode != Opcode::QUERY || m_qdcount != 1 ||
+        m_ancount != 0 || m_nscount != 0 || m_arcount > 1) {
+        return src;
+    }
+
+    // Walk the qname once, recording label offsets, folding and hashing
+    // as we go. Compression pointers can't point anywhere useful from here,
+    // so they (like the obsolete label types) make the packet malformed.
+    const char *qname = src;
+    int n = 0;
+    while (true) {
+        if (src == end) return decode_error(DecodeError::TRUNCATED);
+        uint8_t length = *src;
+        if ((length & 0xC0) == 0xC0) return decode_error(DecodeError::BAD_POINTER);
+        if (length > 63) return decode_error(DecodeError::BAD_LABEL_TYPE);
+        if (length == 0) {
+            m_label_offsets[n] = (src - qname);
+            src += 1;
+            break;
+        }
+        if ((end - src) < length + 1) return decode_error(DecodeError::TRUNCATED);
+        if ((src - qname) + length + 2 > 255) return decode_error(DecodeError::NAME_TOO_LONG);
+        int offset = (src - qname);
+        m_label_offsets[n] = offset;
+        m_folded[offset] = length;
+        m_label_hashes[n] = fold_label(src + 1, length, m_folded + offset + 1);
+        n += 1;
+        src += length + 1;
+    }
+    src = get16bits(src, end, m_qtype);
+    src = get16bits(src, end, m_qclass);
+    if (src == nullptr) return decode_error(DecodeError::TRUNCATED);
+    const char *question_end = src;
+
+    if (m_arcount == 1) {
+        // RFC 6891, section 6.1.2: the OPT record's owner is the root.
+        uint16_t type;
+        uint16_t payload;
+        uint32_t ttl;
+        uint16_t rdlength;
+        if ((end - src) < 11 || *src != 0) return question_end;
+        const char *p = get16bits(src + 1, end, type);
+        if (type != int(RRType::OPT)) return question_end;
+        p = get16bits(p, end, payload);
+        p = get32bits(p, end, ttl);
+        p = get16bits(p, end, rdlength);
+        if ((end - p) < rdlength) return decode_error(DecodeError::TRUNCATED);
+        src = p + rdlength;
+        m_has_opt = true;
+        m_udp_payload_size = payload;
+        m_edns_version = ((ttl >> 16) & 0xFF);
+        m_do = ((ttl >> 15) & 0x1);
+    }
+
+    m_qname = qname;
+    m_question_end = question_end;
+    m_label_count = n;
+    uint32_t hash = 0;
+    m_suffix_hashes[n] = hash;
+    for (int i = n - 1; i >= 0; --i) {
+        hash = hash_name_step(hash, m_label_hashes[i]);
+        m_suffix_hashes[i] = hash;
+    }
+    return src;
+}
+
+Question QueryView::question() const
+{
+    // Names in the question can't be compressed, so no symbol table is needed.
+    SymbolTable syms;
+    Question result;
+    result.decode(syms, m_qname, m_question_end);
+    return result;
+}
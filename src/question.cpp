@@ -9,9 +9,17 @@ using namespace dns;
 
 const char *Question::decode(const SymbolTable& syms, const char *src, const char *end)
 {
-    src = m_qname.decode(syms, src, end);
-    src = get16bits(src, end, m_qtype);
+    DecodeResult result = try_decode(syms, src, end);
+    return result ? *result : nullptr;
+}
+
+DecodeResult Question::try_decode(const SymbolTable& syms, const char *src, const char *end)
+{
+    DecodeResult name = m_qname.try_decode(syms, src, end);
+    if (!name) return name;
+    src = get16bits(*name, end, m_qtype);
     src = get16bits(src, end, m_qclass);
+    if (src == nullptr) return decode_error(DecodeError::TRUNCATED);
     return src;
 }
 
@@ -30,8 +38,7 @@ std::string Question::repr() const
     do { result += ' '; } while (result.size() < 32);
     do { result += ' '; } while ((result.size() % 8) != 0);
     result += "        ";
-    assert(m_qclass == RRClass::IN);
-    result += "IN";
+    result += RRClass(m_qclass).repr();
     result += ' ';
     result += RRType(m_qtype).repr();
     return result;
@@ -0,0 +1,288 @@
+
+#include "bytes.h"
+#include "casefold.h"
+#include "query-view.h"
+#include "response-writer.h"
+
+#include <assert.h>
+#include <string.h>
+
+using namespace dns;
+
+ResponseWriter::ResponseWriter(const QueryView& query, char *dst, const char *end) noexcept :
+    m_start(dst), m_dst(dst + 12), m_end(end), m_real_end(end),
+    m_id(query.id()), m_opcode(query.opcode()), m_rd(query.is_recursion_desired())
+{
+    if ((end - dst) < 12) {
+        m_dst = nullptr;
+    }
+}
+
+ResponseWriter& ResponseWriter::set_opt(uint16_t udp_payload_size, uint8_t extended_rcode) noexcept
+{
+    assert(m_count[0] == 0 && m_count[1] == 0 && m_count[2] == 0);
+    if (!m_opt && m_dst != nullptr && (m_end - m_dst) >= 11) {
+        m_opt = true;
+        m_end -= 11;
+    }
+    m_udp_payload_size = udp_payload_size;
+    m_extended_rcode = extended_rcode;
+    return *this;
+}
+
+void ResponseWriter::remember(const char *label) noexcept
+{
+    int offset = (label - m_start);
+    if (offset < 0x4000 && m_num_names < 64) {
+        m_names[m_num_names++] = offset;
+    }
+}
+
+bool ResponseWriter::matches(const Name& name, size_t i, int offset) const noexcept
+{
+    // Compare labels i..end of `name` against the name already in the
+    // packet at `offset`. Every pointer we've written points backward,
+    // so following them must terminate.
+    const char *p = m_start + offset;
+    const auto& labels = name.labels();
+    for (; i < labels.size(); ++i) {
+        uint8_t length = *p;
+        while ((length & 0xC0) == 0xC0) {
+            p = m_start + (((length & 0x3F) << 8) | static_cast<uint8_t>(p[1]));
+            length = *p;
+        }
+        if (length != labels[i].size()) return false;
+        if (length == 0) return true;
+        if (!equal_ignoring_case(p + 1, labels[i].data(), length)) return false;
+        p += 1 + length;
+    }
+    return false;
+}
+
+char *ResponseWriter::write_name(char *dst, const Name& name) noexcept
+{
+    const auto& labels = name.labels();
+    size_t n = labels.size();
+    assert(n >= 1 && labels.back().empty());
+
+    // Find the longest suffix of `name` that is already in the packet.
+    size_t i = 0;
+    int target = -1;
+    for (; i + 1 < n && target == -1; ++i) {
+        for (int j = 0; j < m_num_names; ++j) {
+            if (matches(name, i, m_names[j])) {
+                target = m_names[j];
+                break;
+            }
+        }
+    }
+    size_t prefix = (target == -1) ? (n - 1) : (i - 1);
+
+    for (size_t k = 0; k < prefix; ++k) {
+        LabelView label = labels[k];
+        if (dst == nullptr || (m_end - dst) < label.size() + 1) return nullptr;
+        remember(dst);
+        *dst++ = label.size();
+        memcpy(dst, label.data(), label.size());
+        dst += label.size();
+    }
+    if (target == -1) {
+        return put8bits(dst, m_end, 0);
+    } else {
+        return put16bits(dst, m_end, 0xC000 | target);
+    }
+}
+
+bool ResponseWriter::copy_question(const char *src, const char *end) noexcept
+{
+    if (m_dst == nullptr || m_qdcount != 0 || m_section != 0 || m_count[0] != 0) {
+        return false;
+    }
+    const char *p = src;
+    while (true) {
+        if (p == end) return false;
+        uint8_t length = *p;
+        if (length & 0xC0) return false;  // a compression pointer, or something stranger
+        if (length == 0) break;
+        if ((end - p) < length + 1) return false;
+        p += length + 1;
+    }
+    p += 1 + 4;  // the root label, QTYPE, and QCLASS
+    if (p > end || (m_end - m_dst) < (p - src)) {
+        return false;
+    }
+    memcpy(m_dst, src, (p - src));
+    for (const char *label = m_dst; *label != 0; label += 1 + static_cast<uint8_t>(*label)) {
+        remember(label);
+    }
+    m_dst += (p - src);
+    m_qdcount = 1;
+    return true;
+}
+
+ResponseWriter& ResponseWriter::set_question(const Question& q) noexcept
+{
+    if (m_dst == nullptr || m_qdcount != 0) {
+        return *this;
+    }
+    int num_names = m_num_names;
+    char *dst = write_name(m_dst, q.qname());
+    dst = put16bits(dst, m_end, int(q.qtype()));
+    dst = put16bits(dst, m_end, int(q.qclass()));
+    if (dst == nullptr) {
+        m_num_names = num_names;
+        m_tc = true;
+    } else {
+        m_dst = dst;
+        m_qdcount = 1;
+    }
+    return *this;
+}
+
+bool ResponseWriter::add(int section, const RR& rr, const Name *owner, bool owner_is_qname) noexcept
+{
+    return add(section, (owner != nullptr) ? owner : &rr.name(), owner_is_qname,
+               rr.rrtype(), rr.rrclass(), rr.ttl(), rr.rdata().data(), rr.rdata().size());
+}
+
+bool ResponseWriter::add_answer(const Name *owner, RRType rrtype, RRClass rrclass, uint32_t ttl,
+                                const char *rdata, size_t rdlength) noexcept
+{
+    return add(0, owner, owner == nullptr, rrtype, rrclass, ttl, rdata, rdlength);
+}
+
+bool ResponseWriter::add_authority(const Name *owner, RRType rrtype, RRClass rrclass, uint32_t ttl,
+                                   const char *rdata, size_t rdlength) noexcept
+{
+    return add(1, owner, owner == nullptr, rrtype, rrclass, ttl, rdata, rdlength);
+}
+
+bool ResponseWriter::add_additional(const Name *owner, RRType rrtype, RRClass rrclass, uint32_t ttl,
+                                    const char *rdata, size_t rdlength) noexcept
+{
+    return add(2, owner, owner == nullptr, rrtype, rrclass, ttl, rdata, rdlength);
+}
+
+void ResponseWriter::rollback(const Checkpoint& c) noexcept
+{
+    m_dst = c.dst;
+    for (int i = 0; i < 3; ++i) {
+        m_count[i] = c.count[i];
+    }
+    m_num_names = c.num_names;
+}
+
+bool ResponseWriter::add(int section, const Name *owner, bool owner_is_qname, RRType rrtype, RRClass rrclass,
+                         uint32_t ttl, const char *rdata, size_t rdlength) noexcept
+{
+    assert(section >= m_section);
+    m_section = section;
+    if (m_dst == nullptr || m_tc) {
+        return false;
+    }
+    int num_names = m_num_names;
+    char *dst;
+    if (owner_is_qname) {
+        // The question always starts right after the header.
+        assert(m_qdcount == 1);
+        dst = put16bits(m_dst, m_end, 0xC000 | 12);
+    } else {
+        dst = write_name(m_dst, *owner);
+    }
+    dst = put16bits(dst, m_end, int(rrtype));
+    dst = put16bits(dst, m_end, int(rrclass));
+    dst = put32bits(dst, m_end, ttl);
+    dst = put16bits(dst, m_end, rdlength);
+    if (dst != nullptr && (m_end - dst) >= rdlength) {
+        memcpy(dst, rdata, rdlength);
+        dst += rdlength;
+    } else {
+        dst = nullptr;
+    }
+    if (dst == nullptr) {
+        // Roll back to the end of the previous RR.
+        m_num_names = num_names;
+        if (section != 2) {
+            m_tc = true;
+        }
+        return false;
+    }
+    m_dst = dst;
+    m_count[section] += 1;
+    return true;
+}
+
+bool ResponseWriter::add(int section, const RRset& rrset, const Name *owner, bool owner_is_qname) noexcept
+{
+    if (m_dst != nullptr && owner == nullptr && rrset.wire_length() <= size_t(m_end - m_dst)) {
+        // It fits even uncompressed, so no record can fail to. (A pointer
+        // to the qname is never longer than the wildcard owner it replaces.)
+        for (const RR *rr : rrset.records()) {
+            add(section, *rr, owner, owner_is_qname);
+        }
+        return !m_tc;
+    }
+    char *dst = m_dst;
+    int count = m_count[section];
+    int num_names = m_num_names;
+    for (const RR *rr : rrset.records()) {
+        if (!add(section, *rr, owner, owner_is_qname)) {
+            // Roll back to the end of the previous RRset.
+            m_dst = dst;
+            m_count[section] = count;
+            m_num_names = num_names;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ResponseWriter::add_authority_preencoded(const std::string& wire, uint16_t owner_offset) noexcept
+{
+    assert(m_section <= 1 && wire.size() >= 2);
+    m_section = 1;
+    if (m_dst == nullptr || m_tc) {
+        return false;
+    }
+    if ((m_end - m_dst) < wire.size()) {
+        m_tc = true;
+        return false;
+    }
+    memcpy(m_dst, wire.data(), wire.size());
+    put16bits(m_dst, m_end, 0xC000 | owner_offset);
+    m_dst += wire.size();
+    m_count[1] += 1;
+    return true;
+}
+
+char *ResponseWriter::finish() noexcept
+{
+    if (m_dst == nullptr) {
+        return nullptr;
+    }
+    int fields = (1 << 15);
+    fields |= (int(m_opcode) << 11);
+    fields |= (int(m_aa) << 10);
+    fields |= (int(m_tc) << 9);
+    fields |= (int(m_rd) << 8);
+    fields |= (int(m_ra) << 7);
+    fields |= (int(m_rcode) << 0);
+
+    char *end = m_dst;
+    if (m_opt) {
+        end = put8bits(end, m_real_end, 0);
+        end = put16bits(end, m_real_end, int(RRType::OPT));
+        end = put16bits(end, m_real_end, m_udp_payload_size);
+        end = put32bits(end, m_real_end, uint32_t(m_extended_rcode) << 24);
+        end = put16bits(end, m_real_end, 0);
+    }
+
+    char *dst = m_start;
+    dst = put16bits(dst, m_end, m_id);
+    dst = put16bits(dst, m_end, fields);
+    dst = put16bits(dst, m_end, m_qdcount);
+    dst = put16bits(dst, m_end, m_count[0]);
+    dst = put16bits(dst, m_end, m_count[1]);
+    dst = put16bits(dst, m_end, m_count[2] + (m_opt ? 1 : 0));
+    return end;
+}
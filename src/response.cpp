@@ -0,0 +1,77 @@
+
+#include "bytes.h"
+#include "message.h"
+#include "response.h"
+
+using namespace dns;
+
+Response& Response::resetAsResponseTo(const Message& query) noexcept
+{
+    m_id = query.id();
+    m_opcode = query.opcode();
+    m_aa = false;
+    m_rd = query.is_recursion_desired();
+    m_ra = false;
+    m_rcode = RCode::NOERROR;
+    m_question = nullptr;
+    m_answer.clear();
+    m_authority.clear();
+    m_additional.clear();
+    m_synthesized.clear();
+    return *this;
+}
+
+Response& Response::add_answer(const RRset& rrset, const Name *owner)
+{
+    for (const RR *rr : rrset.records()) {
+        add_answer(*rr, owner);
+    }
+    return *this;
+}
+
+Response& Response::add_authority(const RRset& rrset)
+{
+    for (const RR *rr : rrset.records()) {
+        add_authority(*rr);
+    }
+    return *this;
+}
+
+Response& Response::add_additional(const RRset& rrset)
+{
+    for (const RR *rr : rrset.records()) {
+        add_additional(*rr);
+    }
+    return *this;
+}
+
+char *Response::encode(char *dst, const char *end) const noexcept
+{
+    int fields = (1 << 15);
+    fields |= (int(m_opcode) << 11);
+    fields |= (int(m_aa) << 10);
+    fields |= (int(m_rd) << 8);
+    fields |= (int(m_ra) << 7);
+    fields |= (int(m_rcode) << 0);
+
+    dst = put16bits(dst, end, m_id);
+    dst = put16bits(dst, end, fields);
+    dst = put16bits(dst, end, (m_question != nullptr) ? 1 : 0);
+    dst = put16bits(dst, end, m_answer.size());
+    dst = put16bits(dst, end, m_authority.size());
+    dst = put16bits(dst, end, m_additional.size());
+
+    if (m_question != nullptr) {
+        dst = m_question->encode(dst, end);
+    }
+    for (auto&& ref : m_answer) {
+        dst = ref.rr->encode(ref.name(), dst, end);
+    }
+    for (auto&& ref : m_authority) {
+        dst = ref.rr->encode(ref.name(), dst, end);
+    }
+    for (auto&& ref : m_additional) {
+        dst = ref.rr->encode(ref.name(), dst, end);
+    }
+    return dst;
+}
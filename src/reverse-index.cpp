@@ -0,0 +1,73 @@
+
+#include "casefold.h"
+#include "name.h"
+#include "reverse-index.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <vector>
+
+using namespace dns;
+
+bool ReverseIndex::parse_octet(const char *data, size_t n, uint8_t& octet) noexcept
+{
+    if (n == 0 || n > 3 || (n > 1 && data[0] == '0')) {
+        return false;
+    }
+    int value = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (data[i] < '0' || data[i] > '9') return false;
+        value = (value * 10) + (data[i] - '0');
+    }
+    if (value > 255) {
+        return false;
+    }
+    octet = value;
+    return true;
+}
+
+bool ReverseIndex::parse_name(const Name& name, uint32_t& address) noexcept
+{
+    LabelList labels = name.labels();
+    if (labels.size() != 7 || !labels[6].empty() ||
+        labels[4].size() != 7 || !equal_ignoring_case(labels[4].data(), "in-addr", 7) ||
+        labels[5].size() != 4 || !equal_ignoring_case(labels[5].data(), "arpa", 4)) {
+        return false;
+    }
+    uint32_t result = 0;
+    for (int i = 3; i >= 0; --i) {
+        uint8_t octet;
+        if (!parse_octet(labels[i].data(), labels[i].size(), octet)) return false;
+        result = (result << 8) | octet;
+    }
+    address = result;
+    return true;
+}
+
+Name ReverseIndex::make_name(uint32_t address)
+{
+    char name[32];
+    snprintf(name, sizeof name, "%u.%u.%u.%u.in-addr.arpa.",
+             address & 0xFF, (address >> 8) & 0xFF, (address >> 16) & 0xFF, address >> 24);
+    return Name(name);
+}
+
+bool ReverseIndex::find(uint32_t address, size_t& first, size_t& last) const noexcept
+{
+    auto range = std::equal_range(m_addresses.begin(), m_addresses.end(), address);
+    first = range.first - m_addresses.begin();
+    last = range.second - m_addresses.begin();
+    return first != last;
+}
+
+bool ReverseIndex::has_prefix(uint32_t prefix, int octets) const noexcept
+{
+    if (octets == 0) {
+        return !m_addresses.empty();
+    }
+    int shift = 32 - 8 * octets;
+    uint32_t first = (shift == 0) ? prefix : (prefix << shift);
+    uint32_t last = (shift == 0) ? prefix : (first | ((uint32_t(1) << shift) - 1));
+    auto it = std::lower_bound(m_addresses.begin(), m_addresses.end(), first);
+    return it != m_addresses.end() && *it <= last;
+}
@@ -1,206 +1,28 @@
 
 #include "bytes.h"
 #include "exception.h"
-#include "ipaddressv4.h"
 #include "rr.h"
 #include "rrtype.h"
+#include "rrtype-traits.h"
 #include "symboltable.h"
 
 #include <assert.h>
-#include <regex>
-#include <stdlib.h>
+#include <ctype.h>
 #include <string>
 #include <string.h>
 
 using namespace dns;
 
-static std::string encode_rdata_repr_just_domain_name(const SymbolTable& syms, const std::string& rdata);
-
-template<int rrtype>
-static std::string decode_rdata_repr_just_domain_name(const char *src, const char *end);
-
-struct by_rrtype_t {
-    RRType type;
-    const char *str;
-    std::string (*encode_rdata_repr)(const SymbolTable& syms, const std::string& rdata);
-    std::string (*decode_rdata_repr)(const char *src, const char *end);
-};
-
-static by_rrtype_t by_rrtype[] = {
-    {
-        RRType::A, "A",
-        [](const SymbolTable&, const std::string& rdata) -> std::string {
-            const char *src = rdata.data();
-            const char *end = rdata.data() + rdata.size();
-            IPAddressV4 ip;
-            src = ip.decode(src, end);
-            assert(src == end);
-            return ip.repr();
-        },
-        [](const char *src, const char *end) -> std::string {
-            IPAddressV4 ip;
-            try {
-                src = ip.decode_repr(src, end);
-                if (src != end) throw dns::Exception("");
-            } catch (const dns::Exception&) {
-                throw dns::UnsupportedException("Zonefile RR of type A has a malformed IP address");
-            }
-            std::string result(4, '\0');
-            char *dst = &result[0];
-            dst = ip.encode(dst, result.data() + 4);
-            assert(dst == result.data() + 4);
-            return result;
-        },
-    },
-    {
-        RRType::NS, "NS",
-        encode_rdata_repr_just_domain_name,
-        decode_rdata_repr_just_domain_name<RRType::NS>,
-    },
-    {
-        RRType::CNAME, "CNAME",
-        encode_rdata_repr_just_domain_name,
-        decode_rdata_repr_just_domain_name<RRType::CNAME>,
-    },
-    {
-        RRType::SOA, "SOA",
-        [](const SymbolTable& syms, const std::string& rdata) -> std::string {
-            const char *src = rdata.data();
-            const char *end = rdata.data() + rdata.size();
-            Name primary_master_name;
-            Name responsible_person_name;
-            uint32_t serial_number;
-            uint32_t refresh;
-            uint32_t retry;
-            uint32_t expire;
-            uint32_t negative_caching_ttl;
-            src = primary_master_name.decode(syms, src, end);
-            src = responsible_person_name.decode(syms, src, end);
-            src = get32bits(src, end, serial_number);
-            src = get32bits(src, end, refresh);
-            src = get32bits(src, end, retry);
-            src = get32bits(src, end, expire);
-            src = get32bits(src, end, negative_caching_ttl);
-            assert(src == end);
-            return (
-                primary_master_name.repr() + " " +
-                responsible_person_name.repr() + " " +
-                std::to_string(serial_number) + " " +
-                std::to_string(refresh) + " " +
-                std::to_string(retry) + " " +
-                std::to_string(expire) + " " +
-                std::to_string(negative_caching_ttl)
-            );
-        },
-        [](const char *src, const char *end) -> std::string {
-            Name primary_master_name;
-            Name responsible_person_name;
-
-            while (src != nullptr && src != end && isspace(*src)) ++src;
-            src = primary_master_name.decode_repr(src, end);
-            while (src != nullptr && src != end && isspace(*src)) ++src;
-            src = responsible_person_name.decode_repr(src, end);
-            if (src == nullptr || src == end) throw dns::UnsupportedException("Zonefile RR of type SOA has the wrong format");
-
-            std::regex rx("\\s+(\\d+)\\s+(\\d+)\\s+(\\d+)\\s+(\\d+)\\s+(\\d+)$");
-            std::cmatch m;
-            bool success = std::regex_match(src, end, m, rx);
-            if (!success) {
-                throw dns::UnsupportedException("Zonefile RR of type SOA has the wrong format");
-            }
-
-            int serial_number = atoi(m[1].first);
-            int refresh = atoi(m[2].first);
-            int retry = atoi(m[3].first);
-            int expire = atoi(m[4].first);
-            int negative_caching_ttl = atoi(m[5].first);
-
-            char buffer[255*64*2 + 20];
-            char *dst = buffer;
-            char *dst_end = buffer + sizeof buffer;
-            dst = primary_master_name.encode(dst, dst_end);
-            dst = responsible_person_name.encode(dst, dst_end);
-            dst = put32bits(dst, dst_end, serial_number);
-            dst = put32bits(dst, dst_end, refresh);
-            dst = put32bits(dst, dst_end, retry);
-            dst = put32bits(dst, dst_end, expire);
-            dst = put32bits(dst, dst_end, negative_caching_ttl);
-            assert(dst != nullptr);
-            return std::string(buffer, dst);
-        },
-    },
-    {
-        RRType::PTR, "PTR",
-        encode_rdata_repr_just_domain_name,
-        decode_rdata_repr_just_domain_name<RRType::PTR>,
-    },
-    {
-        RRType::MX, "MX",
-        [](const SymbolTable& syms, const std::string& rdata) -> std::string {
-            const char *src = rdata.data();
-            const char *end = rdata.data() + rdata.size();
-            uint16_t preference;
-            Name exchange_name;
-            src = get16bits(src, end, preference);
-            src = exchange_name.decode(syms, src, end);
-            assert(src == end);
-            return std::to_string(preference) + " " + exchange_name.repr();
-        },
-        [](const char *src, const char *end) -> std::string {
-            std::regex rx("(\\d+)\\s+(.*)$");
-            std::cmatch m;
-            bool success = std::regex_match(src, end, m, rx);
-            if (!success) {
-                throw dns::UnsupportedException("Zonefile RR of type MX has the wrong format");
-            }
-            int preference = atoi(m[1].first);
-            if (preference < 0 || 65535 < preference) throw dns::UnsupportedException("Zonefile RR of type MX has an out-of-range PREFERENCE");
-            Name exchange_name;
-            src = exchange_name.decode_repr(m[2].first, m[2].second);
-            if (src != end) throw dns::UnsupportedException("Zonefile RR of type MX has the wrong format");
-            char buffer[255*64 + 2];
-            char *p = put16bits(buffer, buffer + sizeof buffer, preference);
-            char *buffer_end = exchange_name.encode(p, buffer + sizeof buffer);
-            assert(buffer_end != nullptr);
-            return std::string(buffer, buffer_end);
-        },
-    },
-};
-
-static std::string encode_rdata_repr_just_domain_name(const SymbolTable& syms, const std::string& rdata)
-{
-    Name canonical_name;
-    const char *src = rdata.data();
-    const char *end = src + rdata.size();
-    src = canonical_name.decode(syms, src, end);
-    assert(src == end);
-    return canonical_name.repr();
-}
-
-template<int rrtype>
-static std::string decode_rdata_repr_just_domain_name(const char *src, const char *end)
-{
-    Name canonical_name;
-    src = canonical_name.decode_repr(src, end);
-    if (src != end) throw dns::UnsupportedException("Zonefile RR of type ", RRType(rrtype).repr(), " has the wrong format");
-    char buffer[255*64];
-    char *buffer_end = canonical_name.encode(buffer, buffer + sizeof buffer);
-    assert(buffer_end != nullptr);
-    return std::string(buffer, buffer_end);
-}
-
-static std::string encode_unknown_rdata_repr(const std::string& rdata)
+static void encode_unknown_rdata_repr(const char *rdata, size_t rdlength, ReprWriter& out)
 {
     // RFC 3597 "Handling of Unknown DNS Resource Record (RR) Types", section 5
-    std::string result = "\\# ";
-    result += std::to_string(rdata.size());
-    result += ' ';
-    for (uint8_t ch : rdata) {
-        char buffer[10];
-        snprintf(buffer, sizeof buffer, "%02x", unsigned(ch));
-        result += buffer;
+    out += "\\# ";
+    out.append_number(rdlength);
+    out += ' ';
+    for (size_t i = 0; i < rdlength; ++i) {
+        out += "0123456789abcdef"[uint8_t(rdata[i]) >> 4];
+        out += "0123456789abcdef"[uint8_t(rdata[i]) & 0xF];
     }
-    return result;
 }
 
 static std::string decode_unknown_rdata_repr(const char *src, const char *end)
@@ -212,19 +34,30 @@ static std::string decode_unknown_rdata_repr(const char *src, const char *end)
         if ('A' <= c && c <= 'F') return (c - 'A') + 10;
         return -1;
     };
-    std::cmatch m;
-    if (!std::regex_match(src, end, m, std::regex("\\\\#\\s+(\\d+)((\\s+[0-9a-fA-F ]*)?)$"))) {
-        throw dns::UnsupportedException("Zonefile RR in RFC 3597 format has the wrong format");
+    // "\#", the length, and then the hex digits, which may be split up by whitespace.
+    auto wrong_format = []() {
+        return dns::UnsupportedException("Zonefile RR in RFC 3597 format has the wrong format");
+    };
+    const char *p = src + 2;
+    if (p == end || !isspace(*p)) throw wrong_format();
+    while (p != end && isspace(*p)) ++p;
+    if (p == end || !isdigit(*p)) throw wrong_format();
+    size_t rdata_length = 0;
+    while (p != end && isdigit(*p)) {
+        if (rdata_length <= 65535) rdata_length = (rdata_length * 10) + (*p - '0');
+        ++p;
     }
-    int rdata_length = atoi(m[1].first);
-    assert(m[2].second == end);
+    if (p != end && !isspace(*p)) throw wrong_format();
     std::string result;
     result.reserve(rdata_length);
     bool highorder = true;
     uint8_t in_progress = 0x00;
-    for (src = m[2].first; src != end; ++src) {
+    for (src = p; src != end; ++src) {
         int digit = to_hex(*src);
-        if (digit == -1) continue;
+        if (digit == -1) {
+            if (!isspace(*src)) throw wrong_format();
+            continue;
+        }
         if (highorder) {
             in_progress = (digit << 4);
         } else {
@@ -241,30 +74,74 @@ static std::string decode_unknown_rdata_repr(const char *src, const char *end)
     return result;
 }
 
-Name RR::rhs_name(const SymbolTable& syms) const
+nonstd::expected<Name, DecodeError> RR::rhs_name(const SymbolTable& syms) const
 {
     assert(m_rrtype == RRType::NS || m_rrtype == RRType::CNAME);
     const char *src = m_rdata.data();
     const char *end = src + m_rdata.size();
     Name result;
-    src = result.decode(syms, src, end);
-    assert(src == end);
+    DecodeResult name = result.try_decode(syms, src, end);
+    if (!name || *name != end) {
+        return decode_error(DecodeError::BAD_RDATA);
+    }
+    return result;
+}
+
+nonstd::expected<Name, DecodeError> RR::additional_name(const SymbolTable& syms) const
+{
+    assert(m_rrtype == RRType::NS || m_rrtype == RRType::MX);
+    const char *src = m_rdata.data();
+    const char *end = src + m_rdata.size();
+    if (m_rrtype == RRType::MX) {
+        if ((end - src) < 2) return decode_error(DecodeError::BAD_RDATA);
+        src += 2;  // PREFERENCE
+    }
+    Name result;
+    DecodeResult name = result.try_decode(syms, src, end);
+    if (!name || *name != end) {
+        return decode_error(DecodeError::BAD_RDATA);
+    }
     return result;
 }
 
+nonstd::expected<uint32_t, DecodeError> RR::soa_minimum(const SymbolTable& syms) const
+{
+    assert(m_rrtype == RRType::SOA);
+    const char *src = m_rdata.data();
+    const char *end = src + m_rdata.size();
+    Name primary_master_name;
+    Name responsible_person_name;
+    uint32_t minimum = 0;
+    src = primary_master_name.decode(syms, src, end);
+    src = responsible_person_name.decode(syms, src, end);
+    if (src == nullptr || (end - src) != 20) {
+        return decode_error(DecodeError::BAD_RDATA);
+    }
+    get32bits(src + 16, end, minimum);
+    return minimum;
+}
+
 const char *RR::decode(const SymbolTable& syms, const char *src, const char *end)
 {
-    src = m_name.decode(syms, src, end);
-    src = get16bits(src, end, m_rrtype);
+    DecodeResult result = try_decode(syms, src, end);
+    return result ? *result : nullptr;
+}
+
+DecodeResult RR::try_decode(const SymbolTable& syms, const char *src, const char *end)
+{
+    DecodeResult name = m_name.try_decode(syms, src, end);
+    if (!name) return name;
+    src = get16bits(*name, end, m_rrtype);
     src = get16bits(src, end, m_rrclass);
     src = get32bits(src, end, m_ttl);
     src = get_uint16_sized_string(src, end, m_rdata);
+    if (src == nullptr) return decode_error(DecodeError::TRUNCATED);
     return src;
 }
 
-char *RR::encode(char *dst, const char *end) const noexcept
+char *RR::encode(const Name& owner, char *dst, const char *end) const noexcept
 {
-    dst = m_name.encode(dst, end);
+    dst = owner.encode(dst, end);
     dst = put16bits(dst, end, m_rrtype);
     dst = put16bits(dst, end, m_rrclass);
     dst = put32bits(dst, end, m_ttl);
@@ -278,73 +155,122 @@ const char *RR::decode_repr(const char *src, const char *end)
     while (src != end && isspace(*src)) ++src;
     src = m_name.decode_repr(src, end);
     if (src == nullptr) return nullptr;
-    std::regex rx("\\s*(\\d+)\\s+(\\S+)\\s+(\\S+)\\s+(.*?)\\s*$");
-    std::cmatch m;
-    if (!std::regex_match(src, end, m, rx)) {
-        throw dns::UnsupportedException("Zonefile RR has the wrong format");
+
+    // The TTL, class and type, then the RDATA up to any trailing whitespace.
+    auto wrong_format = []() {
+        return dns::UnsupportedException("Zonefile RR has the wrong format");
+    };
+    auto next_field = [&](const char *p, bool need_space) {
+        const char *q = p;
+        while (q != end && isspace(*q)) ++q;
+        if (need_space && q == p) throw wrong_format();
+        return q;
+    };
+    auto field_end = [&](const char *p) {
+        while (p != end && !isspace(*p)) ++p;
+        return p;
+    };
+    const char *ttl_start = next_field(src, false);
+    const char *p = ttl_start;
+    long long ttl = 0;
+    while (p != end && isdigit(*p)) {
+        if (ttl <= 999999999) ttl = (ttl * 10) + (*p - '0');
+        ++p;
     }
-    int ttl = atoi(m[1].first);
+    if (p == ttl_start) throw wrong_format();
+    const char *rrclass_start = next_field(p, true);
+    const char *rrclass_end = field_end(rrclass_start);
+    const char *rrtype_start = next_field(rrclass_end, true);
+    const char *rrtype_end = field_end(rrtype_start);
+    if (rrtype_start == rrtype_end) throw wrong_format();
+    const char *rdata = next_field(rrtype_end, true);
+    const char *rdata_end = end;
+    while (rdata_end != rdata && isspace(rdata_end[-1])) --rdata_end;
+
     if (1 <= ttl && ttl <= 999999999) {
         m_ttl = ttl;
     } else {
         throw dns::UnsupportedException("Zonefile RR has an out-of-range TTL");
     }
+    std::string rrclass(rrclass_start, rrclass_end);
     try {
-        m_rrclass = int(RRClass(m.str(2)));
+        m_rrclass = int(RRClass(rrclass));
         if (m_rrclass != RRClass::IN) {
             throw dns::UnsupportedException("Zonefile RR has a class other than IN");
         }
     } catch (const dns::UnsupportedException&) {
-        throw dns::UnsupportedException("Zonefile RR has unknown class ", m.str(2));
+        throw dns::UnsupportedException("Zonefile RR has unknown class ", rrclass);
     }
+    std::string rrtype(rrtype_start, rrtype_end);
     try {
-        m_rrtype = int(RRType(m.str(3)));
+        m_rrtype = int(RRType(rrtype));
         if (m_rrtype == RRType::ANY) {
             throw dns::UnsupportedException("Zonefile RR has type ANY");
         }
     } catch (const dns::UnsupportedException&) {
-        throw dns::UnsupportedException("Zonefile RR has unknown type ", m.str(3));
+        throw dns::UnsupportedException("Zonefile RR has unknown type ", rrtype);
     }
     // See whether the rdata matches the "RR of unknown type" text format.
-    if (m[4].length() >= 2 && m[4].first[0] == '\\' && m[4].first[1] == '#') {
-        m_rdata = decode_unknown_rdata_repr(m[4].first, m[4].second);
+    const RRTypeHandlers& handlers = rrtype_handlers(m_rrtype);
+    if (rdata_end - rdata >= 2 && rdata[0] == '\\' && rdata[1] == '#') {
+        m_rdata = decode_unknown_rdata_repr(rdata, rdata_end);
+    } else if (handlers.decode_rdata_repr != nullptr) {
+        m_rdata = handlers.decode_rdata_repr(rdata, rdata_end);
     } else {
-        for (auto&& rrt : by_rrtype) {
-            // See whether we know a custom RDATA-parsing routine for this specific rrtype.
-            if (RRType(m_rrtype) == rrt.type) {
-                assert(rrt.decode_rdata_repr != nullptr);
-                m_rdata = rrt.decode_rdata_repr(m[4].first, m[4].second);
-                break;
-            }
-        }
+        throw dns::UnsupportedException("Zonefile RR of type ", RRType(m_rrtype).repr(), " must be in RFC 3597 format");
     }
     return end;
 }
 
 std::string RR::repr(const SymbolTable& syms) const
 {
-    std::string result;
-    result += m_name.repr();
-    do { result += ' '; } while (result.size() < 32);
-    do { result += ' '; } while ((result.size() % 8) != 0);
-    result += std::to_string(m_ttl);
-    do { result += ' '; } while ((result.size() % 8) != 0);
-    assert(m_rrclass == RRClass::IN);
-    result += "IN";
-    result += ' ';
-    result += RRType(m_rrtype).repr();
-    do { result += ' '; } while ((result.size() % 8) != 0);
-    bool success = false;
-    for (auto&& rrt : by_rrtype) {
-        if (int(rrt.type) == m_rrtype) {
-            assert(rrt.encode_rdata_repr != nullptr);
-            result += rrt.encode_rdata_repr(syms, m_rdata);
-            success = true;
-            break;
-        }
+    std::string result(max_repr_size(m_rdata.size()), '\0');
+    char *end = repr(syms, m_name, RRType(m_rrtype), RRClass(m_rrclass), m_ttl,
+                     m_rdata.data(), m_rdata.size(), &result[0]);
+    result.resize(end - result.data());
+    return result;
+}
+
+size_t RR::max_repr_size(size_t rdlength) noexcept
+{
+    // The owner, then padding, TTL, class and type take at most 64 more.
+    return Name::max_repr_size + 64 + max_rdata_repr_size(rdlength);
+}
+
+char *RR::repr(const SymbolTable& syms, const Name& owner, RRType rrtype, RRClass rrclass, uint32_t ttl,
+               const char *rdata, size_t rdlength, char *dst) noexcept
+{
+    ReprWriter out(dst);
+    auto column = [&]() { return size_t(out.end() - dst); };
+    out.append_name(owner);
+    do { out += ' '; } while (column() < 32);
+    do { out += ' '; } while ((column() % 8) != 0);
+    out.append_number(ttl);
+    do { out += ' '; } while ((column() % 8) != 0);
+    if (const char *m = rrclass.mnemonic()) {
+        out += m;
+    } else {
+        out += "CLASS";
+        out.append_number(int(rrclass));
     }
-    if (!success) {
-        result += encode_unknown_rdata_repr(m_rdata);
+    out += ' ';
+    if (const char *m = rrtype.mnemonic()) {
+        out += m;
+    } else {
+        out += "TYPE";
+        out.append_number(int(rrtype));
     }
-    return result;
+    do { out += ' '; } while ((column() % 8) != 0);
+
+    // Names in RDATA that may not be compressed must not be followed
+    // through the message's compression pointers either.
+    static const SymbolTable no_symbols;
+    const RRTypeHandlers& handlers = rrtype_handlers(int(rrtype));
+    ReprWriter rdata_out = out;
+    if (handlers.encode_rdata_repr == nullptr ||
+        !handlers.encode_rdata_repr(handlers.compressible ? syms : no_symbols, rdata, rdata + rdlength, rdata_out)) {
+        rdata_out = out;
+        encode_unknown_rdata_repr(rdata, rdlength, rdata_out);
+    }
+    return rdata_out.end();
 }
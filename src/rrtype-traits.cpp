@@ -0,0 +1,543 @@
+
+#include "bytes.h"
+#include "exception.h"
+#include "ipaddressv4.h"
+#include "name.h"
+#include "nonstd.h"
+#include "rrtype.h"
+#include "rrtype-traits.h"
+#include "symboltable.h"
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <string>
+#include <string.h>
+#include <sys/socket.h>
+
+using namespace dns;
+
+constexpr const char *RRTypeTraitsBase::mnemonic;
+constexpr RRTypeHandlers::DecodeReprFn RRTypeTraitsBase::decode_rdata_repr;
+constexpr RRTypeHandlers::EncodeReprFn RRTypeTraitsBase::encode_rdata_repr;
+
+namespace {
+
+const char *skip_space(const char *p, const char *end) noexcept
+{
+    while (p != end && isspace(*p)) ++p;
+    return p;
+}
+
+// Parse the decimal number at p, up to `max`, which must be followed by
+// whitespace or the end; and skip that whitespace.
+bool decode_number(const char *& p, const char *end, uint32_t max, uint32_t& value) noexcept
+{
+    if (p == end || !isdigit(*p)) return false;
+    uint64_t n = 0;
+    while (p != end && isdigit(*p)) {
+        n = (n * 10) + (*p++ - '0');
+        if (n > max) return false;
+    }
+    if (p != end && !isspace(*p)) return false;
+    p = skip_space(p, end);
+    value = n;
+    return true;
+}
+
+
+// A domain name, written out whole, as the last field of the RDATA.
+void decode_last_name(const char *src, const char *end, std::string& out, const char *type)
+{
+    Name name;
+    src = name.decode_repr(src, end);
+    if (src != end) throw dns::UnsupportedException("Zonefile RR of type ", type, " has the wrong format");
+    out.append(name.wire_data(), name.wire_size());
+}
+
+const char *encode_name(const SymbolTable& syms, const char *src, const char *end, ReprWriter& out)
+{
+    // Reused, so that even a long name doesn't allocate after the first.
+    static thread_local Name name;
+    src = name.decode(syms, src, end);
+    if (src != nullptr) out.append_name(name);
+    return src;
+}
+
+// A <character-string> (RFC 1035, section 5.1), quoted or not, with
+// its backslash escapes undone; and the whitespace after it.
+std::string decode_character_string(const char *& p, const char *end, size_t max_length, const char *type)
+{
+    auto malformed = [&]() {
+        return dns::UnsupportedException("Zonefile RR of type ", type, " has a malformed character-string");
+    };
+    std::string result;
+    bool quoted = (p != end && *p == '"');
+    if (quoted) ++p;
+    while (true) {
+        if (p == end) {
+            if (quoted) throw malformed();
+            break;
+        }
+        if (quoted ? (*p == '"') : isspace(*p)) {
+            p += quoted;
+            break;
+        }
+        if (*p == '\\') {
+            ++p;
+            if (p == end) throw malformed();
+            if (isdigit(*p)) {
+                if (end - p < 3 || !isdigit(p[1]) || !isdigit(p[2])) throw malformed();
+                int value = (p[0] - '0') * 100 + (p[1] - '0') * 10 + (p[2] - '0');
+                if (value > 255) throw malformed();
+                result += char(value);
+                p += 3;
+                continue;
+            }
+        }
+        result += *p++;
+    }
+    if (result.size() > max_length) {
+        throw dns::UnsupportedException("Zonefile RR of type ", type, " has a character-string longer than ", std::to_string(max_length), " octets");
+    }
+    if (p != end && !isspace(*p)) throw malformed();
+    p = skip_space(p, end);
+    return result;
+}
+
+void encode_character_string(const char *src, size_t n, ReprWriter& out)
+{
+    out += '"';
+    for (size_t i = 0; i < n; ++i) {
+        uint8_t ch = src[i];
+        if (ch == '"' || ch == '\\') {
+            out += '\\';
+            out += char(ch);
+        } else if (ch < 0x20 || ch >= 0x7F) {
+            out += '\\';
+            out += char('0' + ch / 100);
+            out += char('0' + ch / 10 % 10);
+            out += char('0' + ch % 10);
+        } else {
+            out += char(ch);
+        }
+    }
+    out += '"';
+}
+
+} // namespace
+
+void ReprWriter::append_number(uint32_t n) noexcept
+{
+    char digits[10];
+    int i = 0;
+    do {
+        digits[i++] = '0' + (n % 10);
+        n /= 10;
+    } while (n != 0);
+    while (i != 0) {
+        *m_dst++ = digits[--i];
+    }
+}
+
+namespace dns {
+
+template<>
+struct RRTypeTraits<RRType::A> {
+    static constexpr const char *mnemonic = "A";
+    static constexpr bool compressible = false;
+
+    static std::string decode_rdata_repr(const char *src, const char *end) {
+        IPAddressV4 ip;
+        try {
+            src = ip.decode_repr(src, end);
+            if (src != end) throw dns::Exception("");
+        } catch (const dns::Exception&) {
+            throw dns::UnsupportedException("Zonefile RR of type A has a malformed IP address");
+        }
+        char buffer[4] = {};
+        ip.encode(buffer, buffer + 4);
+        return std::string(buffer, 4);
+    }
+
+    static bool encode_rdata_repr(const SymbolTable&, const char *src, const char *end, ReprWriter& out) {
+        if (end - src != 4) return false;
+        for (int i = 0; i < 4; ++i) {
+            if (i != 0) out += '.';
+            out.append_number(uint8_t(src[i]));
+        }
+        return true;
+    }
+};
+
+// A type whose RDATA is just a domain name.
+template<int Code>
+struct NameRRTypeTraits {
+    static constexpr bool compressible = true;
+
+    static std::string decode_rdata_repr(const char *src, const char *end) {
+        std::string result;
+        decode_last_name(src, end, result, RRTypeTraits<Code>::mnemonic);
+        return result;
+    }
+
+    static bool encode_rdata_repr(const SymbolTable& syms, const char *src, const char *end, ReprWriter& out) {
+        return encode_name(syms, src, end, out) == end;
+    }
+};
+
+template<>
+struct RRTypeTraits<RRType::NS> : NameRRTypeTraits<RRType::NS> {
+    static constexpr const char *mnemonic = "NS";
+};
+
+template<>
+struct RRTypeTraits<RRType::CNAME> : NameRRTypeTraits<RRType::CNAME> {
+    static constexpr const char *mnemonic = "CNAME";
+};
+
+template<>
+struct RRTypeTraits<RRType::SOA> {
+    static constexpr const char *mnemonic = "SOA";
+    static constexpr bool compressible = true;
+
+    static std::string decode_rdata_repr(const char *src, const char *end) {
+        auto malformed = []() {
+            return dns::UnsupportedException("Zonefile RR of type SOA has the wrong format");
+        };
+        Name primary_master_name;
+        Name responsible_person_name;
+        src = primary_master_name.decode_repr(skip_space(src, end), end);
+        if (src == end || !isspace(*src)) throw malformed();
+        src = responsible_person_name.decode_repr(skip_space(src, end), end);
+        if (src == end || !isspace(*src)) throw malformed();
+        src = skip_space(src, end);
+
+        std::string result;
+        result.append(primary_master_name.wire_data(), primary_master_name.wire_size());
+        result.append(responsible_person_name.wire_data(), responsible_person_name.wire_size());
+        // SERIAL, REFRESH, RETRY, EXPIRE and MINIMUM
+        for (int i = 0; i < 5; ++i) {
+            uint32_t value;
+            if (!decode_number(src, end, 0xFFFFFFFF, value)) throw malformed();
+            char buffer[4] = {};
+            put32bits(buffer, buffer + 4, value);
+            result.append(buffer, 4);
+        }
+        if (src != end) throw malformed();
+        return result;
+    }
+
+    static bool encode_rdata_repr(const SymbolTable& syms, const char *src, const char *end, ReprWriter& out) {
+        src = encode_name(syms, src, end, out);
+        if (src == nullptr) return false;
+        out += ' ';
+        src = encode_name(syms, src, end, out);
+        if (src == nullptr || (end - src) != 20) return false;
+        for (int i = 0; i < 5; ++i) {
+            uint32_t value;
+            src = get32bits(src, end, value);
+            out += ' ';
+            out.append_number(value);
+        }
+        return true;
+    }
+};
+
+template<>
+struct RRTypeTraits<RRType::PTR> : NameRRTypeTraits<RRType::PTR> {
+    static constexpr const char *mnemonic = "PTR";
+};
+
+template<>
+struct RRTypeTraits<RRType::MX> {
+    static constexpr const char *mnemonic = "MX";
+    static constexpr bool compressible = true;
+
+    static std::string decode_rdata_repr(const char *src, const char *end) {
+        uint32_t preference;
+        if (src == end || !isdigit(*src)) {
+            throw dns::UnsupportedException("Zonefile RR of type MX has the wrong format");
+        }
+        if (!decode_number(src, end, 65535, preference)) {
+            throw dns::UnsupportedException("Zonefile RR of type MX has an out-of-range PREFERENCE");
+        }
+        char buffer[2] = {};
+        put16bits(buffer, buffer + 2, preference);
+        std::string result(buffer, 2);
+        decode_last_name(src, end, result, "MX");
+        return result;
+    }
+
+    static bool encode_rdata_repr(const SymbolTable& syms, const char *src, const char *end, ReprWriter& out) {
+        uint16_t preference;
+        src = get16bits(src, end, preference);
+        if (src == nullptr) return false;
+        out.append_number(preference);
+        out += ' ';
+        return encode_name(syms, src, end, out) == end;
+    }
+};
+
+template<>
+struct RRTypeTraits<RRType::TXT> {
+    static constexpr const char *mnemonic = "TXT";
+    static constexpr bool compressible = false;
+
+    static std::string decode_rdata_repr(const char *src, const char *end) {
+        if (src == end) throw dns::UnsupportedException("Zonefile RR of type TXT has no character-strings");
+        std::string result;
+        while (src != end) {
+            std::string s = decode_character_string(src, end, 255, "TXT");
+            result += char(s.size());
+            result += s;
+        }
+        return result;
+    }
+
+    static bool encode_rdata_repr(const SymbolTable&, const char *src, const char *end, ReprWriter& out) {
+        if (src == end) return false;
+        while (src != end) {
+            size_t n = uint8_t(*src++);
+            if (size_t(end - src) < n) return false;
+            encode_character_string(src, n, out);
+            src += n;
+            if (src != end) out += ' ';
+        }
+        return true;
+    }
+};
+
+template<>
+struct RRTypeTraits<RRType::AAAA> {
+    static constexpr const char *mnemonic = "AAAA";
+    static constexpr bool compressible = false;
+
+    static std::string decode_rdata_repr(const char *src, const char *end) {
+        char text[INET6_ADDRSTRLEN];
+        unsigned char address[16];
+        if (size_t(end - src) >= sizeof text) {
+            throw dns::UnsupportedException("Zonefile RR of type AAAA has a malformed IP address");
+        }
+        memcpy(text, src, end - src);
+        text[end - src] = '\0';
+        if (inet_pton(AF_INET6, text, address) != 1) {
+            throw dns::UnsupportedException("Zonefile RR of type AAAA has a malformed IP address");
+        }
+        return std::string(reinterpret_cast<char *>(address), 16);
+    }
+
+    static bool encode_rdata_repr(const SymbolTable&, const char *src, const char *end, ReprWriter& out) {
+        char text[INET6_ADDRSTRLEN];
+        if (end - src != 16) return false;
+        inet_ntop(AF_INET6, src, text, sizeof text);
+        out += text;
+        return true;
+    }
+};
+
+template<>
+struct RRTypeTraits<RRType::SRV> {
+    static constexpr const char *mnemonic = "SRV";
+    static constexpr bool compressible = false;  // RFC 2782
+
+    static std::string decode_rdata_repr(const char *src, const char *end) {
+        // PRIORITY, WEIGHT and PORT, then TARGET
+        std::string result;
+        for (int i = 0; i < 3; ++i) {
+            uint32_t value;
+            if (!decode_number(src, end, 65535, value)) {
+                throw dns::UnsupportedException("Zonefile RR of type SRV has the wrong format");
+            }
+            char buffer[2] = {};
+            put16bits(buffer, buffer + 2, value);
+            result.append(buffer, 2);
+        }
+        decode_last_name(src, end, result, "SRV");
+        return result;
+    }
+
+    static bool encode_rdata_repr(const SymbolTable& syms, const char *src, const char *end, ReprWriter& out) {
+        for (int i = 0; i < 3; ++i) {
+            uint16_t value;
+            src = get16bits(src, end, value);
+            if (src == nullptr) return false;
+            out.append_number(value);
+            out += ' ';
+        }
+        return encode_name(syms, src, end, out) == end;
+    }
+};
+
+template<>
+struct RRTypeTraits<RRType::DS> {
+    static constexpr const char *mnemonic = "DS";
+    static constexpr bool compressible = false;
+
+    static std::string decode_rdata_repr(const char *src, const char *end) {
+        auto malformed = []() {
+            return dns::UnsupportedException("Zonefile RR of type DS has the wrong format");
+        };
+        // KEY TAG, ALGORITHM and DIGEST TYPE, then the DIGEST in hex,
+        // which may contain whitespace (RFC 4034, section 5.3).
+        uint32_t key_tag, algorithm, digest_type;
+        if (!decode_number(src, end, 65535, key_tag) ||
+            !decode_number(src, end, 255, algorithm) ||
+            !decode_number(src, end, 255, digest_type)) {
+            throw malformed();
+        }
+        char buffer[4] = {};
+        put16bits(buffer, buffer + 2, key_tag);
+        buffer[2] = algorithm;
+        buffer[3] = digest_type;
+        std::string result(buffer, 4);
+        int high = -1;
+        for (; src != end; ++src) {
+            if (isspace(*src)) continue;
+            if (!isxdigit(*src)) throw malformed();
+            int digit = isdigit(*src) ? (*src - '0') : (tolower(*src) - 'a' + 10);
+            if (high < 0) {
+                high = digit;
+            } else {
+                result += char((high << 4) | digit);
+                high = -1;
+            }
+        }
+        if (high >= 0 || result.size() == 4) throw malformed();
+        return result;
+    }
+
+    static bool encode_rdata_repr(const SymbolTable&, const char *src, const char *end, ReprWriter& out) {
+        uint16_t key_tag;
+        src = get16bits(src, end, key_tag);
+        if (src == nullptr || (end - src) < 3) return false;
+        out.append_number(key_tag);
+        out += ' ';
+        out.append_number(uint8_t(src[0]));
+        out += ' ';
+        out.append_number(uint8_t(src[1]));
+        out += ' ';
+        for (src += 2; src != end; ++src) {
+            out += "0123456789ABCDEF"[uint8_t(*src) >> 4];
+            out += "0123456789ABCDEF"[uint8_t(*src) & 0xF];
+        }
+        return true;
+    }
+};
+
+template<>
+struct RRTypeTraits<RRType::OPT> : RRTypeTraitsBase {
+    static constexpr const char *mnemonic = "OPT";
+};
+
+template<>
+struct RRTypeTraits<RRType::ANY> : RRTypeTraitsBase {
+    static constexpr const char *mnemonic = "ANY";
+};
+
+template<>
+struct RRTypeTraits<RRType::CAA> {
+    static constexpr const char *mnemonic = "CAA";
+    static constexpr bool compressible = false;
+
+    static std::string decode_rdata_repr(const char *src, const char *end) {
+        // FLAGS, then the TAG, then the VALUE (RFC 8659, section 4.1.1)
+        uint32_t flags;
+        if (!decode_number(src, end, 255, flags)) {
+            throw dns::UnsupportedException("Zonefile RR of type CAA has the wrong format");
+        }
+        const char *tag = src;
+        while (src != end && isalnum(*src)) ++src;
+        size_t tag_length = src - tag;
+        if (tag_length == 0 || tag_length > 15 || src == end || !isspace(*src)) {
+            throw dns::UnsupportedException("Zonefile RR of type CAA has a malformed tag");
+        }
+        src = skip_space(src, end);
+        std::string value = decode_character_string(src, end, 65535, "CAA");
+        if (src != end) throw dns::UnsupportedException("Zonefile RR of type CAA has the wrong format");
+        std::string result;
+        result += char(flags);
+        result += char(tag_length);
+        result.append(tag, tag_length);
+        result += value;
+        return result;
+    }
+
+    static bool encode_rdata_repr(const SymbolTable&, const char *src, const char *end, ReprWriter& out) {
+        if (end - src < 2) return false;
+        size_t tag_length = uint8_t(src[1]);
+        if (tag_length == 0 || size_t(end - src - 2) < tag_length) return false;
+        out.append_number(uint8_t(src[0]));
+        out += ' ';
+        out.append(src + 2, tag_length);
+        out += ' ';
+        src += 2 + tag_length;
+        encode_character_string(src, end - src, out);
+        return true;
+    }
+};
+
+} // namespace dns
+
+namespace {
+
+template<int Code>
+constexpr RRTypeHandlers handlers_for() {
+    return RRTypeHandlers{
+        RRTypeTraits<Code>::mnemonic,
+        RRTypeTraits<Code>::compressible,
+        RRTypeTraits<Code>::decode_rdata_repr,
+        RRTypeTraits<Code>::encode_rdata_repr,
+    };
+}
+
+struct RRTypeTable {
+    RRTypeHandlers entries[rrtype_table_size];
+};
+
+template<int... Codes>
+constexpr RRTypeTable make_table(nonstd::int_sequence<Codes...>) {
+    return RRTypeTable{{ handlers_for<Codes>()... }};
+}
+
+constexpr RRTypeTable rrtype_table = make_table(nonstd::make_int_sequence<rrtype_table_size>());
+
+constexpr RRTypeHandlers unknown_rrtype = handlers_for<rrtype_table_size>();
+
+} // namespace
+
+const RRTypeHandlers& dns::rrtype_handlers(int code) noexcept
+{
+    if (code < 0 || code >= rrtype_table_size) {
+        return unknown_rrtype;
+    }
+    return rrtype_table.entries[code];
+}
+
+int dns::rrtype_from_mnemonic(const char *src, const char *end) noexcept
+{
+    // The handful of known types, found once by walking the table.
+    struct Known {
+        int count = 0;
+        int codes[64];
+        size_t lengths[64];
+        Known() {
+            for (int code = 0; code < rrtype_table_size && count < 64; ++code) {
+                if (const char *m = rrtype_table.entries[code].mnemonic) {
+                    codes[count] = code;
+                    lengths[count] = strlen(m);
+                    count += 1;
+                }
+            }
+        }
+    };
+    static const Known known;
+    size_t n = end - src;
+    for (int i = 0; i < known.count; ++i) {
+        const char *m = rrtype_table.entries[known.codes[i]].mnemonic;
+        if (known.lengths[i] == n && memcmp(m, src, n) == 0) {
+            return known.codes[i];
+        }
+    }
+    return -1;
+}
@@ -1,51 +1,60 @@
 
 #include "exception.h"
 #include "rrtype.h"
+#include "rrtype-traits.h"
 
-#include <regex>
-#include <stdlib.h>
+#include <ctype.h>
 #include <string>
+#include <string.h>
 
 namespace dns {
 
-RRClass::RRClass(const std::string& repr)
+// The number in a generic mnemonic such as "TYPE65280" (RFC 3597,
+// section 5), from 1 to 65535; or -1.
+static int generic_code(const std::string& repr, const char *prefix)
 {
-    for (int i=0; i <= ANY; ++i) {
-        RRClass rrclass(i);
-        if (repr == rrclass.repr()) {
-            *this = rrclass;
-            return;
-        }
+    size_t n = strlen(prefix);
+    if (repr.size() <= n || repr.size() > n + 5 || repr.compare(0, n, prefix) != 0) {
+        return -1;
+    }
+    int value = 0;
+    for (size_t i = n; i < repr.size(); ++i) {
+        if (!isdigit(repr[i])) return -1;
+        value = (value * 10) + (repr[i] - '0');
     }
-    std::smatch m;
-    if (std::regex_match(repr, m, std::regex("CLASS(\\d+)$"))) {
-        int i = atoi(&*m[1].first);
-        if (1 <= i && i <= 65535) {
-            *this = RRClass(i);
-            return;
-        }
+    return (1 <= value && value <= 65535) ? value : -1;
+}
+
+RRClass::RRClass(const std::string& repr)
+{
+    int i = (repr == "IN") ? int(IN) : (repr == "ANY") ? int(ANY) : generic_code(repr, "CLASS");
+    if (i < 0) {
+        throw dns::UnsupportedException("rrclass ", repr, " is unknown or invalid");
     }
-    throw dns::UnsupportedException("rrclass ", repr, " is unknown or invalid");
+    *this = RRClass(i);
 }
 
 RRType::RRType(const std::string& repr)
 {
-    for (int i=0; i <= ANY; ++i) {
-        RRType type(i);
-        if (repr == type.repr()) {
-            *this = type;
-            return;
-        }
+    int i = rrtype_from_mnemonic(repr.data(), repr.data() + repr.size());
+    if (i < 0) {
+        i = generic_code(repr, "TYPE");
     }
-    std::smatch m;
-    if (std::regex_match(repr, m, std::regex("TYPE(\\d+)$"))) {
-        int i = atoi(&*m[1].first);
-        if (1 <= i && i <= 65535) {
-            *this = RRType(i);
-            return;
-        }
+    if (i < 0) {
+        throw dns::UnsupportedException("rrtype ", repr, " is unknown or invalid");
     }
-    throw dns::UnsupportedException("rrtype ", repr, " is unknown or invalid");
+    *this = RRType(i);
+}
+
+const char *RRType::mnemonic() const noexcept
+{
+    return rrtype_handlers(m_value).mnemonic;
+}
+
+std::string RRType::repr() const
+{
+    const char *m = mnemonic();
+    return (m != nullptr) ? std::string(m) : "TYPE" + std::to_string(int(m_value));
 }
 
 } // namespace dns
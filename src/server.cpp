@@ -1,18 +1,38 @@
 
 #include "authoritative-resolver.h"
 #include "exception.h"
-#include "message.h"
-#include "question.h"
+#include "query-view.h"
+#include "response-writer.h"
 #include "server.h"
+#include "stage-tracer.h"
 
 #include <iostream>
 #include <errno.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
 #include <string.h>
 #include <sys/socket.h>
 
 using namespace dns;
 
+// The largest query we can receive, which is also the UDP payload size
+// we advertise in EDNS responses.
+static const int max_query_size = 1024;
+
+std::string Server::RejectCounts::repr() const
+{
+    std::string result;
+    result += ";; REJECTED: malformed " + std::to_string(malformed);
+    result += ", responses " + std::to_string(responses);
+    result += ", NOTIMP " + std::to_string(not_query);
+    result += ", FORMERR " + std::to_string(formerr);
+    result += ", BADVERS " + std::to_string(badvers);
+    result += ", trailing bytes " + std::to_string(trailing_bytes);
+    result += ", too big " + std::to_string(no_room);
+    return result;
+}
+
 void Server::bind_to(int port)
 {
     m_sockfd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -28,94 +48,179 @@ void Server::bind_to(int port)
     }
 }
 
+void Server::send_to_client(const sockaddr_in& addr, const char *packet, const char *end) noexcept
+{
+    sendto(
+        m_sockfd,
+        packet, (end - packet),
+        0,
+        reinterpret_cast<const struct sockaddr *>(&addr), sizeof addr
+    );
+}
+
+char *Server::handle_packet(Workspace& ws, const char *packet, const char *end,
+                            char *out, const char *out_end, const sockaddr_in& client) noexcept
+{
+    return handle_packet(ws, ws.trace, packet, end, out, out_end, client);
+}
+
+template<class Tracer>
+char *Server::handle_packet(Workspace& ws, Tracer& trace, const char *packet, const char *end,
+                            char *out, const char *out_end, const sockaddr_in& client) noexcept
+{
+    QueryView& query = ws.query;
+    RejectCounts& rejects = ws.rejects;
+
+    DecodeResult result = query.parse(packet, end);
+    trace.lap(Stage::PARSE);
+    if (!result) {
+        // Blackhole the malformed packet.
+        rejects.malformed += 1;
+        return nullptr;
+    }
+    const char *parsed = *result;
+
+    if (query.is_response()) {
+        // Blackhole the unsolicited response.
+        rejects.responses += 1;
+        return nullptr;
+    }
+
+    ResponseWriter response(query, out, out_end);
+    if (query.opcode() != Opcode::QUERY) {
+        rejects.not_query += 1;
+        response.setAA(true).setRA(false).setRCode(RCode::NOTIMP);
+    } else if (query.question_count() != 1 ||
+               query.answer_count() != 0 ||
+               query.authority_count() != 0 ||
+               (query.additional_count() != 0 && !query.has_opt())) {
+        // Exactly one question, and nothing but an OPT record besides.
+        rejects.formerr += 1;
+        response.setAA(true).setRA(false).setRCode(RCode::FORMERR);
+    } else if (query.has_opt() && query.edns_version() != 0) {
+        // RFC 6891, section 6.1.3: respond with BADVERS
+        rejects.badvers += 1;
+        response.set_opt(max_query_size, 1).setAA(true).setRA(false);
+    } else {
+        if (parsed != end) {
+            rejects.trailing_bytes += 1;
+        }
+        if (query.has_opt()) {
+            response.set_opt(max_query_size);
+        }
+        response.setAA(true).setRA(false);
+        m_resolver.populate_response(query, response);
+        if (response.rcode() == RCode::REFUSED && m_forwarder != nullptr) {
+            Forwarder::Client fc { client, query.id(), query.is_recursion_desired(), query.question() };
+            auto send = [this](const sockaddr_in& addr, const char *p, const char *e) {
+                send_to_client(addr, p, e);
+            };
+            if (m_forwarder->resolve(std::move(fc), send)) {
+                return nullptr;
+            }
+        }
+    }
+    trace.lap(Stage::RESOLVE);
+
+    char *written = response.finish();
+    trace.lap(Stage::ENCODE);
+    if (written == nullptr) {
+        // The buffer wasn't long enough; blackhole the query.
+        rejects.no_room += 1;
+    }
+    return written;
+}
+
+template char *Server::handle_packet(Workspace&, StageTracer<0>&, const char *, const char *,
+                                     char *, const char *, const sockaddr_in&) noexcept;
+template char *Server::handle_packet(Workspace&, StageTracer<1>&, const char *, const char *,
+                                     char *, const char *, const sockaddr_in&) noexcept;
+template char *Server::handle_packet(Workspace&, StageTracer<64>&, const char *, const char *,
+                                     char *, const char *, const sockaddr_in&) noexcept;
+#if DNS_STAGE_SAMPLING != 0 && DNS_STAGE_SAMPLING != 1 && DNS_STAGE_SAMPLING != 64
+template char *Server::handle_packet(Workspace&, StageTracing&, const char *, const char *,
+                                     char *, const char *, const sockaddr_in&) noexcept;
+#endif
+
+static volatile sig_atomic_t dump_requested = 0;
+
+static void request_dump(int)
+{
+    dump_requested = 1;
+}
+
 void Server::run() noexcept
 {
     std::cout << "DNS Server running..." << std::endl;
 
-    struct sockaddr_in clientAddress;
-    socklen_t addrLen = sizeof clientAddress;
+    // Without SA_RESTART, so that a blocked recvfrom() returns at once.
+    struct sigaction action {};
+    action.sa_handler = request_dump;
+    sigaction(SIGUSR1, &action, nullptr);
 
+    auto send = [this](const sockaddr_in& addr, const char *packet, const char *end) {
+        send_to_client(addr, packet, end);
+    };
+
+    Workspace ws;
     while (true) {
-        Message query;
-
-        auto read_in = [&]() -> bool {
-            char buffer[1024];
-            int nbytes = recvfrom(
-                m_sockfd,
-                buffer, sizeof buffer,
-                0,
-                reinterpret_cast<struct sockaddr *>(&clientAddress), &addrLen
-            );
-            const char *parsed = nullptr;
-            try {
-                parsed = query.decode(buffer, buffer + nbytes);
-            } catch (const dns::Exception& e) {
-                std::cout << "During packet decode: " << e.what() << std::endl;
-            }
-            if (parsed == nullptr) {
-                std::cout << "Failed to parse packet of length " << nbytes << std::endl;
-                // and blackhole the malformed packet
-                return false;
+        if (dump_requested) {
+            dump_requested = 0;
+            std::cout << ws.rejects.repr() << std::endl;
+            ws.trace.dump(std::cout, 0);
+            if (m_forwarder != nullptr) {
+                std::cout << m_forwarder->rejects().repr() << std::endl;
+                std::cout << m_forwarder->cache().stats().repr() << std::endl;
             }
-            if (parsed != buffer + nbytes) {
-                std::cout << "Packet of length " << nbytes
-                    << " parsed as message of length " << (parsed - buffer)
-                    << " with some trailing bytes" << std::endl;
+        }
+
+        if (m_forwarder != nullptr) {
+            // Wait for either a new query or an upstream reply, but
+            // never block on the upstream alone.
+            struct pollfd fds[2] = {
+                { m_sockfd, POLLIN, 0 },
+                { m_forwarder->fd(), POLLIN, 0 },
+            };
+            poll(fds, 2, m_forwarder->next_timeout_ms());
+            if (fds[1].revents & POLLIN) {
+                m_forwarder->on_readable(send);
             }
-            return true;
-        };
-        auto write_out = [&](const Message& response) {
-            char buffer[512];
-            const char *written = response.encode(buffer, buffer + sizeof buffer);
-            if (written == nullptr) {
-                std::cout << "Buffer wasn't long enough to encode response packet" << std::endl;
-                // and blackhole the query: oops!
-            } else {
-                sendto(
-                    m_sockfd,
-                    buffer, (written - buffer),
-                    0,
-                    reinterpret_cast<struct sockaddr *>(&clientAddress), addrLen
-                );
+            m_forwarder->on_timer(send);
+            if (!(fds[0].revents & POLLIN)) {
+                continue;
             }
-        };
-        if (read_in()) {
-            if (query.is_response()) {
-                std::cout << "Packet was an unsolicited response, not a query" << std::endl;
-                // and blackhole the malformed packet
-            } else if (query.opcode() != Opcode::QUERY) {
-                std::cout << "Query had opcode " << query.opcode().repr() << ", not QUERY" << std::endl;
-                Message response = Message::beginResponseTo(query);
-                response.setAA(true).setRA(false).setRCode(RCode::NOTIMP);
-                write_out(response);
-            } else if (query.questions().size() != 1) {
-                std::cout << "Query contained " << (query.questions().empty() ? "no" : "multiple") << " questions in question section" << std::endl;
-                Message response = Message::beginResponseTo(query);
-                response.setAA(true).setRA(false).setRCode(RCode::FORMERR);
-                write_out(response);
-            } else if (query.answers().size() != 0) {
-                std::cout << "Query contained RRs in its answer section" << std::endl;
-                Message response = Message::beginResponseTo(query);
-                response.setAA(true).setRA(false).setRCode(RCode::FORMERR);
-                write_out(response);
-            } else if (query.authority().size() != 0) {
-                std::cout << "Query contained RRs in its authority section" << std::endl;
-                Message response = Message::beginResponseTo(query);
-                response.setAA(true).setRA(false).setRCode(RCode::FORMERR);
-                write_out(response);
-            } else if (query.additional().size() != 0) {
-                // RFC 6891, section 7: if EDNS is unsupported, respond with FORMERR
-                std::cout << "Query contained RRs in its additional section (perhaps due to EDNS?)" << std::endl;
-                Message response = Message::beginResponseTo(query);
-                response.setAA(true).setRA(false).setRCode(RCode::FORMERR);
-                write_out(response);
-            } else {
-                const Question& q = query.questions().front();
-                Message response = Message::beginResponseTo(query);
-                response.setAA(true).setRA(false);
-                m_resolver.populate_response(q, response);
-                write_out(response);
+        }
+
+        if (ws.trace.next_query()) {
+            // Wait for the query first, so that only receiving it is timed.
+            struct pollfd fd = { m_sockfd, POLLIN, 0 };
+            if (poll(&fd, 1, -1) < 0) {
+                continue;
             }
         }
+        ws.trace.start();
+
+        struct sockaddr_in clientAddress;
+        socklen_t addrLen = sizeof clientAddress;
+        char buffer[max_query_size];
+        int nbytes = recvfrom(
+            m_sockfd,
+            buffer, sizeof buffer,
+            0,
+            reinterpret_cast<struct sockaddr *>(&clientAddress), &addrLen
+        );
+        if (nbytes < 0) {
+            continue;
+        }
+        ws.trace.lap(Stage::RECV);
+        char out[512];
+        const char *written = handle_packet(ws, buffer, buffer + nbytes, out, out + sizeof out, clientAddress);
+        if (written != nullptr) {
+            // Only queries answered here count towards the total; those
+            // dropped or forwarded took a different path.
+            send_to_client(clientAddress, out, written);
+            ws.trace.lap(Stage::SEND);
+            ws.trace.finish();
+        }
     }
 }
@@ -0,0 +1,65 @@
+
+#include "stage-tracer.h"
+
+#include <chrono>
+#include <ostream>
+#include <stdio.h>
+
+using namespace dns;
+
+constexpr int StageHistogram::bucket_count;
+
+double dns::tsc_ticks_per_ns()
+{
+    static const double ticks_per_ns = []() {
+        using clock = std::chrono::steady_clock;
+        auto start = clock::now();
+        uint64_t ticks = read_tsc();
+        while (clock::now() - start < std::chrono::milliseconds(20)) {
+        }
+        ticks = read_tsc() - ticks;
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+        return double(ticks) / elapsed.count();
+    }();
+    return ticks_per_ns;
+}
+
+uint64_t StageHistogram::quantile(double q) const noexcept
+{
+    uint64_t rank = uint64_t(q * m_count + 0.5);
+    if (rank < 1) rank = 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < bucket_count; ++b) {
+        seen += m_buckets[b];
+        if (seen >= rank) {
+            if (b < 4) return b;
+            int msb = b / 4 + 1;
+            uint64_t upper = (uint64_t(4 + b % 4 + 1) << (msb - 2)) - 1;
+            return (upper < m_max) ? upper : m_max;
+        }
+    }
+    return m_max;
+}
+
+void dns::dump_stage_histograms(std::ostream& os, int worker, const StageHistogram *histograms, unsigned sample_every)
+{
+    static const char *const names[stage_count] = {"recv", "parse", "resolve", "encode", "send", "total"};
+    double ticks_per_ns = tsc_ticks_per_ns();
+    char line[160];
+    snprintf(line, sizeof line, ";; worker %d: stage times in ns, of 1 in %u queries (%.3f ticks per ns)",
+             worker, sample_every, ticks_per_ns);
+    os << line << "\n";
+    snprintf(line, sizeof line, ";; %-8s %10s %9s %9s %9s %9s %9s %9s",
+             "stage", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+    os << line << "\n";
+    for (int s = 0; s < stage_count; ++s) {
+        const StageHistogram& h = histograms[s];
+        if (h.count() == 0) continue;
+        snprintf(line, sizeof line, ";; %-8s %10llu %9.0f %9.0f %9.0f %9.0f %9.0f %9.0f",
+                 names[s], (unsigned long long)h.count(), h.sum() / ticks_per_ns / h.count(),
+                 h.quantile(0.5) / ticks_per_ns, h.quantile(0.9) / ticks_per_ns,
+                 h.quantile(0.99) / ticks_per_ns, h.quantile(0.999) / ticks_per_ns, h.max() / ticks_per_ns);
+        os << line << "\n";
+    }
+    os.flush();
+}
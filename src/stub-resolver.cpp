@@ -1,4 +1,5 @@
 
+#include "bytes.h"
 #include "exception.h"
 #include "message.h"
 #include "nonstd.h"
@@ -11,6 +12,7 @@
 #include <errno.h>
 #include <netinet/in.h>
 #include <stdlib.h>
+#include <string>
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -24,11 +26,22 @@ StubResolver::StubResolver(Upstream upstream)
 
 std::future<Message> StubResolver::async_resolve(const Message& query, nonstd::milliseconds timeout) const
 {
+    std::future<Reply> reply = async_query(query, timeout);
+    return std::async(std::launch::deferred, [](std::future<Reply> r) -> Message {
+        return std::move(r.get().message);
+    }, std::move(reply));
+}
+
+std::future<StubResolver::Reply> StubResolver::async_query(const Message& query, nonstd::milliseconds timeout) const
+{
+    using clock = std::chrono::steady_clock;
+
     const Upstream& upstream = this->m_upstreams.at(0);
 
     Upstream ephemeral_port("127.0.0.1", 0);
     int sockfd = ephemeral_port.bind_udp_socket(timeout);
 
+    auto start = clock::now();
     char buffer[512];
     const char *end = query.encode(buffer, buffer + sizeof buffer);
     if (end == nullptr) {
@@ -50,9 +63,19 @@ std::future<Message> StubResolver::async_resolve(const Message& query, nonstd::m
 
     // Now listen until we hear a response. (TODO: this is awkward and bad)
 
-    return std::async([sockfd]() -> Message {
+    // A reply must answer this query: its ID, and the question section
+    // exactly as we sent it (as AsyncClient checks).
+    uint16_t id = query.id();
+    std::string question_wire;
+    for (auto&& q : query.questions()) {
+        char qbuffer[512];
+        char *q_end = q.encode(qbuffer, qbuffer + sizeof qbuffer);
+        question_wire.append(qbuffer, q_end);
+    }
+    return std::async([sockfd, question_wire, id, start]() -> Reply {
         char buffer[1024];
-        Message response;
+        Reply reply;
+        Message& response = reply.message;
 
         while (true) {
             struct sockaddr_in serverAddress;
@@ -63,30 +86,44 @@ std::future<Message> StubResolver::async_resolve(const Message& query, nonstd::m
                 0,
                 reinterpret_cast<struct sockaddr *>(&serverAddress), &addrLen
             );
+            if (nbytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                close(sockfd);
+                throw dns::Exception("Timed out waiting for a response");
+            }
             std::cout << "Received " << nbytes << " bytes!" << std::endl;
             if (nbytes <= 0) {
                 continue;
             }
-            const char *parsed = nullptr;
-            try {
-                parsed = response.decode(buffer, buffer + nbytes);
-            } catch (const dns::Exception& e) {
-                std::cout << "During packet decode: " << e.what() << std::endl;
+            uint16_t reply_id;
+            uint16_t fields;
+            const char *src = get16bits(buffer, buffer + nbytes, reply_id);
+            src = get16bits(src, buffer + nbytes, fields);
+            if (src == nullptr || reply_id != id || (fields & 0x8000) == 0) {
+                std::cout << "Discarding packet that is not a response to our query" << std::endl;
+                continue;
+            }
+            if (nbytes < 12 + question_wire.size() ||
+                memcmp(buffer + 12, question_wire.data(), question_wire.size()) != 0) {
+                std::cout << "Discarding response to a different question" << std::endl;
                 continue;
             }
-            if (parsed == nullptr) {
-                std::cout << "Failed to parse packet of length " << nbytes << std::endl;
+            DecodeResult result = response.try_decode(buffer, buffer + nbytes);
+            if (!result) {
+                std::cout << "Failed to parse packet of length " << nbytes << ": " << result.error().repr() << std::endl;
                 continue;
             }
+            const char *parsed = *result;
             if (parsed != buffer + nbytes) {
                 std::cout << "Packet of length " << nbytes
                     << " parsed as message of length " << (parsed - buffer)
                     << " with some trailing bytes" << std::endl;
             }
+            reply.bytes_received = nbytes;
+            reply.rtt = std::chrono::duration_cast<nonstd::microseconds>(clock::now() - start);
             break;
         }
 
         close(sockfd);
-        return response;
+        return reply;
     });
 }
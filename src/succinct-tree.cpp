@@ -0,0 +1,209 @@
+
+#include "succinct-tree.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <limits>
+#include <vector>
+
+using namespace dns;
+
+const size_t SuccinctTree::block_bits;
+
+namespace {
+
+// For each byte, read from its lowest bit: how far the excess ('(' less
+// ')') moves over the whole byte, and the least it gets to along the way.
+struct ByteTables {
+    int8_t excess[256];
+    int8_t min[256];
+
+    ByteTables() {
+        for (int b = 0; b < 256; ++b) {
+            int e = 0;
+            int m = 8;
+            for (int i = 0; i < 8; ++i) {
+                e += ((b >> i) & 1) ? 1 : -1;
+                m = std::min(m, e);
+            }
+            excess[b] = e;
+            min[b] = m;
+        }
+    }
+};
+
+const ByteTables byte_tables;
+
+} // namespace
+
+SuccinctTree::SuccinctTree(const std::vector<uint32_t>& degrees) :
+    m_size(degrees.size()), m_bits(2 * degrees.size())
+{
+    // One word more than the bits need, so that rank1(m_bits) may look at it.
+    m_words.assign(m_bits / 64 + 1, 0);
+    size_t i = 0;
+    auto push = [&](bool open) {
+        if (open) m_words[i / 64] |= uint64_t(1) << (i % 64);
+        i += 1;
+    };
+    if (m_size != 0) {
+        push(true);
+        for (uint32_t d : degrees) {
+            for (uint32_t k = 0; k < d; ++k) push(true);
+            push(false);
+        }
+    }
+    assert(i == m_bits);
+
+    size_t blocks = m_bits / block_bits + 1;
+    m_ranks.assign(blocks + 1, 0);
+    size_t words_per_block = block_bits / 64;
+    for (size_t b = 0; b < blocks; ++b) {
+        size_t count = 0;
+        for (size_t w = b * words_per_block; w < (b + 1) * words_per_block && w < m_words.size(); ++w) {
+            count += __builtin_popcountll(m_words[w]);
+        }
+        m_ranks[b + 1] = m_ranks[b] + count;
+    }
+
+    m_leaves = 1;
+    while (m_leaves < blocks) m_leaves *= 2;
+    m_min_tree.assign(2 * m_leaves, std::numeric_limits<int32_t>::max());
+    long excess = 0;
+    for (size_t j = 0; j < m_bits; ++j) {
+        excess += bit(j) ? 1 : -1;
+        int32_t& m = m_min_tree[m_leaves + j / block_bits];
+        m = std::min<int32_t>(m, excess);
+    }
+    for (size_t n = m_leaves - 1; n >= 1; --n) {
+        m_min_tree[n] = std::min(m_min_tree[2 * n], m_min_tree[2 * n + 1]);
+    }
+}
+
+size_t SuccinctTree::memory_bytes() const noexcept
+{
+    return m_words.size() * sizeof(uint64_t) + m_ranks.size() * sizeof(uint32_t) +
+           m_min_tree.size() * sizeof(int32_t);
+}
+
+size_t SuccinctTree::rank1(size_t i) const noexcept
+{
+    size_t b = i / block_bits;
+    size_t n = m_ranks[b];
+    for (size_t w = b * (block_bits / 64); w < i / 64; ++w) {
+        n += __builtin_popcountll(m_words[w]);
+    }
+    if (i % 64 != 0) {
+        n += __builtin_popcountll(m_words[i / 64] & ((uint64_t(1) << (i % 64)) - 1));
+    }
+    return n;
+}
+
+size_t SuccinctTree::select0(size_t k) const noexcept
+{
+    // The last block with at most k ')' before it, then the word.
+    size_t lo = 0;
+    size_t hi = m_ranks.size() - 1;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (mid * block_bits - m_ranks[mid] <= k) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    k -= lo * block_bits - m_ranks[lo];
+    size_t w = lo * (block_bits / 64);
+    while (true) {
+        size_t zeros = 64 - __builtin_popcountll(m_words[w]);
+        if (k < zeros) break;
+        k -= zeros;
+        w += 1;
+    }
+    uint64_t x = ~m_words[w];
+    for (size_t j = 0; j < k; ++j) {
+        x &= x - 1;
+    }
+    return w * 64 + __builtin_ctzll(x);
+}
+
+size_t SuccinctTree::position(size_t node) const noexcept
+{
+    // Node r's description starts right after the r-th ')'.
+    return (node == 0) ? 1 : select0(node - 1) + 1;
+}
+
+SuccinctTree::Children SuccinctTree::children(size_t node) const noexcept
+{
+    size_t p = position(node);
+    return Children{node, p, select0(node) - p};
+}
+
+size_t SuccinctTree::child(const Children& children, size_t k) const noexcept
+{
+    assert(k < children.count);
+    if (k == 0) {
+        return children.node + 1;
+    }
+    size_t q = find_close(children.position + children.count - 1 - k) + 1;
+    return q - rank1(q);  // the number of ')' before it
+}
+
+// Walk the bits [from, to), starting with the excess before `from`, and
+// stop at the first where the excess comes down to `target`.
+bool SuccinctTree::scan(size_t from, size_t to, long& excess, long target, size_t& found) const noexcept
+{
+    size_t j = from;
+    while (j < to) {
+        if (j % 8 == 0 && j + 8 <= to) {
+            uint8_t byte = m_words[j / 64] >> (j % 64);
+            if (excess + byte_tables.min[byte] > target) {
+                excess += byte_tables.excess[byte];
+                j += 8;
+                continue;
+            }
+        }
+        excess += bit(j) ? 1 : -1;
+        if (excess <= target) {
+            found = j;
+            return true;
+        }
+        j += 1;
+    }
+    return false;
+}
+
+// The first block at or after `from` whose least excess is at most
+// `target`, within the blocks [lo, hi) under `node` of the min tree; or -1.
+long SuccinctTree::first_block(size_t node, size_t lo, size_t hi, size_t from, long target) const noexcept
+{
+    if (hi <= from || m_min_tree[node] > target) {
+        return -1;
+    }
+    if (hi - lo == 1) {
+        return lo;
+    }
+    size_t mid = (lo + hi) / 2;
+    long b = first_block(2 * node, lo, mid, from, target);
+    return (b >= 0) ? b : first_block(2 * node + 1, mid, hi, from, target);
+}
+
+size_t SuccinctTree::find_close(size_t i) const noexcept
+{
+    // The first ')' after i that brings the excess below what it was at i.
+    long excess = 2 * long(rank1(i + 1)) - long(i + 1);
+    long target = excess - 1;
+    size_t found = 0;
+    size_t b = i / block_bits;
+    if (scan(i + 1, std::min((b + 1) * block_bits, m_bits), excess, target, found)) {
+        return found;
+    }
+    long next = first_block(1, 0, m_leaves, b + 1, target);
+    assert(next >= 0);
+    size_t start = next * block_bits;
+    excess = 2 * long(m_ranks[next]) - long(start);
+    bool ok = scan(start, std::min(start + block_bits, m_bits), excess, target, found);
+    assert(ok);
+    (void)ok;
+    return found;
+}
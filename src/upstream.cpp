@@ -25,7 +25,7 @@ int Upstream::bind_udp_socket(nonstd::milliseconds timeout) const
 
     struct timeval tv;
     tv.tv_sec = (timeout.count() / 1000);
-    tv.tv_usec = (timeout.count() % 1000);
+    tv.tv_usec = (timeout.count() % 1000) * 1000;
     setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(struct timeval));
 
     int rc = bind(sockfd, this->sockaddr(), this->sockaddr_length());
@@ -0,0 +1,334 @@
+
+#include "zone-generator.h"
+#include "exception.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+using namespace dns;
+
+// SplitMix64's finalizer (Steele et al., "Fast splittable pseudorandom
+// number generators", 2014): a bijection that scatters the bits.
+static uint64_t mix(uint64_t x) noexcept
+{
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+// The top 53 bits of a hash, as a double in [0, 1).
+static double unit(uint64_t h) noexcept
+{
+    return (h >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void append_base36(std::string& s, uint64_t n)
+{
+    char buffer[16];
+    char *p = buffer + sizeof buffer;
+    do {
+        *--p = "0123456789abcdefghijklmnopqrstuvwxyz"[n % 36];
+        n /= 36;
+    } while (n != 0);
+    s.append(p, buffer + sizeof buffer);
+}
+
+// log1p(x)/x and expm1(x)/x, with their limits at 0.
+static double log1p_over_x(double x) noexcept
+{
+    return (fabs(x) > 1e-8) ? log1p(x) / x : 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+}
+
+static double expm1_over_x(double x) noexcept
+{
+    return (fabs(x) > 1e-8) ? expm1(x) / x : 1 + x * 0.5 * (1 + x * (1.0 / 3) * (1 + 0.25 * x));
+}
+
+ZipfSampler::ZipfSampler(uint64_t n, double s) : m_n(n), m_s(s)
+{
+    m_integral_x1 = integral(1.5) - 1;
+    m_integral_n = integral(n + 0.5);
+    m_threshold = 2 - integral_inverse(integral(2.5) - h(2));
+}
+
+double ZipfSampler::h(double x) const noexcept
+{
+    return exp(-m_s * log(x));
+}
+
+// An antiderivative of h, and its inverse.
+double ZipfSampler::integral(double x) const noexcept
+{
+    double log_x = log(x);
+    return expm1_over_x((1 - m_s) * log_x) * log_x;
+}
+
+double ZipfSampler::integral_inverse(double x) const noexcept
+{
+    double t = std::max(x * (1 - m_s), -1.0);
+    return exp(log1p_over_x(t) * x);
+}
+
+// The RR types a plain name may own, in the order of their weights in m_type_cdf.
+enum GeneratedType { GEN_A, GEN_AAAA, GEN_MX, GEN_TXT, GEN_CNAME };
+static const char *const generated_types[] = {"A", "AAAA", "MX", "TXT", "CNAME"};
+
+ZoneGenerator::ZoneGenerator(const GeneratorOptions& options) : m_options(options)
+{
+    const GeneratorOptions& o = m_options;
+    if (o.origin.empty() || o.origin.back() != '.') {
+        throw dns::Exception("Origin must be an absolute name: ", o.origin);
+    }
+    if (o.records < 4) {
+        throw dns::Exception("There must be at least 4 records");
+    }
+    if (o.depth < 1 || o.depth > 16) {
+        throw dns::Exception("Depth must be from 1 to 16");
+    }
+    if (o.wildcard_fraction < 0 || o.delegation_fraction < 0 || o.nxdomain_fraction < 0 ||
+        o.wildcard_fraction + o.delegation_fraction > 1 || o.nxdomain_fraction > 1) {
+        throw dns::Exception("Fractions must be from 0 to 1");
+    }
+    if (o.fanout_skew <= 0 || o.query_skew <= 0) {
+        throw dns::Exception("Zipf exponents must be positive");
+    }
+
+    // The weights of all five types, in the order of generated_types.
+    m_type_cdf.assign(5, 0);
+    for (auto&& tw : o.types) {
+        auto it = std::find_if(std::begin(generated_types), std::end(generated_types), [&](const char *t) {
+            return tw.first == t;
+        });
+        if (it == std::end(generated_types) || tw.second < 0) {
+            throw dns::Exception("Can't generate records of type: ", tw.first);
+        }
+        m_type_cdf[it - std::begin(generated_types)] += tw.second;
+    }
+    for (size_t t = 1; t < m_type_cdf.size(); ++t) {
+        m_type_cdf[t] += m_type_cdf[t - 1];
+    }
+    if (m_type_cdf.back() <= 0) {
+        throw dns::Exception("Some type must have a positive weight");
+    }
+
+    // The apex owns three records, and each delegation two.
+    uint64_t n = std::max<uint64_t>(1, (o.records - 3) / (1 + o.delegation_fraction));
+    double ratio = std::max(2.0, pow(double(n), 1.0 / o.depth));
+    double size = 1;
+    uint64_t remaining = n;
+    m_level_start.push_back(0);
+    for (int level = 1; level <= o.depth && remaining != 0; ++level) {
+        size *= ratio;
+        uint64_t take = (level == o.depth) ? remaining : std::min<uint64_t>(remaining, llround(size));
+        m_level_start.push_back(m_level_start.back() + take);
+        remaining -= take;
+    }
+
+    m_parent_samplers.emplace_back();
+    for (int level = 1; level <= levels(); ++level) {
+        m_parent_samplers.emplace_back(level_size(level), o.fanout_skew);
+    }
+    m_query_sampler = ZipfSampler(names(), o.query_skew);
+}
+
+uint64_t ZoneGenerator::hash(uint64_t i, uint64_t salt) const noexcept
+{
+    return mix(m_options.seed ^ mix(i * 64 + salt));
+}
+
+ZoneGenerator::Kind ZoneGenerator::kind(uint64_t i) const noexcept
+{
+    double u = unit(hash(i, 1));
+    if (u < m_options.delegation_fraction) return DELEGATION;
+    if (u < m_options.delegation_fraction + m_options.wildcard_fraction) return WILDCARD;
+    return PLAIN;
+}
+
+size_t ZoneGenerator::type(uint64_t i) const noexcept
+{
+    double u = unit(hash(i, 2)) * m_type_cdf.back();
+    return std::upper_bound(m_type_cdf.begin(), m_type_cdf.end(), u) - m_type_cdf.begin();
+}
+
+bool ZoneGenerator::can_have_children(uint64_t i) const noexcept
+{
+    return kind(i) == PLAIN && type(i) != GEN_CNAME;
+}
+
+int ZoneGenerator::level(uint64_t i) const noexcept
+{
+    return std::upper_bound(m_level_start.begin(), m_level_start.end(), i) - m_level_start.begin();
+}
+
+uint64_t ZoneGenerator::parent(uint64_t i) const noexcept
+{
+    int l = level(i);
+    if (l == 1) {
+        return no_parent;
+    }
+    uint64_t first = m_level_start[l - 2];
+    uint64_t n = level_size(l - 1);
+    uint64_t rank = 0;
+    for (int attempt = 0; attempt < 8; ++attempt) {
+        uint64_t state = hash(i, 8 + attempt);
+        if (m_options.zipf_fanout) {
+            rank = m_parent_samplers[l - 1]([&]() { state = mix(state); return unit(state); }) - 1;
+        } else {
+            rank = uint64_t(unit(state) * n);
+        }
+        if (can_have_children(first + rank)) {
+            return first + rank;
+        }
+    }
+    for (uint64_t k = 1; k < n; ++k) {
+        uint64_t p = first + (rank + k) % n;
+        if (can_have_children(p)) {
+            return p;
+        }
+    }
+    return no_parent;
+}
+
+void ZoneGenerator::append_label(std::string& s, uint64_t i) const
+{
+    static const char *const words[] = {"www", "mail", "api", "cdn", "db", "dev", "edge", "host"};
+    s += words[hash(i, 3) % 8];
+    append_base36(s, i);
+}
+
+void ZoneGenerator::append_name(std::string& s, uint64_t i) const
+{
+    for (uint64_t j = i; j != no_parent; j = parent(j)) {
+        append_label(s, j);
+        s += '.';
+    }
+    s += m_options.origin;
+}
+
+void ZoneGenerator::append_rdata(std::string& s, uint64_t i, size_t type) const
+{
+    char buffer[64];
+    switch (type) {
+        case GEN_A:
+            snprintf(buffer, sizeof buffer, "10.%u.%u.%u",
+                     unsigned(i >> 16) & 0xFF, unsigned(i >> 8) & 0xFF, unsigned(i) & 0xFF);
+            s += buffer;
+            break;
+        case GEN_AAAA:
+            snprintf(buffer, sizeof buffer, "2001:db8::%x:%x", unsigned(i >> 16) & 0xFFFF, unsigned(i) & 0xFFFF);
+            s += buffer;
+            break;
+        case GEN_MX:
+        case GEN_CNAME:
+            // Some earlier name, so that CNAME chains can't loop.
+            if (type == GEN_MX) s += "10 ";
+            if (i == 0) {
+                s += "ns." + m_options.origin;
+            } else {
+                append_name(s, hash(i, 4) % i);
+            }
+            break;
+        case GEN_TXT:
+            s += "\"generated ";
+            append_base36(s, i);
+            s += '"';
+            break;
+    }
+}
+
+uint64_t ZoneGenerator::write_zone(FILE *out) const
+{
+    const std::string& origin = m_options.origin;
+    uint64_t records = 3;
+    fprintf(out, "%s 3600 IN SOA ns.%s hostmaster.%s 1 7200 3600 1209600 3600\n",
+            origin.c_str(), origin.c_str(), origin.c_str());
+    fprintf(out, "%s 3600 IN NS ns.%s\n", origin.c_str(), origin.c_str());
+    fprintf(out, "ns.%s 3600 IN A 192.0.2.1\n", origin.c_str());
+
+    std::string name;
+    std::string line;
+    for (uint64_t i = 0; i < names(); ++i) {
+        name.clear();
+        append_name(name, i);
+        line.clear();
+        switch (kind(i)) {
+            case DELEGATION:
+                line += name + " 3600 IN NS ns." + name + "\n";
+                line += "ns." + name + " 3600 IN A ";
+                append_rdata(line, i, GEN_A);
+                records += 2;
+                break;
+            case WILDCARD:
+            case PLAIN:
+                if (kind(i) == WILDCARD) line += "*.";
+                line += name + " 3600 IN " + generated_types[type(i)] + " ";
+                append_rdata(line, i, type(i));
+                records += 1;
+                break;
+        }
+        line += '\n';
+        fputs(line.c_str(), out);
+    }
+    if (ferror(out)) {
+        throw dns::Exception("Could not write the zone");
+    }
+    return records;
+}
+
+uint64_t ZoneGenerator::write_queries(FILE *out, uint64_t count) const
+{
+    // Spread the popular ranks over the levels, by visiting the names with
+    // a stride that is coprime to their number.
+    uint64_t n = names();
+    uint64_t stride = 1000003;
+    while (true) {
+        uint64_t a = stride, b = n;
+        while (b != 0) { uint64_t t = a % b; a = b; b = t; }
+        if (a == 1) break;
+        stride += 2;
+    }
+    uint64_t offset = hash(n, 5) % n;
+
+    uint64_t state = hash(count, 6);
+    auto next = [&]() { state = mix(state); return unit(state); };
+    uint64_t nxdomains = 0;
+    std::string line;
+    for (uint64_t q = 0; q < count; ++q) {
+        line.clear();
+        if (next() < m_options.nxdomain_fraction) {
+            // No generated label has a hyphen, and the apex has no wildcard.
+            line += "nx-";
+            append_base36(line, mix(state) >> 16);
+            line += "." + m_options.origin + " A";
+            nxdomains += 1;
+        } else {
+            uint64_t i = ((m_query_sampler(next) - 1) * stride + offset) % n;
+            switch (kind(i)) {
+                case DELEGATION:
+                    append_name(line, i);
+                    line += " A";
+                    break;
+                case WILDCARD:
+                    line += "w";
+                    append_base36(line, mix(state) >> 40);
+                    line += ".";
+                    // fall through
+                case PLAIN:
+                    append_name(line, i);
+                    line += " ";
+                    line += generated_types[type(i)];
+                    break;
+            }
+        }
+        line += '\n';
+        fputs(line.c_str(), out);
+    }
+    if (ferror(out)) {
+        throw dns::Exception("Could not write the queries");
+    }
+    return nxdomains;
+}
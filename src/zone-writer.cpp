@@ -0,0 +1,79 @@
+
+#include "zone-writer.h"
+#include "exception.h"
+#include "symboltable.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace dns;
+
+ZoneWriter::ZoneWriter(Sink sink, size_t buffer_size) :
+    m_sink(std::move(sink)),
+    m_buffer(std::max(buffer_size, RR::max_repr_size(65535) + 1))
+{
+}
+
+ZoneWriter::Sink ZoneWriter::to_fd(int fd)
+{
+    return [fd](const char *data, size_t n) {
+        while (n != 0) {
+            ssize_t written = ::write(fd, data, n);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                throw dns::Exception("Could not write the zone: ", strerror(errno));
+            }
+            data += written;
+            n -= written;
+        }
+    };
+}
+
+void ZoneWriter::reserve(size_t n)
+{
+    if (m_buffer.size() - m_used < n) {
+        flush();
+    }
+}
+
+void ZoneWriter::write(const RR& rr)
+{
+    write(rr.name(), rr.rrtype(), rr.rrclass(), rr.ttl(), rr.rdata().data(), rr.rdata().size());
+}
+
+void ZoneWriter::write(const Name& owner, RRType rrtype, RRClass rrclass, uint32_t ttl,
+                       const char *rdata, size_t rdlength)
+{
+    // Zone-file RDATA has no compression pointers to follow.
+    static const SymbolTable no_symbols;
+    reserve(RR::max_repr_size(rdlength) + 1);
+    char *end = RR::repr(no_symbols, owner, rrtype, rrclass, ttl, rdata, rdlength, m_buffer.data() + m_used);
+    *end++ = '\n';
+    m_used = end - m_buffer.data();
+    m_records += 1;
+}
+
+void ZoneWriter::write_line(const std::string& line)
+{
+    if (line.size() + 1 > m_buffer.size()) {
+        flush();
+        m_sink(line.data(), line.size());
+        m_sink("\n", 1);
+    } else {
+        reserve(line.size() + 1);
+        memcpy(m_buffer.data() + m_used, line.data(), line.size());
+        m_buffer[m_used + line.size()] = '\n';
+        m_used += line.size() + 1;
+    }
+    m_directives += 1;
+}
+
+void ZoneWriter::flush()
+{
+    if (m_used != 0) {
+        m_sink(m_buffer.data(), m_used);
+        m_used = 0;
+    }
+}